@@ -0,0 +1,233 @@
+#include "sdk_common.h"
+#include "alarm_ack.h"
+#include <string.h>
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "alarm_util.h"
+
+/**@brief   Command in flight. */
+typedef struct
+{
+    bool     used;
+    bool     report;                                                /**< Belongs to the current link. */
+    uint8_t  type;
+    uint8_t  seq;
+    uint8_t  retries;
+    uint16_t cmd_id;
+    uint16_t length;
+    uint32_t first_tx_at;                                           /**< app_timer counter value of the first transmission. */
+    uint32_t last_tx_at;
+    uint8_t  payload[ALARM_ACK_PAYLOAD_MAX_LEN];
+} entry_t;
+
+APP_TIMER_DEF(m_timer_id);
+
+static alarm_ack_init_t  m_init;
+static entry_t           m_window[ALARM_ACK_WINDOW];
+static bool              m_timer_running;
+static alarm_ack_stats_t m_stats;
+
+
+static void report(entry_t const * p_entry, alarm_ack_status_t status, uint32_t rtt_ms)
+{
+    alarm_ack_report_t rpt;
+
+    if (!p_entry->report)
+    {
+        return;
+    }
+
+    rpt.cmd_id  = p_entry->cmd_id;
+    rpt.status  = status;
+    rpt.retries = p_entry->retries;
+    rpt.rtt_ms  = (uint16_t)MIN(rtt_ms, UINT16_MAX);
+    m_init.report(&rpt);
+}
+
+
+/**@brief Function for retransmitting overdue commands and giving up on those out of retries. */
+static void timeout_handler(void * p_context)
+{
+    uint32_t now     = app_timer_cnt_get();
+    bool     pending = false;
+
+    UNUSED_PARAMETER(p_context);
+
+    for (uint8_t i = 0; i < ALARM_ACK_WINDOW; i++)
+    {
+        entry_t * p_entry = &m_window[i];
+
+        if (!p_entry->used)
+        {
+            continue;
+        }
+
+        if (ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(now, p_entry->last_tx_at)) < ALARM_ACK_TIMEOUT_MS)
+        {
+            pending = true;
+            continue;
+        }
+
+        if (p_entry->retries == ALARM_ACK_RETRIES_MAX)
+        {
+            m_stats.failed++;
+            report(p_entry, ALARM_ACK_STATUS_FAILED, 0);
+            p_entry->used = false;
+            continue;
+        }
+
+        p_entry->retries++;
+        p_entry->last_tx_at = now;
+        m_stats.retransmits++;
+        (void)m_init.send(p_entry->type, p_entry->seq, p_entry->payload, p_entry->length);
+        pending = true;
+    }
+
+    if (!pending)
+    {
+        CRITICAL_REGION_ENTER();
+        // A command sent since the scan above keeps the timer running.
+        for (uint8_t i = 0; i < ALARM_ACK_WINDOW; i++)
+        {
+            pending = pending || m_window[i].used;
+        }
+        if (!pending)
+        {
+            (void)app_timer_stop(m_timer_id);
+            m_timer_running = false;
+        }
+        CRITICAL_REGION_EXIT();
+    }
+}
+
+
+ret_code_t alarm_ack_init(alarm_ack_init_t const * p_init)
+{
+    VERIFY_PARAM_NOT_NULL(p_init);
+    VERIFY_PARAM_NOT_NULL(p_init->send);
+    VERIFY_PARAM_NOT_NULL(p_init->report);
+
+    m_init          = *p_init;
+    m_timer_running = false;
+    memset(m_window, 0, sizeof(m_window));
+    alarm_ack_link_reset();
+
+    return app_timer_create(&m_timer_id, APP_TIMER_MODE_REPEATED, timeout_handler);
+}
+
+
+ret_code_t alarm_ack_send(uint8_t         type,
+                          uint8_t         seq,
+                          uint8_t const * p_payload,
+                          uint16_t        length,
+                          uint16_t        cmd_id)
+{
+    entry_t * p_entry = NULL;
+    bool      start   = false;
+
+    if (length > ALARM_ACK_PAYLOAD_MAX_LEN)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    CRITICAL_REGION_ENTER();
+    for (uint8_t i = 0; i < ALARM_ACK_WINDOW; i++)
+    {
+        if (!m_window[i].used)
+        {
+            p_entry = &m_window[i];
+            break;
+        }
+    }
+
+    if (p_entry != NULL)
+    {
+        p_entry->report      = (cmd_id != ALARM_ACK_CMD_ID_NONE);
+        p_entry->type        = type;
+        p_entry->seq         = seq;
+        p_entry->retries     = 0;
+        p_entry->cmd_id      = cmd_id;
+        p_entry->length      = length;
+        p_entry->first_tx_at = app_timer_cnt_get();
+        p_entry->last_tx_at  = p_entry->first_tx_at;
+        memcpy(p_entry->payload, p_payload, length);
+        p_entry->used        = true;
+        m_stats.sent++;
+
+        start           = !m_timer_running;
+        m_timer_running = true;
+    }
+    else
+    {
+        m_stats.busy++;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (p_entry == NULL)
+    {
+        alarm_ack_report_t rpt = {.cmd_id = cmd_id, .status = ALARM_ACK_STATUS_BUSY};
+
+        if (cmd_id != ALARM_ACK_CMD_ID_NONE)
+        {
+            m_init.report(&rpt);
+        }
+        return NRF_ERROR_NO_MEM;
+    }
+
+    if (start)
+    {
+        (void)app_timer_start(m_timer_id, APP_TIMER_TICKS(ALARM_ACK_POLL_MS), NULL);
+    }
+
+    // A frame the link refuses now is retransmitted on timeout like a lost one.
+    (void)m_init.send(type, seq, p_entry->payload, length);
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_ack_rx(uint8_t seq)
+{
+    for (uint8_t i = 0; i < ALARM_ACK_WINDOW; i++)
+    {
+        entry_t * p_entry = &m_window[i];
+        uint32_t  rtt_ms;
+
+        if (!p_entry->used || (p_entry->seq != seq))
+        {
+            continue;
+        }
+
+        rtt_ms = ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), p_entry->first_tx_at));
+
+        m_stats.delivered++;
+        m_stats.rtt_sum_ms += rtt_ms;
+        m_stats.rtt_min_ms  = MIN(m_stats.rtt_min_ms, rtt_ms);
+        m_stats.rtt_max_ms  = MAX(m_stats.rtt_max_ms, rtt_ms);
+
+        report(p_entry, ALARM_ACK_STATUS_DELIVERED, rtt_ms);
+        p_entry->used = false;
+        return;
+    }
+
+    m_stats.duplicate_acks++;
+}
+
+
+void alarm_ack_link_reset(void)
+{
+    CRITICAL_REGION_ENTER();
+    for (uint8_t i = 0; i < ALARM_ACK_WINDOW; i++)
+    {
+        m_window[i].report = false;
+    }
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.rtt_min_ms = UINT32_MAX;
+    CRITICAL_REGION_EXIT();
+}
+
+
+alarm_ack_stats_t const * alarm_ack_stats_get(void)
+{
+    return &m_stats;
+}
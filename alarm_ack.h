@@ -0,0 +1,109 @@
+#ifndef ALARM_ACK_H__
+#define ALARM_ACK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "ble_alarm.h"
+
+/**@file
+ *
+ * @details Reliable delivery of peer commands to the ESP. Every command frame stays in a window
+ *          of @ref ALARM_ACK_WINDOW slots until the ESP acknowledges its sequence number, and is
+ *          sent again, with the same sequence number, if no acknowledgement arrives within
+ *          @ref ALARM_ACK_TIMEOUT_MS. The ESP acknowledges duplicates again without acting on
+ *          them twice. The outcome of every command is reported back, to be notified to the peer.
+ */
+
+#define ALARM_ACK_WINDOW                4                           /**< Commands in flight to the ESP. */
+#define ALARM_ACK_TIMEOUT_MS            200                         /**< Time without acknowledgement before a retransmission. */
+#define ALARM_ACK_RETRIES_MAX           3                           /**< Retransmissions before a command is reported as failed. */
+#define ALARM_ACK_POLL_MS               50                          /**< Resolution of the retransmission timer. */
+#define ALARM_ACK_PAYLOAD_MAX_LEN       BLE_NUS_MAX_DATA_LEN        /**< Commands come from single RX writes. */
+#define ALARM_ACK_CMD_ID_NONE           0xFFFF                      /**< Command id of a command whose outcome is not reported. */
+
+typedef enum
+{
+    ALARM_ACK_STATUS_DELIVERED,                                     /**< The ESP acknowledged the command. */
+    ALARM_ACK_STATUS_FAILED,                                        /**< No acknowledgement after @ref ALARM_ACK_RETRIES_MAX retransmissions. */
+    ALARM_ACK_STATUS_BUSY,                                          /**< The window was full; the command was not sent. */
+    ALARM_ACK_STATUS_DROPPED,                                       /**< Reported by the application: the write was over the RX budget and never forwarded. */
+    ALARM_ACK_STATUS_REPEAT                                         /**< Reported by the application: a copy of an alarm forwarded moments before; counted, not forwarded. */
+} alarm_ack_status_t;
+
+/**@brief   Outcome of one command. */
+typedef struct
+{
+    uint16_t           cmd_id;                                      /**< Identifier given to @ref alarm_ack_send. */
+    alarm_ack_status_t status;
+    uint8_t            retries;                                     /**< Retransmissions needed. */
+    uint16_t           rtt_ms;                                      /**< First transmission to acknowledgement, when delivered. */
+} alarm_ack_report_t;
+
+/**@brief   Queues one frame for the ESP. */
+typedef ret_code_t (*alarm_ack_send_t)(uint8_t type, uint8_t seq, uint8_t const * p_payload, uint16_t length);
+
+typedef void (*alarm_ack_report_handler_t)(alarm_ack_report_t const * p_report);
+
+typedef struct
+{
+    alarm_ack_send_t           send;
+    alarm_ack_report_handler_t report;
+} alarm_ack_init_t;
+
+/**@brief   Counters of the current link, see @ref alarm_ack_link_reset. */
+typedef struct
+{
+    uint32_t sent;                                                  /**< Commands taken into the window. */
+    uint32_t delivered;
+    uint32_t failed;
+    uint32_t busy;                                                  /**< Commands refused because the window was full. */
+    uint32_t retransmits;
+    uint32_t duplicate_acks;                                        /**< Acknowledgements of commands no longer in flight. */
+    uint32_t rtt_sum_ms;
+    uint32_t rtt_min_ms;
+    uint32_t rtt_max_ms;
+} alarm_ack_stats_t;
+
+/**@brief Function for initializing reliable command delivery. Needs app_timer.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_ack_init(alarm_ack_init_t const * p_init);
+
+/**@brief Function for sending a command and tracking it until it is acknowledged.
+ *
+ * @details Safe to call from any interrupt level.
+ *
+ * @param[in]   type        Frame type.
+ * @param[in]   seq         Frame sequence number; must not be in use by another command in flight.
+ * @param[in]   p_payload   Command, copied.
+ * @param[in]   length      At most @ref ALARM_ACK_PAYLOAD_MAX_LEN.
+ * @param[in]   cmd_id      Identifier reported back with the outcome, or @ref ALARM_ACK_CMD_ID_NONE
+ *                          to deliver the command without reporting it.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH, or NRF_ERROR_NO_MEM if the window is full
+ *              (reported as @ref ALARM_ACK_STATUS_BUSY).
+ */
+ret_code_t alarm_ack_send(uint8_t         type,
+                          uint8_t         seq,
+                          uint8_t const * p_payload,
+                          uint16_t        length,
+                          uint16_t        cmd_id);
+
+/**@brief Function for handling an acknowledgement from the ESP.
+ *
+ * @param[in]   seq     Sequence number acknowledged.
+ */
+void alarm_ack_rx(uint8_t seq);
+
+/**@brief Function for starting a new peer link.
+ *
+ * @details Commands of the previous link still in flight are delivered, but no longer reported.
+ *          The counters restart.
+ */
+void alarm_ack_link_reset(void);
+
+alarm_ack_stats_t const * alarm_ack_stats_get(void);
+
+#endif // ALARM_ACK_H__
@@ -0,0 +1,193 @@
+#include "sdk_common.h"
+#include "alarm_adv.h"
+#include <string.h>
+#include "ble_advdata.h"
+
+static alarm_adv_init_t m_init;
+static uint8_t          m_adv_buf[2][ALARM_ADV_DATA_MAX_LEN];       /**< One buffer is owned by the SoftDevice while the other is filled. */
+#if !ALARM_ADV_EXTENDED
+static uint8_t          m_srsp_buf[2][ALARM_ADV_DATA_MAX_LEN];
+#endif
+static uint8_t          m_buf_idx;
+static uint8_t const  * m_p_override;
+static uint16_t         m_override_len;
+
+
+uint16_t alarm_adv_snapshot_encode(alarm_adv_snapshot_t const * p_snapshot, uint8_t format, uint8_t * p_buf)
+{
+    uint16_t len = 0;
+
+    p_buf[len++] = format;
+
+    if (format == ALARM_ADV_FORMAT_SHORT)
+    {
+        p_buf[len++] = p_snapshot->status.flags;
+        len += uint16_encode(p_snapshot->zones,          &p_buf[len]);
+        len += uint16_encode(p_snapshot->status.battery, &p_buf[len]);
+        return len;
+    }
+
+    p_buf[len++] = p_snapshot->status.heartbeat;
+    p_buf[len++] = p_snapshot->status.flags;
+    len += uint16_encode(p_snapshot->zones,                  &p_buf[len]);
+    len += uint16_encode(p_snapshot->status.battery,         &p_buf[len]);
+    p_buf[len++] = (uint8_t)p_snapshot->status.rssi;
+    len += uint16_encode(p_snapshot->status.tx_dropped,      &p_buf[len]);
+    len += uint16_encode(p_snapshot->status.alarm_delay_max, &p_buf[len]);
+    p_buf[len++] = p_snapshot->last_event_zone;
+    len += uint16_encode(p_snapshot->last_event_age_s,       &p_buf[len]);
+    len += uint16_encode(p_snapshot->alarm_count,            &p_buf[len]);
+    len += uint32_encode(p_snapshot->uptime_s,               &p_buf[len]);
+
+    for (uint8_t zone = 0; zone < ALARM_ADV_ZONE_COUNT; zone++)
+    {
+        len += uint16_encode(p_snapshot->zone_trips[zone], &p_buf[len]);
+    }
+
+    return len;
+}
+
+
+ret_code_t alarm_adv_snapshot_decode(uint8_t const * p_data, uint16_t length, alarm_adv_snapshot_t * p_snapshot)
+{
+    uint16_t offset = 1;
+
+    if (length < 1)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    memset(p_snapshot, 0, sizeof(*p_snapshot));
+    p_snapshot->last_event_zone = ALARM_ADV_EVENT_NONE;
+
+    switch (p_data[0])
+    {
+        case ALARM_ADV_FORMAT_SHORT:
+            if (length != ALARM_ADV_SHORT_LEN)
+            {
+                return NRF_ERROR_INVALID_LENGTH;
+            }
+            p_snapshot->status.flags   = p_data[1];
+            p_snapshot->zones          = uint16_decode(&p_data[2]);
+            p_snapshot->status.battery = uint16_decode(&p_data[4]);
+            return NRF_SUCCESS;
+
+        case ALARM_ADV_FORMAT_FULL:
+            if (length != ALARM_ADV_FULL_LEN)
+            {
+                return NRF_ERROR_INVALID_LENGTH;
+            }
+            break;
+
+        default:
+            return NRF_ERROR_INVALID_DATA;
+    }
+
+    p_snapshot->status.heartbeat       = p_data[offset++];
+    p_snapshot->status.flags           = p_data[offset++];
+    p_snapshot->zones                  = uint16_decode(&p_data[offset]);
+    offset                            += 2;
+    p_snapshot->status.battery         = uint16_decode(&p_data[offset]);
+    offset                            += 2;
+    p_snapshot->status.rssi            = (int8_t)p_data[offset++];
+    p_snapshot->status.tx_dropped      = uint16_decode(&p_data[offset]);
+    offset                            += 2;
+    p_snapshot->status.alarm_delay_max = uint16_decode(&p_data[offset]);
+    offset                            += 2;
+    p_snapshot->last_event_zone        = p_data[offset++];
+    p_snapshot->last_event_age_s       = uint16_decode(&p_data[offset]);
+    offset                            += 2;
+    p_snapshot->alarm_count            = uint16_decode(&p_data[offset]);
+    offset                            += 2;
+    p_snapshot->uptime_s               = uint32_decode(&p_data[offset]);
+    offset                            += 4;
+
+    for (uint8_t zone = 0; zone < ALARM_ADV_ZONE_COUNT; zone++)
+    {
+        p_snapshot->zone_trips[zone] = uint16_decode(&p_data[offset]);
+        offset                      += 2;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_adv_init(alarm_adv_init_t const * p_init)
+{
+    m_init         = *p_init;
+    m_buf_idx      = 0;
+    m_p_override   = NULL;
+    m_override_len = 0;
+}
+
+
+void alarm_adv_override_set(uint8_t const * p_data, uint16_t length)
+{
+    m_p_override   = p_data;
+    m_override_len = (p_data != NULL) ? length : 0;
+}
+
+
+ret_code_t alarm_adv_update(ble_advertising_t * p_advertising, alarm_adv_snapshot_t const * p_snapshot)
+{
+    ret_code_t                 err_code;
+    ble_advdata_t              advdata;
+    ble_advdata_manuf_data_t   manuf;
+    ble_gap_adv_data_t         gap_adv_data;
+    uint8_t                    payload[ALARM_ADV_FULL_LEN];
+
+    VERIFY_PARAM_NOT_NULL(p_advertising);
+    VERIFY_PARAM_NOT_NULL(p_snapshot);
+
+    m_buf_idx ^= 1;
+    memset(&gap_adv_data, 0, sizeof(gap_adv_data));
+
+    manuf.company_identifier = ALARM_ADV_COMPANY_ID;
+    manuf.data.p_data        = payload;
+
+    memset(&advdata, 0, sizeof(advdata));
+    advdata.flags                   = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    advdata.uuids_complete.uuid_cnt = m_init.uuid_cnt;
+    advdata.uuids_complete.p_uuids  = m_init.p_uuids;
+    advdata.p_manuf_specific_data   = &manuf;
+
+#if ALARM_ADV_EXTENDED
+    // Nonscannable extended PDU: everything a scanner needs is in the advertising data.
+    manuf.data.size            = alarm_adv_snapshot_encode(p_snapshot, ALARM_ADV_FORMAT_FULL, payload);
+    advdata.name_type          = BLE_ADVDATA_FULL_NAME;
+    advdata.include_appearance = true;
+#else
+    manuf.data.size = alarm_adv_snapshot_encode(p_snapshot, ALARM_ADV_FORMAT_SHORT, payload);
+    if (m_override_len != 0)
+    {
+        advdata.uuids_complete.uuid_cnt = 0;
+    }
+
+    {
+        ble_advdata_t srdata;
+
+        memset(&srdata, 0, sizeof(srdata));
+        srdata.name_type          = BLE_ADVDATA_FULL_NAME;
+        srdata.include_appearance = true;
+
+        gap_adv_data.scan_rsp_data.p_data = m_srsp_buf[m_buf_idx];
+        gap_adv_data.scan_rsp_data.len    = sizeof(m_srsp_buf[m_buf_idx]);
+        err_code = ble_advdata_encode(&srdata, gap_adv_data.scan_rsp_data.p_data,
+                                      &gap_adv_data.scan_rsp_data.len);
+        VERIFY_SUCCESS(err_code);
+    }
+#endif
+
+    if (m_override_len != 0)
+    {
+        manuf.data.p_data = (uint8_t *)m_p_override;
+        manuf.data.size   = m_override_len;
+    }
+
+    gap_adv_data.adv_data.p_data = m_adv_buf[m_buf_idx];
+    gap_adv_data.adv_data.len    = sizeof(m_adv_buf[m_buf_idx]);
+    err_code = ble_advdata_encode(&advdata, gap_adv_data.adv_data.p_data, &gap_adv_data.adv_data.len);
+    VERIFY_SUCCESS(err_code);
+
+    return sd_ble_gap_adv_set_configure(&p_advertising->adv_handle, &gap_adv_data, NULL);
+}
@@ -0,0 +1,104 @@
+#ifndef ALARM_ADV_H__
+#define ALARM_ADV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "ble.h"
+#include "ble_advertising.h"
+#include "ble_alarm.h"
+
+#if defined(S140)
+#define ALARM_ADV_EXTENDED              1                           /**< Carry the full snapshot in extended advertising PDUs. */
+#else
+#define ALARM_ADV_EXTENDED              0                           /**< Legacy PDUs only; carry the short snapshot. */
+#endif
+
+#define ALARM_ADV_COMPANY_ID            0x0059                      /**< Manufacturer data company identifier (Nordic Semiconductor). */
+#define ALARM_ADV_ZONE_COUNT            4                           /**< Zones with a trip counter in the full snapshot. */
+
+#define ALARM_ADV_FORMAT_SHORT          0x01                        /**< Flags, zones and battery; fits a legacy PDU next to the service UUID. */
+#define ALARM_ADV_FORMAT_FULL           0x02                        /**< Complete alarm state; needs an extended PDU. */
+#define ALARM_ADV_FORMAT_FLOOD          0x03                        /**< Flooded alarm event, see @ref alarm_flood.h. */
+
+#define ALARM_ADV_SHORT_LEN             6
+#define ALARM_ADV_FULL_LEN              (21 + (2 * ALARM_ADV_ZONE_COUNT))
+
+#define ALARM_ADV_EVENT_NONE            0xFF                        /**< @ref alarm_adv_snapshot_t::last_event_zone before the first trip. */
+
+#if ALARM_ADV_EXTENDED
+#define ALARM_ADV_DATA_MAX_LEN          BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_CONNECTABLE_MAX_SUPPORTED
+#else
+#define ALARM_ADV_DATA_MAX_LEN          BLE_GAP_ADV_SET_DATA_SIZE_MAX
+#endif
+
+/**@brief   Alarm state published in the manufacturer specific data.
+ *
+ * @details The short format carries status.flags, zones and status.battery. The full format
+ *          carries every field, little-endian, in declaration order after the format byte.
+ */
+typedef struct
+{
+    ble_alarm_status_t status;                                      /**< Status characteristic fields; status.zones is not used. */
+    uint16_t           zones;                                       /**< Bit n set if zone n tripped since a gateway last connected. */
+    uint8_t            last_event_zone;                             /**< Zone of the latest trip, or @ref ALARM_ADV_EVENT_NONE. */
+    uint16_t           last_event_age_s;                            /**< Seconds since the latest trip (saturating). */
+    uint16_t           alarm_count;                                 /**< Alarm commands received since boot (saturating). */
+    uint32_t           uptime_s;
+    uint16_t           zone_trips[ALARM_ADV_ZONE_COUNT];            /**< Trips per zone since boot (saturating). */
+} alarm_adv_snapshot_t;
+
+/**@brief   Advertising data that stays fixed between updates. */
+typedef struct
+{
+    ble_uuid_t * p_uuids;                                           /**< Complete list of service UUIDs. */
+    uint16_t     uuid_cnt;
+} alarm_adv_init_t;
+
+/**@brief Function for encoding a snapshot as manufacturer data, company identifier excluded.
+ *
+ * @param[in]   format      ALARM_ADV_FORMAT_SHORT or ALARM_ADV_FORMAT_FULL.
+ * @param[out]  p_buf       Buffer of at least @ref ALARM_ADV_FULL_LEN bytes.
+ *
+ * @return      Number of bytes written.
+ */
+uint16_t alarm_adv_snapshot_encode(alarm_adv_snapshot_t const * p_snapshot, uint8_t format, uint8_t * p_buf);
+
+/**@brief Function for decoding manufacturer data written by @ref alarm_adv_snapshot_encode.
+ *
+ * @details Fields the format does not carry are zeroed, last_event_zone is
+ *          @ref ALARM_ADV_EVENT_NONE.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH or NRF_ERROR_INVALID_DATA (unknown format).
+ */
+ret_code_t alarm_adv_snapshot_decode(uint8_t const * p_data, uint16_t length, alarm_adv_snapshot_t * p_snapshot);
+
+/**@brief Function for initializing the advertising payload builder.
+ *
+ * @details The name and appearance go in the scan response of legacy builds and in the
+ *          advertising data of extended builds, never in both.
+ */
+void alarm_adv_init(alarm_adv_init_t const * p_init);
+
+/**@brief Function for advertising another manufacturer data payload instead of the snapshot.
+ *
+ * @details Takes effect on the next @ref alarm_adv_update. Legacy PDUs leave out the service UUID
+ *          to make room, so scanners filtering on it do not take the payload for a snapshot.
+ *
+ * @param[in]   p_data      Payload starting with its format byte, company identifier excluded.
+ *                          Must stay valid until cleared. NULL to go back to the snapshot.
+ */
+void alarm_adv_override_set(uint8_t const * p_data, uint16_t length);
+
+/**@brief Function for publishing a new snapshot in the running advertising set.
+ *
+ * @details The payload is encoded into the buffer the SoftDevice is not using and handed over with
+ *          sd_ble_gap_adv_set_configure(), so the data can change while advertising. The
+ *          Advertising module restores its own payload whenever it switches mode, so call this
+ *          again on every non-directed advertising event.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_adv_update(ble_advertising_t * p_advertising, alarm_adv_snapshot_t const * p_snapshot);
+
+#endif // ALARM_ADV_H__
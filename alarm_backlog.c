@@ -0,0 +1,566 @@
+#include "sdk_common.h"
+#include "alarm_backlog.h"
+#include <string.h>
+#include "app_util_platform.h"
+#include "alarm_util.h"
+
+#define REC_HDR_LEN             sizeof(alarm_backlog_rec_hdr_t)
+#define REC_SIZE(_len)          (REC_HDR_LEN + ALIGN_NUM(4, (_len)))
+
+typedef enum
+{
+    STEP_MORE,                                                      /**< A record was delivered. */
+    STEP_BLOCKED,                                                   /**< The peer or the flash is not ready. */
+    STEP_EMPTY                                                      /**< Nothing stored at this level. */
+} step_t;
+
+static alarm_backlog_t * m_instances[ALARM_BACKLOG_INSTANCES_MAX];
+static uint8_t           m_instance_count;
+static bool              m_fds_ready;                               /**< FDS initialized and stale chunks deleted. */
+
+
+/**@brief Function for copying bytes out of the RAM ring, across the wrap. */
+static void ring_read(alarm_backlog_t const * p_backlog, uint32_t offset, void * p_dst, uint16_t length)
+{
+    uint16_t start = (uint16_t)(offset % p_backlog->ram_size);
+    uint16_t first = MIN(length, p_backlog->ram_size - start);
+
+    memcpy(p_dst, &p_backlog->p_ram[start], first);
+    memcpy((uint8_t *)p_dst + first, p_backlog->p_ram, length - first);
+}
+
+
+static void ring_write(alarm_backlog_t * p_backlog, uint32_t offset, void const * p_src, uint16_t length)
+{
+    uint16_t start = (uint16_t)(offset % p_backlog->ram_size);
+    uint16_t first = MIN(length, p_backlog->ram_size - start);
+
+    memcpy(&p_backlog->p_ram[start], p_src, first);
+    memcpy(p_backlog->p_ram, (uint8_t const *)p_src + first, length - first);
+}
+
+
+static uint16_t ram_free(alarm_backlog_t const * p_backlog)
+{
+    return (uint16_t)(p_backlog->ram_size - (p_backlog->ram_tail - p_backlog->ram_head));
+}
+
+
+/**@brief Function for discarding the oldest RAM record. Call in a critical region. */
+static void ram_pop(alarm_backlog_t * p_backlog)
+{
+    alarm_backlog_rec_hdr_t hdr;
+
+    ring_read(p_backlog, p_backlog->ram_head, &hdr, REC_HDR_LEN);
+    p_backlog->ram_head += REC_SIZE(hdr.len);
+    p_backlog->ram_records--;
+}
+
+
+/**@brief Function for forgetting the oldest chunk. Call in a critical region. */
+static void chunk_pop(alarm_backlog_t * p_backlog)
+{
+    p_backlog->chunk_head   = (p_backlog->chunk_head + 1) % ALARM_BACKLOG_CHUNKS_MAX;
+    p_backlog->chunk_count--;
+    p_backlog->chunk_offset = 0;
+}
+
+
+/**@brief Function for moving the oldest RAM records into the staging chunk. Call in a critical region.
+ *
+ * @return      True if a chunk was staged and must be written with @ref chunk_write.
+ */
+static bool spill(alarm_backlog_t * p_backlog)
+{
+    alarm_backlog_chunk_t * p_chunk;
+    uint8_t               * p_staging = (uint8_t *)p_backlog->p_staging;
+    uint8_t                 index;
+
+    // A record being delivered stays where it is, or a failed delivery would leave it behind
+    // younger records in flash.
+    if (!m_fds_ready                                          ||
+        p_backlog->staging_busy                               ||
+        p_backlog->ram_head_locked                            ||
+        (p_backlog->chunk_count == ALARM_BACKLOG_CHUNKS_MAX)  ||
+        (p_backlog->ram_records == 0))
+    {
+        return false;
+    }
+
+    index   = (p_backlog->chunk_head + p_backlog->chunk_count) % ALARM_BACKLOG_CHUNKS_MAX;
+    p_chunk = &p_backlog->chunks[index];
+    memset(p_chunk, 0, sizeof(*p_chunk));
+
+    while (p_backlog->ram_records != 0)
+    {
+        alarm_backlog_rec_hdr_t hdr;
+        uint16_t                size;
+
+        ring_read(p_backlog, p_backlog->ram_head, &hdr, REC_HDR_LEN);
+        size = REC_SIZE(hdr.len);
+        if (p_chunk->len + size > ALARM_BACKLOG_CHUNK_SIZE)
+        {
+            break;
+        }
+
+        if (p_chunk->records == 0)
+        {
+            p_chunk->first_at_s = hdr.stored_at_s;
+        }
+        ring_read(p_backlog, p_backlog->ram_head, &p_staging[p_chunk->len], size);
+        p_chunk->len += size;
+        p_chunk->records++;
+        p_backlog->ram_head += size;
+        p_backlog->ram_records--;
+    }
+
+    p_backlog->chunk_count++;
+    p_backlog->staging_chunk  = index;
+    p_backlog->staging_busy   = true;
+    p_backlog->stats.spilled += p_chunk->records;
+
+    return true;
+}
+
+
+/**@brief Function for giving up on the staged chunk after a flash error. */
+static void staging_fail(alarm_backlog_t * p_backlog)
+{
+    CRITICAL_REGION_ENTER();
+    // Only one chunk is written at a time and a chunk is never dropped before it is written,
+    // so the staged chunk is still the newest.
+    p_backlog->stats.dropped += p_backlog->chunks[p_backlog->staging_chunk].records;
+    p_backlog->stats.flash_errors++;
+    p_backlog->chunk_count--;
+    p_backlog->staging_busy = false;
+    CRITICAL_REGION_EXIT();
+}
+
+
+/**@brief Function for writing the staged chunk to flash. */
+static void chunk_write(alarm_backlog_t * p_backlog)
+{
+    ret_code_t              err_code;
+    fds_record_t            record;
+    alarm_backlog_chunk_t * p_chunk = &p_backlog->chunks[p_backlog->staging_chunk];
+
+    record.file_id           = p_backlog->file_id;
+    record.key               = ALARM_BACKLOG_RECORD_KEY;
+    record.data.p_data       = p_backlog->p_staging;
+    record.data.length_words = p_chunk->len / sizeof(uint32_t);
+
+    err_code = fds_record_write(&p_chunk->desc, &record);
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH)
+    {
+        err_code = fds_gc();
+        if (err_code == NRF_SUCCESS)
+        {
+            p_backlog->write_again = true;
+            return;
+        }
+    }
+
+    if (err_code != NRF_SUCCESS)
+    {
+        staging_fail(p_backlog);
+    }
+}
+
+
+/**@brief Function for discarding the oldest chunk to make room. Call in a critical region.
+ *
+ * @param[out]  p_desc  Record to delete from flash once out of the critical region.
+ *
+ * @return      True if a chunk was dropped.
+ */
+static bool chunk_drop_oldest(alarm_backlog_t * p_backlog, fds_record_desc_t * p_desc)
+{
+    alarm_backlog_chunk_t const * p_chunk = &p_backlog->chunks[p_backlog->chunk_head];
+
+    if ((p_backlog->chunk_count == 0) || p_backlog->chunk_head_locked || !p_chunk->written)
+    {
+        return false;
+    }
+
+    *p_desc                   = p_chunk->desc;
+    p_backlog->stats.dropped += p_chunk->records;
+    chunk_pop(p_backlog);
+
+    return true;
+}
+
+
+/**@brief Function for delivering one record of the oldest chunk. */
+static step_t chunk_step(alarm_backlog_t * p_backlog)
+{
+    alarm_backlog_chunk_t         * p_chunk;
+    alarm_backlog_rec_hdr_t const * p_hdr;
+    fds_flash_record_t              flash_record;
+    fds_record_desc_t               desc;
+    bool                            accepted;
+    bool                            done = false;
+
+    CRITICAL_REGION_ENTER();
+    p_chunk = (p_backlog->chunk_count != 0) ? &p_backlog->chunks[p_backlog->chunk_head] : NULL;
+    if ((p_chunk != NULL) && p_chunk->written)
+    {
+        p_backlog->chunk_head_locked = true;
+    }
+    else if (p_chunk != NULL)
+    {
+        // Resumed from the FDS write event.
+        p_backlog->drain_blocked = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (p_chunk == NULL)
+    {
+        return STEP_EMPTY;
+    }
+    if (!p_backlog->chunk_head_locked)
+    {
+        return STEP_BLOCKED;
+    }
+
+    desc = p_chunk->desc;
+    if (fds_record_open(&desc, &flash_record) != NRF_SUCCESS)
+    {
+        CRITICAL_REGION_ENTER();
+        p_backlog->stats.dropped += p_chunk->records;
+        p_backlog->stats.flash_errors++;
+        chunk_pop(p_backlog);
+        p_backlog->chunk_head_locked = false;
+        CRITICAL_REGION_EXIT();
+
+        (void)fds_record_delete(&desc);
+        return STEP_MORE;
+    }
+
+    p_hdr    = (alarm_backlog_rec_hdr_t const *)((uint8_t const *)flash_record.p_data + p_backlog->chunk_offset);
+    accepted = p_backlog->init.deliver((uint8_t const *)(p_hdr + 1), p_hdr->len);
+
+    if (accepted)
+    {
+        uint32_t age_s = p_backlog->init.clock() - p_hdr->stored_at_s;
+
+        p_backlog->stats.forwarded++;
+        p_backlog->stats.age_max_s = MAX(p_backlog->stats.age_max_s, age_s);
+
+        p_backlog->chunk_offset += REC_SIZE(p_hdr->len);
+        p_chunk->records--;
+        done = (p_backlog->chunk_offset >= p_chunk->len);
+        if (!done)
+        {
+            p_hdr               = (alarm_backlog_rec_hdr_t const *)((uint8_t const *)flash_record.p_data +
+                                                                     p_backlog->chunk_offset);
+            p_chunk->first_at_s = p_hdr->stored_at_s;
+        }
+    }
+
+    (void)fds_record_close(&desc);
+
+    CRITICAL_REGION_ENTER();
+    if (done)
+    {
+        chunk_pop(p_backlog);
+    }
+    p_backlog->chunk_head_locked = false;
+    CRITICAL_REGION_EXIT();
+
+    if (done)
+    {
+        (void)fds_record_delete(&desc);
+    }
+
+    return accepted ? STEP_MORE : STEP_BLOCKED;
+}
+
+
+/**@brief Function for delivering the oldest RAM record. */
+static step_t ram_step(alarm_backlog_t * p_backlog)
+{
+    alarm_backlog_rec_hdr_t hdr;
+    uint8_t                 data[ALARM_BACKLOG_RECORD_MAX_LEN];
+    bool                    accepted;
+
+    CRITICAL_REGION_ENTER();
+    if (p_backlog->ram_records != 0)
+    {
+        ring_read(p_backlog, p_backlog->ram_head, &hdr, REC_HDR_LEN);
+        ring_read(p_backlog, p_backlog->ram_head + REC_HDR_LEN, data, hdr.len);
+        p_backlog->ram_head_locked = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (!p_backlog->ram_head_locked)
+    {
+        return STEP_EMPTY;
+    }
+
+    accepted = p_backlog->init.deliver(data, hdr.len);
+
+    CRITICAL_REGION_ENTER();
+    if (accepted)
+    {
+        ram_pop(p_backlog);
+    }
+    p_backlog->ram_head_locked = false;
+    CRITICAL_REGION_EXIT();
+
+    if (accepted)
+    {
+        uint32_t age_s = p_backlog->init.clock() - hdr.stored_at_s;
+
+        p_backlog->stats.forwarded++;
+        p_backlog->stats.age_max_s = MAX(p_backlog->stats.age_max_s, age_s);
+    }
+
+    return accepted ? STEP_MORE : STEP_BLOCKED;
+}
+
+
+/**@brief Function for delivering records, flash first since it holds the older ones. */
+static void drain_once(void * p_context)
+{
+    alarm_backlog_t * p_backlog = p_context;
+    step_t            step;
+
+    do
+    {
+        step = chunk_step(p_backlog);
+        if (step == STEP_EMPTY)
+        {
+            step = ram_step(p_backlog);
+        }
+    } while (step == STEP_MORE);
+}
+
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    for (uint8_t i = 0; i < m_instance_count; i++)
+    {
+        alarm_backlog_t * p_backlog = m_instances[i];
+
+        switch (p_evt->id)
+        {
+            case FDS_EVT_INIT:
+                if (p_evt->result == NRF_SUCCESS)
+                {
+                    (void)fds_file_delete(p_backlog->file_id);
+                    m_fds_ready = true;
+                }
+                break;
+
+            case FDS_EVT_WRITE:
+                if ((p_evt->write.file_id != p_backlog->file_id) || !p_backlog->staging_busy)
+                {
+                    break;
+                }
+                if (p_evt->result != NRF_SUCCESS)
+                {
+                    staging_fail(p_backlog);
+                    break;
+                }
+                p_backlog->chunks[p_backlog->staging_chunk].written = true;
+                p_backlog->staging_busy                             = false;
+                if (p_backlog->drain_blocked)
+                {
+                    p_backlog->drain_blocked = false;
+                    alarm_backlog_drain(p_backlog);
+                }
+                break;
+
+            case FDS_EVT_GC:
+                if (p_backlog->write_again)
+                {
+                    p_backlog->write_again = false;
+                    chunk_write(p_backlog);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+
+ret_code_t alarm_backlog_init(alarm_backlog_t * p_backlog, alarm_backlog_init_t const * p_init)
+{
+    ret_code_t err_code;
+
+    VERIFY_PARAM_NOT_NULL(p_backlog);
+    VERIFY_PARAM_NOT_NULL(p_init);
+    VERIFY_PARAM_NOT_NULL(p_init->deliver);
+    VERIFY_PARAM_NOT_NULL(p_init->clock);
+
+    if ((p_backlog->ram_size < ALARM_BACKLOG_CHUNK_SIZE) || (m_instance_count == ALARM_BACKLOG_INSTANCES_MAX))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    p_backlog->init              = *p_init;
+    p_backlog->ram_head          = 0;
+    p_backlog->ram_tail          = 0;
+    p_backlog->ram_records       = 0;
+    p_backlog->ram_head_locked   = false;
+    p_backlog->chunk_head        = 0;
+    p_backlog->chunk_count       = 0;
+    p_backlog->chunk_offset      = 0;
+    p_backlog->chunk_head_locked = false;
+    p_backlog->staging_busy      = false;
+    p_backlog->write_again       = false;
+    p_backlog->drain_blocked     = false;
+    p_backlog->drain_requests    = 0;
+    memset(&p_backlog->stats, 0, sizeof(p_backlog->stats));
+
+    if (m_instance_count == 0)
+    {
+        err_code = fds_register(fds_evt_handler);
+        VERIFY_SUCCESS(err_code);
+    }
+    m_instances[m_instance_count++] = p_backlog;
+
+    // Stale chunks are deleted on FDS_EVT_INIT if FDS is not up yet.
+    err_code = fds_file_delete(p_backlog->file_id);
+    if (err_code == FDS_ERR_NOT_INITIALIZED)
+    {
+        return NRF_SUCCESS;
+    }
+    VERIFY_SUCCESS(err_code);
+    m_fds_ready = true;
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t alarm_backlog_put(alarm_backlog_t * p_backlog, uint8_t const * p_data, uint16_t length)
+{
+    alarm_backlog_rec_hdr_t hdr;
+    fds_record_desc_t       dropped_desc;
+    uint16_t                size   = REC_SIZE(length);
+    bool                    write  = false;
+    bool                    drop   = false;
+    bool                    stored = false;
+
+    if ((length == 0) || (length > ALARM_BACKLOG_RECORD_MAX_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    hdr.len         = length;
+    hdr.reserved    = 0;
+    hdr.stored_at_s = p_backlog->init.clock();
+
+    CRITICAL_REGION_ENTER();
+    if (ram_free(p_backlog) < size)
+    {
+        write = spill(p_backlog);
+    }
+
+    if ((ram_free(p_backlog) < size) && (p_backlog->init.policy == ALARM_BACKLOG_DROP_OLDEST))
+    {
+        // Flash holds the oldest records: dropping a chunk frees a slot to spill RAM into.
+        if (!write                                                   &&
+            !p_backlog->staging_busy                                 &&
+            (p_backlog->chunk_count == ALARM_BACKLOG_CHUNKS_MAX)     &&
+            chunk_drop_oldest(p_backlog, &dropped_desc))
+        {
+            drop  = true;
+            write = spill(p_backlog);
+        }
+
+        // Flash full of chunks still being written, or not available: drop from RAM instead.
+        while ((ram_free(p_backlog) < size) && (p_backlog->ram_records != 0) && !p_backlog->ram_head_locked)
+        {
+            ram_pop(p_backlog);
+            p_backlog->stats.dropped++;
+        }
+    }
+
+    if (ram_free(p_backlog) >= size)
+    {
+        ring_write(p_backlog, p_backlog->ram_tail, &hdr, REC_HDR_LEN);
+        ring_write(p_backlog, p_backlog->ram_tail + REC_HDR_LEN, p_data, length);
+        p_backlog->ram_tail += size;
+        p_backlog->ram_records++;
+        p_backlog->stats.stored++;
+        stored = true;
+    }
+    else
+    {
+        p_backlog->stats.dropped++;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (drop)
+    {
+        (void)fds_record_delete(&dropped_desc);
+    }
+    if (write)
+    {
+        chunk_write(p_backlog);
+    }
+
+    return stored ? NRF_SUCCESS : NRF_ERROR_NO_MEM;
+}
+
+
+void alarm_backlog_drain(alarm_backlog_t * p_backlog)
+{
+    alarm_drain_run(&p_backlog->drain_requests, drain_once, p_backlog);
+}
+
+
+bool alarm_backlog_is_empty(alarm_backlog_t const * p_backlog)
+{
+    return (p_backlog->ram_records == 0) && (p_backlog->chunk_count == 0);
+}
+
+
+void alarm_backlog_policy_set(alarm_backlog_t * p_backlog, alarm_backlog_policy_t policy)
+{
+    p_backlog->init.policy = policy;
+}
+
+
+void alarm_backlog_depth_get(alarm_backlog_t const * p_backlog, alarm_backlog_depth_t * p_depth)
+{
+    alarm_backlog_rec_hdr_t hdr;
+    bool                    stamped = false;
+
+    memset(p_depth, 0, sizeof(*p_depth));
+
+    CRITICAL_REGION_ENTER();
+    p_depth->ram_records  = p_backlog->ram_records;
+    p_depth->ram_bytes    = (uint16_t)(p_backlog->ram_tail - p_backlog->ram_head);
+    p_depth->flash_chunks = p_backlog->chunk_count;
+    for (uint8_t i = 0; i < p_backlog->chunk_count; i++)
+    {
+        p_depth->flash_records += p_backlog->chunks[(p_backlog->chunk_head + i) % ALARM_BACKLOG_CHUNKS_MAX].records;
+    }
+
+    if (p_backlog->chunk_count != 0)
+    {
+        hdr.stored_at_s = p_backlog->chunks[p_backlog->chunk_head].first_at_s;
+        stamped         = true;
+    }
+    else if (p_backlog->ram_records != 0)
+    {
+        ring_read(p_backlog, p_backlog->ram_head, &hdr, REC_HDR_LEN);
+        stamped = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (stamped)
+    {
+        p_depth->oldest_age_s = p_backlog->init.clock() - hdr.stored_at_s;
+    }
+}
+
+
+alarm_backlog_stats_t const * alarm_backlog_stats_get(alarm_backlog_t const * p_backlog)
+{
+    return &p_backlog->stats;
+}
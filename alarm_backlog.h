@@ -0,0 +1,170 @@
+#ifndef ALARM_BACKLOG_H__
+#define ALARM_BACKLOG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_common.h"
+#include "nrf_atomic.h"
+#include "fds.h"
+
+/**@file
+ *
+ * @details Store-and-forward queue for messages whose peer is away. Records are kept in a RAM
+ *          ring; when the ring is full its oldest records are copied into a chunk and written to
+ *          FDS, so flash holds the older part of the backlog and RAM the newer part. Once both
+ *          are full the instance policy decides which record is lost.
+ *
+ *          Records are handed back in the order they were stored when @ref alarm_backlog_drain
+ *          is called, as fast as the deliver callback accepts them.
+ *
+ *          Flash only extends RAM: the records carry uptime stamps, so chunks left over from
+ *          before a reset are deleted when FDS initializes.
+ */
+
+#define ALARM_BACKLOG_CHUNK_SIZE        256                         /**< Bytes per flash record. */
+#define ALARM_BACKLOG_CHUNKS_MAX        4                           /**< Flash records per instance. */
+#define ALARM_BACKLOG_INSTANCES_MAX     2
+#define ALARM_BACKLOG_RECORD_KEY        0x0001                      /**< FDS record key of every chunk. */
+
+/**@brief   Header stored in front of every record, in RAM and in flash. */
+typedef struct
+{
+    uint16_t len;
+    uint16_t reserved;
+    uint32_t stored_at_s;                                           /**< Uptime when the record was stored. */
+} alarm_backlog_rec_hdr_t;
+
+#define ALARM_BACKLOG_RECORD_MAX_LEN    (ALARM_BACKLOG_CHUNK_SIZE - sizeof(alarm_backlog_rec_hdr_t))
+
+/**@brief   Which record is lost when the backlog is full. */
+typedef enum
+{
+    ALARM_BACKLOG_DROP_OLDEST,                                      /**< Make room by discarding the oldest records. */
+    ALARM_BACKLOG_DROP_NEWEST                                       /**< Refuse the record being stored. */
+} alarm_backlog_policy_t;
+
+/**@brief   Hands one record to the returning peer.
+ *
+ * @return  True if the record was taken; false stops draining until the next
+ *          @ref alarm_backlog_drain call.
+ */
+typedef bool (*alarm_backlog_deliver_t)(uint8_t const * p_data, uint16_t length);
+
+/**@brief   Current uptime in seconds. */
+typedef uint32_t (*alarm_backlog_clock_t)(void);
+
+typedef struct
+{
+    alarm_backlog_policy_t  policy;
+    alarm_backlog_deliver_t deliver;
+    alarm_backlog_clock_t   clock;
+} alarm_backlog_init_t;
+
+/**@brief   Counters since boot. */
+typedef struct
+{
+    uint32_t stored;                                                /**< Records accepted. */
+    uint32_t spilled;                                               /**< Records moved from RAM to flash. */
+    uint32_t forwarded;                                             /**< Records delivered. */
+    uint32_t dropped;                                               /**< Records lost to the policy or to flash errors. */
+    uint32_t flash_errors;
+    uint32_t age_max_s;                                             /**< Longest time a delivered record waited. */
+} alarm_backlog_stats_t;
+
+/**@brief   Current queue depth and age. */
+typedef struct
+{
+    uint16_t ram_records;
+    uint16_t ram_bytes;
+    uint16_t flash_records;
+    uint8_t  flash_chunks;
+    uint32_t oldest_age_s;                                          /**< Age of the next record to be delivered, 0 if empty. */
+} alarm_backlog_depth_t;
+
+/**@brief   Chunk of records in flash. */
+typedef struct
+{
+    fds_record_desc_t desc;
+    uint16_t          len;                                          /**< Bytes used, a multiple of 4. */
+    uint16_t          records;                                      /**< Records not yet delivered. */
+    uint32_t          first_at_s;                                   /**< Stamp of the first record not yet delivered. */
+    bool              written;                                      /**< FDS finished the write. */
+} alarm_backlog_chunk_t;
+
+/**@brief   Backlog instance. Use @ref ALARM_BACKLOG_DEF to define one. */
+typedef struct
+{
+    uint8_t             * const p_ram;
+    uint16_t const              ram_size;
+    uint16_t const              file_id;
+    uint32_t            * const p_staging;                          /**< Chunk being written; must stay valid until FDS is done. */
+    alarm_backlog_init_t        init;
+    uint32_t                    ram_head;                           /**< Free-running byte offsets into p_ram. */
+    uint32_t                    ram_tail;
+    uint16_t                    ram_records;
+    bool                        ram_head_locked;                    /**< The oldest RAM record is being delivered. */
+    alarm_backlog_chunk_t       chunks[ALARM_BACKLOG_CHUNKS_MAX];
+    uint8_t                     chunk_head;
+    uint8_t                     chunk_count;
+    uint16_t                    chunk_offset;                       /**< Read position in the oldest chunk. */
+    bool                        chunk_head_locked;                  /**< The oldest chunk is being read. */
+    uint8_t                     staging_chunk;                      /**< Index of the chunk in p_staging. */
+    bool                        staging_busy;
+    bool                        write_again;                        /**< Retry the staged write once garbage collection is done. */
+    bool                        drain_blocked;                      /**< A drain waits for the oldest chunk to be written. */
+    nrf_atomic_u32_t            drain_requests;
+    alarm_backlog_stats_t       stats;
+} alarm_backlog_t;
+
+/**@brief   Macro for defining a backlog instance with its storage.
+ *
+ * @param   _name       Name of the instance.
+ * @param   _ram_size   Bytes of RAM ring, a multiple of 4.
+ * @param   _file_id    FDS file holding the overflow; one per instance.
+ * @hideinitializer
+ */
+#define ALARM_BACKLOG_DEF(_name, _ram_size, _file_id)                                              \
+STATIC_ASSERT(((_ram_size) % sizeof(uint32_t)) == 0);                                              \
+static uint32_t CONCAT_2(_name, _ram)[(_ram_size) / sizeof(uint32_t)];                             \
+static uint32_t CONCAT_2(_name, _staging)[ALARM_BACKLOG_CHUNK_SIZE / sizeof(uint32_t)];            \
+static alarm_backlog_t _name =                                                                     \
+{                                                                                                  \
+    .p_ram     = (uint8_t *)CONCAT_2(_name, _ram),                                                 \
+    .ram_size  = (_ram_size),                                                                      \
+    .file_id   = (_file_id),                                                                       \
+    .p_staging = CONCAT_2(_name, _staging)                                                         \
+}
+
+/**@brief Function for initializing a backlog instance.
+ *
+ * @details Registers with FDS on first use, so it must run before FDS is initialized.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_backlog_init(alarm_backlog_t * p_backlog, alarm_backlog_init_t const * p_init);
+
+/**@brief Function for storing a record until the peer returns. Safe to call from any interrupt level.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH if the record is empty or larger than
+ *              @ref ALARM_BACKLOG_RECORD_MAX_LEN, or NRF_ERROR_NO_MEM if the policy refused it.
+ */
+ret_code_t alarm_backlog_put(alarm_backlog_t * p_backlog, uint8_t const * p_data, uint16_t length);
+
+/**@brief Function for delivering stored records until the backlog is empty or the peer is full.
+ *
+ * @details Call when the peer returns and whenever it frees space. Reentrant calls from other
+ *          interrupt levels are folded into the drain already in progress.
+ */
+void alarm_backlog_drain(alarm_backlog_t * p_backlog);
+
+/**@brief Function for checking whether records are waiting. */
+bool alarm_backlog_is_empty(alarm_backlog_t const * p_backlog);
+
+/**@brief Function for changing the policy applied once the backlog is full. */
+void alarm_backlog_policy_set(alarm_backlog_t * p_backlog, alarm_backlog_policy_t policy);
+
+void alarm_backlog_depth_get(alarm_backlog_t const * p_backlog, alarm_backlog_depth_t * p_depth);
+
+alarm_backlog_stats_t const * alarm_backlog_stats_get(alarm_backlog_t const * p_backlog);
+
+#endif // ALARM_BACKLOG_H__
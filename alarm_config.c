@@ -0,0 +1,353 @@
+#include "sdk_common.h"
+#include "alarm_config.h"
+#include <string.h>
+#include "app_util_platform.h"
+#include "crc16.h"
+#include "fds.h"
+#include "nrf_log.h"
+
+#define ZONE_FLAGS_ALL  (ALARM_CONFIG_ZONE_FLAG_ENABLED | ALARM_CONFIG_ZONE_FLAG_24H)
+
+static alarm_config_evt_handler_t m_evt_handler;
+static alarm_config_t             m_active;                         /**< Configuration in use. */
+static alarm_config_t             m_staged;                         /**< Validated blob waiting for commit. */
+static bool                       m_staged_valid;
+static uint32_t                   m_flash_buf[CEIL_DIV(ALARM_CONFIG_ENCODED_MAX_LEN, sizeof(uint32_t))];  /**< Must stay valid until FDS finishes the write. */
+static bool                       m_store_busy;                     /**< A flash write is in progress. */
+static bool                       m_store_again;                    /**< A newer commit arrived during the write. */
+
+
+/**@brief Function for filling in the table used when nothing is stored: one enabled zone per
+ *        detector, all forwarded to the ESP. */
+static void defaults_set(alarm_config_t * p_config)
+{
+    memset(p_config, 0, sizeof(*p_config));
+
+    for (uint8_t source = 0; source < ALARM_CONFIG_SOURCE_COUNT; source++)
+    {
+        p_config->zones[source].source = source;
+        p_config->zones[source].flags  = ALARM_CONFIG_ZONE_FLAG_ENABLED;
+    }
+    p_config->zone_count = ALARM_CONFIG_SOURCE_COUNT;
+
+    p_config->rules[0].zone_mask = (1 << ALARM_CONFIG_SOURCE_COUNT) - 1;
+    p_config->rules[0].action    = ALARM_CONFIG_ACTION_FORWARD;
+    p_config->rule_count         = 1;
+}
+
+
+uint16_t alarm_config_encode(alarm_config_t const * p_config, uint8_t * p_buf)
+{
+    uint16_t len = 0;
+
+    p_buf[len++] = ALARM_CONFIG_MAGIC;
+    p_buf[len++] = ALARM_CONFIG_VERSION;
+    p_buf[len++] = p_config->zone_count;
+    p_buf[len++] = p_config->rule_count;
+
+    for (uint8_t i = 0; i < p_config->zone_count; i++)
+    {
+        p_buf[len++] = p_config->zones[i].source;
+        p_buf[len++] = p_config->zones[i].flags;
+        len += uint16_encode(p_config->zones[i].entry_delay_s, &p_buf[len]);
+    }
+
+    for (uint8_t i = 0; i < p_config->rule_count; i++)
+    {
+        len += uint16_encode(p_config->rules[i].zone_mask, &p_buf[len]);
+        p_buf[len++] = p_config->rules[i].action;
+        p_buf[len++] = p_config->rules[i].arg;
+    }
+
+    len += uint16_encode(crc16_compute(p_buf, len, NULL), &p_buf[len]);
+
+    return len;
+}
+
+
+ret_code_t alarm_config_decode(uint8_t const * p_data, uint16_t length, alarm_config_t * p_config)
+{
+    uint8_t  zone_count;
+    uint8_t  rule_count;
+    uint16_t zone_mask_all;
+    uint16_t offset = ALARM_CONFIG_HEADER_LEN;
+
+    if (length < (ALARM_CONFIG_HEADER_LEN + ALARM_CONFIG_CRC_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    zone_count = p_data[2];
+    rule_count = p_data[3];
+
+    if ((p_data[0] != ALARM_CONFIG_MAGIC)          ||
+        (p_data[1] != ALARM_CONFIG_VERSION)        ||
+        (zone_count > ALARM_CONFIG_MAX_ZONES)      ||
+        (rule_count > ALARM_CONFIG_MAX_RULES))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    if (length != (ALARM_CONFIG_HEADER_LEN +
+                   ((zone_count + rule_count) * ALARM_CONFIG_ENTRY_LEN) +
+                   ALARM_CONFIG_CRC_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    if (crc16_compute(p_data, length - ALARM_CONFIG_CRC_LEN, NULL) !=
+        uint16_decode(&p_data[length - ALARM_CONFIG_CRC_LEN]))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    memset(p_config, 0, sizeof(*p_config));
+    p_config->zone_count = zone_count;
+    p_config->rule_count = rule_count;
+
+    for (uint8_t i = 0; i < zone_count; i++)
+    {
+        alarm_config_zone_t * p_zone = &p_config->zones[i];
+
+        p_zone->source        = p_data[offset];
+        p_zone->flags         = p_data[offset + 1];
+        p_zone->entry_delay_s = uint16_decode(&p_data[offset + 2]);
+        offset               += ALARM_CONFIG_ENTRY_LEN;
+
+        if ((p_zone->source >= ALARM_CONFIG_SOURCE_COUNT) || ((p_zone->flags & ~ZONE_FLAGS_ALL) != 0))
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+    }
+
+    zone_mask_all = (uint16_t)((1UL << zone_count) - 1);
+
+    for (uint8_t i = 0; i < rule_count; i++)
+    {
+        alarm_config_rule_t * p_rule = &p_config->rules[i];
+
+        p_rule->zone_mask = uint16_decode(&p_data[offset]);
+        p_rule->action    = p_data[offset + 2];
+        p_rule->arg       = p_data[offset + 3];
+        offset           += ALARM_CONFIG_ENTRY_LEN;
+
+        if ((p_rule->action >= ALARM_CONFIG_ACTION_COUNT) || ((p_rule->zone_mask & ~zone_mask_all) != 0))
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for writing the active configuration to flash.
+ *
+ * @details Only one write is in flight at a time; a commit during the write is picked up when it
+ *          completes, so flash always ends up with the newest table.
+ */
+static void store(void)
+{
+    ret_code_t        err_code;
+    fds_record_t      record;
+    fds_record_desc_t desc;
+    fds_find_token_t  token;
+
+    if (m_store_busy)
+    {
+        m_store_again = true;
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    record.data.length_words = BYTES_TO_WORDS(alarm_config_encode(&m_active, (uint8_t *)m_flash_buf));
+    CRITICAL_REGION_EXIT();
+
+    record.file_id     = ALARM_CONFIG_FILE_ID;
+    record.key         = ALARM_CONFIG_RECORD_KEY;
+    record.data.p_data = m_flash_buf;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(ALARM_CONFIG_FILE_ID, ALARM_CONFIG_RECORD_KEY, &desc, &token) == NRF_SUCCESS)
+    {
+        err_code = fds_record_update(&desc, &record);
+    }
+    else
+    {
+        err_code = fds_record_write(NULL, &record);
+    }
+
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH)
+    {
+        // Reclaim the space of superseded records and retry once garbage collection is done.
+        err_code = fds_gc();
+        if (err_code == NRF_SUCCESS)
+        {
+            m_store_again = true;
+            return;
+        }
+    }
+
+    if (err_code == NRF_SUCCESS)
+    {
+        m_store_busy = true;
+    }
+    else
+    {
+        NRF_LOG_ERROR("Configuration store failed: 0x%x.", err_code);
+        m_evt_handler(ALARM_CONFIG_EVT_STORE_FAILED);
+    }
+}
+
+
+/**@brief Function for loading the stored configuration, keeping the defaults if there is none
+ *        or it does not validate. */
+static void load(void)
+{
+    fds_record_desc_t  desc;
+    fds_find_token_t   token;
+    fds_flash_record_t flash_record;
+    alarm_config_t     config;
+
+    memset(&token, 0, sizeof(token));
+    if ((fds_record_find(ALARM_CONFIG_FILE_ID, ALARM_CONFIG_RECORD_KEY, &desc, &token) == NRF_SUCCESS) &&
+        (fds_record_open(&desc, &flash_record) == NRF_SUCCESS))
+    {
+        // Word-padded on flash, so the exact length comes from the counts in the header.
+        uint8_t const * p_data = flash_record.p_data;
+        uint16_t        length = ALARM_CONFIG_HEADER_LEN +
+                                 ((p_data[2] + p_data[3]) * ALARM_CONFIG_ENTRY_LEN) +
+                                 ALARM_CONFIG_CRC_LEN;
+
+        if ((length <= (flash_record.p_header->length_words * sizeof(uint32_t))) &&
+            (alarm_config_decode(p_data, length, &config) == NRF_SUCCESS))
+        {
+            CRITICAL_REGION_ENTER();
+            m_active = config;
+            CRITICAL_REGION_EXIT();
+        }
+        else
+        {
+            NRF_LOG_WARNING("Stored configuration is invalid, using defaults.");
+        }
+
+        (void)fds_record_close(&desc);
+    }
+
+    m_evt_handler(ALARM_CONFIG_EVT_LOADED);
+}
+
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    switch (p_evt->id)
+    {
+        case FDS_EVT_INIT:
+            if (p_evt->result == NRF_SUCCESS)
+            {
+                load();
+            }
+            break;
+
+        case FDS_EVT_WRITE:
+        case FDS_EVT_UPDATE:
+            if ((p_evt->write.file_id != ALARM_CONFIG_FILE_ID) ||
+                (p_evt->write.record_key != ALARM_CONFIG_RECORD_KEY))
+            {
+                break;
+            }
+            m_store_busy = false;
+            m_evt_handler((p_evt->result == NRF_SUCCESS) ? ALARM_CONFIG_EVT_STORED
+                                                         : ALARM_CONFIG_EVT_STORE_FAILED);
+            if (m_store_again)
+            {
+                m_store_again = false;
+                store();
+            }
+            break;
+
+        case FDS_EVT_GC:
+            if (m_store_again && !m_store_busy)
+            {
+                m_store_again = false;
+                store();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+ret_code_t alarm_config_init(alarm_config_evt_handler_t evt_handler)
+{
+    VERIFY_PARAM_NOT_NULL(evt_handler);
+
+    m_evt_handler  = evt_handler;
+    m_staged_valid = false;
+    m_store_busy   = false;
+    m_store_again  = false;
+    defaults_set(&m_active);
+
+    return fds_register(fds_evt_handler);
+}
+
+
+ret_code_t alarm_config_stage(uint8_t const * p_data, uint16_t length)
+{
+    ret_code_t err_code;
+
+    VERIFY_PARAM_NOT_NULL(p_data);
+
+    err_code       = alarm_config_decode(p_data, length, &m_staged);
+    m_staged_valid = (err_code == NRF_SUCCESS);
+
+    return err_code;
+}
+
+
+ret_code_t alarm_config_commit(void)
+{
+    if (!m_staged_valid)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    CRITICAL_REGION_ENTER();
+    m_active = m_staged;
+    CRITICAL_REGION_EXIT();
+
+    m_staged_valid = false;
+    store();
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_config_get(alarm_config_t * p_config)
+{
+    CRITICAL_REGION_ENTER();
+    *p_config = m_active;
+    CRITICAL_REGION_EXIT();
+}
+
+
+bool alarm_config_source_enabled(alarm_config_source_t source)
+{
+    bool enabled = false;
+
+    CRITICAL_REGION_ENTER();
+    for (uint8_t i = 0; i < m_active.zone_count; i++)
+    {
+        if ((m_active.zones[i].source == source) &&
+            ((m_active.zones[i].flags & ALARM_CONFIG_ZONE_FLAG_ENABLED) != 0))
+        {
+            enabled = true;
+            break;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    return enabled;
+}
@@ -0,0 +1,126 @@
+#ifndef ALARM_CONFIG_H__
+#define ALARM_CONFIG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+#define ALARM_CONFIG_MAGIC              0xAC                        /**< First byte of every configuration blob. */
+#define ALARM_CONFIG_VERSION            1                           /**< Blob layout version. */
+#define ALARM_CONFIG_MAX_ZONES          16
+#define ALARM_CONFIG_MAX_RULES          16
+
+#define ALARM_CONFIG_HEADER_LEN         4                           /**< Magic, version, zone count, rule count. */
+#define ALARM_CONFIG_ENTRY_LEN          4                           /**< Encoded size of one zone or rule. */
+#define ALARM_CONFIG_CRC_LEN            2
+#define ALARM_CONFIG_ENCODED_MAX_LEN    (ALARM_CONFIG_HEADER_LEN +                                      \
+                                         ((ALARM_CONFIG_MAX_ZONES + ALARM_CONFIG_MAX_RULES) *           \
+                                          ALARM_CONFIG_ENTRY_LEN) +                                     \
+                                         ALARM_CONFIG_CRC_LEN)
+
+#define ALARM_CONFIG_FILE_ID            0x1A01                      /**< FDS file holding application records. */
+#define ALARM_CONFIG_RECORD_KEY         0x0001                      /**< FDS record key of the configuration blob. */
+
+/**@brief   Detector feeding a zone. */
+typedef enum
+{
+    ALARM_CONFIG_SOURCE_MIC,                                        /**< Microphone level limits. */
+    ALARM_CONFIG_SOURCE_VIBRATION,                                  /**< Vibration sensor limit. */
+    ALARM_CONFIG_SOURCE_BATTERY,                                    /**< Supply voltage limit. */
+    ALARM_CONFIG_SOURCE_GLASSBREAK,                                 /**< Acoustic glass-break detector. */
+    ALARM_CONFIG_SOURCE_COUNT
+} alarm_config_source_t;
+
+/**@brief   Action taken when a rule matches. */
+typedef enum
+{
+    ALARM_CONFIG_ACTION_NOTIFY,                                     /**< Report to the connected peer only. */
+    ALARM_CONFIG_ACTION_FORWARD,                                    /**< Forward an alarm command to the ESP. */
+    ALARM_CONFIG_ACTION_COUNT
+} alarm_config_action_t;
+
+#define ALARM_CONFIG_ZONE_FLAG_ENABLED  0x01                        /**< The zone raises alarms. */
+#define ALARM_CONFIG_ZONE_FLAG_24H      0x02                        /**< The zone is armed even while the system is disarmed. */
+
+typedef struct
+{
+    uint8_t  source;                                                /**< @ref alarm_config_source_t. */
+    uint8_t  flags;                                                 /**< ALARM_CONFIG_ZONE_FLAG_* bits. */
+    uint16_t entry_delay_s;                                         /**< Delay before the zone raises an alarm. */
+} alarm_config_zone_t;
+
+typedef struct
+{
+    uint16_t zone_mask;                                             /**< Zones the rule applies to. */
+    uint8_t  action;                                                /**< @ref alarm_config_action_t. */
+    uint8_t  arg;                                                   /**< Action argument. */
+} alarm_config_rule_t;
+
+/**@brief   Decoded zone and rule table. */
+typedef struct
+{
+    uint8_t             zone_count;
+    uint8_t             rule_count;
+    alarm_config_zone_t zones[ALARM_CONFIG_MAX_ZONES];
+    alarm_config_rule_t rules[ALARM_CONFIG_MAX_RULES];
+} alarm_config_t;
+
+typedef enum
+{
+    ALARM_CONFIG_EVT_LOADED,                                        /**< The active configuration was read from flash (or defaulted). */
+    ALARM_CONFIG_EVT_STORED,                                        /**< A committed configuration reached flash. */
+    ALARM_CONFIG_EVT_STORE_FAILED                                   /**< A committed configuration could not be written to flash. */
+} alarm_config_evt_t;
+
+typedef void (*alarm_config_evt_handler_t)(alarm_config_evt_t evt);
+
+/**@brief Function for initializing the configuration store.
+ *
+ * @details Must be called before fds_init() (done by the Peer Manager). The stored blob is
+ *          loaded once FDS reports that it is ready; until then the default table is active.
+ *
+ * @param[in]   evt_handler     Handler for configuration events.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_config_init(alarm_config_evt_handler_t evt_handler);
+
+/**@brief Function for decoding and validating a complete configuration blob.
+ *
+ * @details The blob is checked as a whole: magic, version, counts, the exact length implied by
+ *          the counts, every field range and the trailing CRC16 (CCITT, over all bytes before it).
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH or NRF_ERROR_INVALID_DATA.
+ */
+ret_code_t alarm_config_decode(uint8_t const * p_data, uint16_t length, alarm_config_t * p_config);
+
+/**@brief Function for encoding a configuration, CRC included.
+ *
+ * @param[out]  p_buf       Buffer of at least @ref ALARM_CONFIG_ENCODED_MAX_LEN bytes.
+ *
+ * @return      Number of bytes written.
+ */
+uint16_t alarm_config_encode(alarm_config_t const * p_config, uint8_t * p_buf);
+
+/**@brief Function for validating a blob and holding it until @ref alarm_config_commit.
+ *
+ * @return      See @ref alarm_config_decode. On error the previously staged blob is discarded.
+ */
+ret_code_t alarm_config_stage(uint8_t const * p_data, uint16_t length);
+
+/**@brief Function for making the staged configuration active and writing it to flash.
+ *
+ * @details The RAM copy is swapped in one critical region, so readers never see a mix of the
+ *          old and new tables. The flash write completes asynchronously.
+ *
+ * @return      NRF_SUCCESS, or NRF_ERROR_INVALID_STATE if nothing is staged.
+ */
+ret_code_t alarm_config_commit(void);
+
+/**@brief Function for copying the active configuration. */
+void alarm_config_get(alarm_config_t * p_config);
+
+/**@brief Function for checking whether any enabled zone is fed by a detector. */
+bool alarm_config_source_enabled(alarm_config_source_t source);
+
+#endif // ALARM_CONFIG_H__
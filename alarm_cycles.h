@@ -0,0 +1,20 @@
+#ifndef ALARM_CYCLES_H__
+#define ALARM_CYCLES_H__
+
+#include "nrf.h"
+
+/**@brief   CPU cycle counter used to benchmark hot paths on the device.
+ *
+ * @details Uses the DWT cycle counter when the core has one and reads as zero otherwise, so
+ *          code instrumented with it still builds for targets without a DWT.
+ */
+#if defined(DWT)
+#define ALARM_CYCLES_ENABLE()   do { CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;    \
+                                     DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk; } while (0)
+#define ALARM_CYCLES_NOW()      (DWT->CYCCNT)
+#else
+#define ALARM_CYCLES_ENABLE()
+#define ALARM_CYCLES_NOW()      0
+#endif
+
+#endif // ALARM_CYCLES_H__
@@ -0,0 +1,205 @@
+#include "sdk_common.h"
+#include "alarm_dedup.h"
+#include <string.h>
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "alarm_util.h"
+
+/**@brief   Window of one forwarded command. */
+typedef struct
+{
+    bool     used;
+    uint8_t  seq;
+    uint16_t length;
+    uint16_t repeats;
+    uint32_t forwarded_at;                                          /**< app_timer counter value when the command was forwarded. */
+    uint8_t  cmd[ALARM_DEDUP_CMD_MAX_LEN];
+} entry_t;
+
+APP_TIMER_DEF(m_timer_id);
+
+static alarm_dedup_init_t  m_init;
+static entry_t             m_cache[ALARM_DEDUP_ENTRIES];
+static bool                m_timer_running;
+static alarm_dedup_stats_t m_stats;
+
+
+static bool is_open(entry_t const * p_entry, uint32_t now)
+{
+    return ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(now, p_entry->forwarded_at)) < ALARM_DEDUP_WINDOW_MS;
+}
+
+
+/**@brief Function for reporting a closed window. Called outside critical regions. */
+static void report(entry_t const * p_entry)
+{
+    alarm_dedup_report_t rpt;
+
+    if (p_entry->repeats == 0)
+    {
+        return;
+    }
+
+    rpt.p_cmd   = p_entry->cmd;
+    rpt.length  = p_entry->length;
+    rpt.seq     = p_entry->seq;
+    rpt.repeats = p_entry->repeats;
+
+    m_stats.reports++;
+    m_init.report(&rpt);
+}
+
+
+/**@brief Function for closing the windows that have run out. */
+static void timeout_handler(void * p_context)
+{
+    uint32_t now     = app_timer_cnt_get();
+    bool     pending = false;
+
+    UNUSED_PARAMETER(p_context);
+
+    for (uint8_t i = 0; i < ALARM_DEDUP_ENTRIES; i++)
+    {
+        entry_t closed;
+
+        CRITICAL_REGION_ENTER();
+        closed.used = m_cache[i].used && !is_open(&m_cache[i], now);
+        if (closed.used)
+        {
+            closed          = m_cache[i];
+            m_cache[i].used = false;
+        }
+        pending = pending || m_cache[i].used;
+        CRITICAL_REGION_EXIT();
+
+        if (closed.used)
+        {
+            report(&closed);
+        }
+    }
+
+    if (!pending)
+    {
+        CRITICAL_REGION_ENTER();
+        // A command added since the scan above keeps the timer running.
+        for (uint8_t i = 0; i < ALARM_DEDUP_ENTRIES; i++)
+        {
+            pending = pending || m_cache[i].used;
+        }
+        if (!pending)
+        {
+            (void)app_timer_stop(m_timer_id);
+            m_timer_running = false;
+        }
+        CRITICAL_REGION_EXIT();
+    }
+}
+
+
+ret_code_t alarm_dedup_init(alarm_dedup_init_t const * p_init)
+{
+    VERIFY_PARAM_NOT_NULL(p_init);
+    VERIFY_PARAM_NOT_NULL(p_init->report);
+
+    m_init          = *p_init;
+    m_timer_running = false;
+    memset(m_cache, 0, sizeof(m_cache));
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    return app_timer_create(&m_timer_id, APP_TIMER_MODE_REPEATED, timeout_handler);
+}
+
+
+bool alarm_dedup_is_repeat(uint8_t const * p_cmd, uint16_t length)
+{
+    uint32_t now    = app_timer_cnt_get();
+    bool     repeat = false;
+
+    if (length > ALARM_DEDUP_CMD_MAX_LEN)
+    {
+        return false;
+    }
+
+    CRITICAL_REGION_ENTER();
+    for (uint8_t i = 0; i < ALARM_DEDUP_ENTRIES; i++)
+    {
+        entry_t * p_entry = &m_cache[i];
+
+        // An entry whose window ran out is left to the timer; the copy starts a new window.
+        if (p_entry->used && (p_entry->length == length) && is_open(p_entry, now) &&
+            (memcmp(p_entry->cmd, p_cmd, length) == 0))
+        {
+            p_entry->repeats = (uint16_t)MIN(p_entry->repeats + 1, UINT16_MAX);
+            m_stats.absorbed++;
+            repeat = true;
+            break;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    return repeat;
+}
+
+
+void alarm_dedup_add(uint8_t const * p_cmd, uint16_t length, uint8_t seq)
+{
+    entry_t * p_entry = NULL;
+    entry_t   evicted = {.used = false};
+    uint32_t  now     = app_timer_cnt_get();
+    uint32_t  age_max = 0;
+    bool      start;
+
+    if (length > ALARM_DEDUP_CMD_MAX_LEN)
+    {
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    for (uint8_t i = 0; i < ALARM_DEDUP_ENTRIES; i++)
+    {
+        if (!m_cache[i].used)
+        {
+            p_entry = &m_cache[i];
+            break;
+        }
+        if (app_timer_cnt_diff_compute(now, m_cache[i].forwarded_at) >= age_max)
+        {
+            p_entry = &m_cache[i];                                  // Oldest so far.
+            age_max = app_timer_cnt_diff_compute(now, m_cache[i].forwarded_at);
+        }
+    }
+
+    if (p_entry->used)
+    {
+        evicted = *p_entry;
+        m_stats.evicted++;
+    }
+
+    p_entry->used         = true;
+    p_entry->seq          = seq;
+    p_entry->length       = length;
+    p_entry->repeats      = 0;
+    p_entry->forwarded_at = now;
+    memcpy(p_entry->cmd, p_cmd, length);
+    m_stats.forwarded++;
+
+    start           = !m_timer_running;
+    m_timer_running = true;
+    CRITICAL_REGION_EXIT();
+
+    if (evicted.used)
+    {
+        report(&evicted);
+    }
+
+    if (start)
+    {
+        (void)app_timer_start(m_timer_id, APP_TIMER_TICKS(ALARM_DEDUP_POLL_MS), NULL);
+    }
+}
+
+
+alarm_dedup_stats_t const * alarm_dedup_stats_get(void)
+{
+    return &m_stats;
+}
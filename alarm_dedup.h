@@ -0,0 +1,80 @@
+#ifndef ALARM_DEDUP_H__
+#define ALARM_DEDUP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+/**@file
+ *
+ * @details Coalescing of repeated alarm commands. A peer on a flaky link writes the same alarm
+ *          command several times; only the first copy is forwarded, at once. Copies with the same
+ *          content that arrive within @ref ALARM_DEDUP_WINDOW_MS of it are counted instead, and
+ *          when the window closes the count is reported once, against the sequence number of
+ *          the forwarded frame. A copy after the window is a new alarm.
+ *
+ *          Commands longer than @ref ALARM_DEDUP_CMD_MAX_LEN are always forwarded: entries are
+ *          matched on the whole command, never on a hash, so a distinct alarm is never absorbed.
+ */
+
+#define ALARM_DEDUP_ENTRIES             4                           /**< Distinct commands tracked at once. */
+#define ALARM_DEDUP_CMD_MAX_LEN         20                          /**< Longest command that is deduplicated. */
+#define ALARM_DEDUP_WINDOW_MS           1000                        /**< Time after a forwarded command during which copies are absorbed. */
+#define ALARM_DEDUP_POLL_MS             100                         /**< Resolution of the window timer. */
+
+/**@brief   Repeats absorbed during the window of one forwarded command. */
+typedef struct
+{
+    uint8_t const * p_cmd;
+    uint16_t        length;
+    uint8_t         seq;                                            /**< Sequence number given to @ref alarm_dedup_add. */
+    uint16_t        repeats;                                        /**< Copies absorbed, at least 1. */
+} alarm_dedup_report_t;
+
+/**@brief   Reports the repeats of one command once its window closes. Not called for commands
+ *          that were not repeated. */
+typedef void (*alarm_dedup_report_handler_t)(alarm_dedup_report_t const * p_report);
+
+typedef struct
+{
+    alarm_dedup_report_handler_t report;
+} alarm_dedup_init_t;
+
+/**@brief   Counters since boot. */
+typedef struct
+{
+    uint32_t forwarded;                                             /**< Commands recorded through @ref alarm_dedup_add. */
+    uint32_t absorbed;                                              /**< Copies that were not forwarded. */
+    uint32_t reports;                                               /**< Windows closed with repeats. */
+    uint32_t evicted;                                               /**< Windows closed early to make room. */
+} alarm_dedup_stats_t;
+
+/**@brief Function for initializing the dedup cache. Needs app_timer.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_dedup_init(alarm_dedup_init_t const * p_init);
+
+/**@brief Function for checking whether a command repeats one forwarded within the window.
+ *
+ * @details A repeat is counted against the forwarded command. Safe to call from any interrupt
+ *          level.
+ *
+ * @return      True if the command must not be forwarded.
+ */
+bool alarm_dedup_is_repeat(uint8_t const * p_cmd, uint16_t length);
+
+/**@brief Function for opening the window of a command that was just forwarded.
+ *
+ * @details If every entry is in use, the oldest window is closed and reported first. Safe to
+ *          call from any interrupt level.
+ *
+ * @param[in]   p_cmd       Command, copied.
+ * @param[in]   length      Commands longer than @ref ALARM_DEDUP_CMD_MAX_LEN are ignored.
+ * @param[in]   seq         Sequence number of the frame that carried it.
+ */
+void alarm_dedup_add(uint8_t const * p_cmd, uint16_t length, uint8_t seq);
+
+alarm_dedup_stats_t const * alarm_dedup_stats_get(void);
+
+#endif // ALARM_DEDUP_H__
@@ -0,0 +1,881 @@
+#include "sdk_common.h"
+#include "alarm_esp.h"
+#include <string.h>
+#include "nrf_drv_uart.h"
+#include "nrf_drv_timer.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_gpiote.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_gpio.h"
+#include "nrf_delay.h"
+#include "nrf_log.h"
+#include "alarm_util.h"
+
+#define TX_BUF_SIZE             256                                 /**< TX ring; one EasyDMA transfer covers at most its contiguous part. */
+#define RX_BUF_LEN              255                                 /**< Per RX buffer; RXD.MAXCNT is 8 bits on nRF52832. */
+#define CTRL_FRAME_MAX_LEN      4                                   /**< Longest ESP control frame, '\r' included. */
+#define IRQ_PRIORITY            APP_TIMER_CONFIG_IRQ_PRIORITY       /**< UARTE, counter and app_timer handlers never preempt each other. */
+
+#if defined (UART_PRESENT)
+#define ERROR_OVERRUN           NRF_UART_ERROR_OVERRUN_MASK
+#define ERROR_PARITY            NRF_UART_ERROR_PARITY_MASK
+#define ERROR_FRAMING           NRF_UART_ERROR_FRAMING_MASK
+#define ERROR_BREAK             NRF_UART_ERROR_BREAK_MASK
+#define EVENT_RXDRDY            NRF_UART_EVENT_RXDRDY
+#else
+#define ERROR_OVERRUN           NRF_UARTE_ERROR_OVERRUN_MASK
+#define ERROR_PARITY            NRF_UARTE_ERROR_PARITY_MASK
+#define ERROR_FRAMING           NRF_UARTE_ERROR_FRAMING_MASK
+#define ERROR_BREAK             NRF_UARTE_ERROR_BREAK_MASK
+#define EVENT_RXDRDY            NRF_UARTE_EVENT_RXDRDY
+#endif
+
+typedef enum
+{
+    STATE_REQUEST,                                                  /**< Rate request sent at the base rate, waiting for 'B'. */
+    STATE_SWITCH,                                                   /**< 'B' received; reopen at the accepted rate from the timer. */
+    STATE_PROBE,                                                    /**< Probe sent at the new rate, waiting for 'P'. */
+    STATE_UP,
+    STATE_SLEEP,                                                    /**< Gated: UARTE off, nRF wake line low. */
+    STATE_WAKE                                                      /**< Reopening the UARTE, then waiting for the ESP wake line. */
+} state_t;
+
+typedef struct
+{
+    uint32_t uart;                                                  /**< BAUDRATE register value. */
+    uint32_t bps;
+} rate_t;
+
+static const rate_t m_rates[ALARM_ESP_RATE_COUNT] =
+{
+#if defined (UART_PRESENT)
+    {NRF_UART_BAUDRATE_115200,  115200},
+    {NRF_UART_BAUDRATE_230400,  230400},
+    {NRF_UART_BAUDRATE_460800,  460800},
+    {NRF_UART_BAUDRATE_921600,  921600},
+    {NRF_UART_BAUDRATE_1000000, 1000000},
+#else
+    {NRF_UARTE_BAUDRATE_115200,  115200},
+    {NRF_UARTE_BAUDRATE_230400,  230400},
+    {NRF_UARTE_BAUDRATE_460800,  460800},
+    {NRF_UARTE_BAUDRATE_921600,  921600},
+    {NRF_UARTE_BAUDRATE_1000000, 1000000},
+#endif
+};
+
+static const nrf_drv_uart_t  m_uart       = NRF_DRV_UART_INSTANCE(0);
+static const nrf_drv_timer_t m_rx_counter = NRF_DRV_TIMER_INSTANCE(2);  /**< TIMER0 belongs to the SoftDevice, TIMER1 to the SAADC. */
+
+APP_TIMER_DEF(m_timer_id);
+APP_TIMER_DEF(m_idle_timer_id);
+APP_TIMER_DEF(m_sleep_timer_id);
+APP_TIMER_DEF(m_wake_timer_id);
+
+static alarm_esp_init_t  m_init;
+static volatile state_t  m_state;
+static uint8_t           m_target;                                  /**< Highest rate the next request asks for. */
+static uint8_t           m_rate_new;                                /**< Rate accepted by the ESP. */
+static bool              m_hwfc_new;
+static bool              m_gated_new;                               /**< Power gating accepted by the ESP. */
+static bool              m_open;
+static uint8_t           m_ctrl[CTRL_FRAME_MAX_LEN];
+static uint8_t           m_ctrl_len;
+static uint32_t          m_framing_errors_tick;                     /**< Framing errors since the last tick. */
+static uint32_t          m_tx_bytes_tick;                           /**< tx_bytes at the last tick. */
+static alarm_esp_stats_t m_stats;
+static uint32_t          m_active_at;                               /**< app_timer counter value of the last traffic. */
+static uint32_t          m_slept_at;                                /**< app_timer counter value asleep time was last added at. */
+static uint32_t          m_wake_at;                                 /**< app_timer counter value of the pending wake request. */
+
+static uint8_t           m_tx_buf[TX_BUF_SIZE];
+static uint32_t          m_tx_head;                                 /**< Bytes ever written to the ring. */
+static uint32_t          m_tx_tail;                                 /**< Bytes ever sent from the ring. */
+static uint8_t           m_tx_len;                                  /**< Bytes of the EasyDMA transfer in progress, 0 when idle. */
+
+static uint8_t           m_rx_buf[2][RX_BUF_LEN];
+static uint8_t           m_rx_active;                               /**< Buffer EasyDMA is writing. */
+static uint8_t           m_rx_read;                                 /**< Bytes of the active buffer already handled. */
+static uint32_t          m_rx_start;                                /**< Byte counter value when the active buffer started. */
+static uint32_t          m_rx_seen;                                 /**< Byte counter value at the last idle poll. */
+static nrf_ppi_channel_t m_ppi_channel;                             /**< RXDRDY to the byte counter. */
+
+
+static void uart_evt_handler(nrf_drv_uart_event_t * p_event, void * p_context);
+static void rx_bytes(uint8_t const * p_data, uint16_t length);
+static void negotiate(uint8_t target);
+
+
+/**@brief Function for noting traffic on the link, which postpones gating. */
+static void activity(void)
+{
+    m_active_at = app_timer_cnt_get();
+}
+
+
+static bool wake_wired(void)
+{
+    return (m_init.wake_out_pin != ALARM_ESP_PIN_NONE) && (m_init.wake_in_pin != ALARM_ESP_PIN_NONE);
+}
+
+
+static bool wake_in_high(void)
+{
+    return nrf_gpio_pin_read(m_init.wake_in_pin) != 0;
+}
+
+
+/**@brief Function for starting an EasyDMA transfer of the contiguous head of the TX ring.
+ *
+ * @details Call inside a critical region.
+ */
+static void tx_start(void)
+{
+    uint32_t len;
+
+    if ((m_tx_len != 0) || (m_tx_head == m_tx_tail))
+    {
+        return;
+    }
+
+    len = MIN(m_tx_head - m_tx_tail, TX_BUF_SIZE - (m_tx_tail % TX_BUF_SIZE));
+    len = MIN(len, UINT8_MAX);
+    if (nrf_drv_uart_tx(&m_uart, &m_tx_buf[m_tx_tail % TX_BUF_SIZE], (uint8_t)len) == NRF_SUCCESS)
+    {
+        m_tx_len = (uint8_t)len;
+    }
+}
+
+
+/**@brief Function for copying as many bytes as fit into the TX ring and starting transmission.
+ *
+ * @return  Number of bytes accepted.
+ */
+static uint16_t tx_put(uint8_t const * p_data, uint16_t length)
+{
+    uint16_t sent = 0;
+
+    CRITICAL_REGION_ENTER();
+    while ((sent < length) && ((m_tx_head - m_tx_tail) < TX_BUF_SIZE))
+    {
+        m_tx_buf[m_tx_head % TX_BUF_SIZE] = p_data[sent++];
+        m_tx_head++;
+    }
+    m_stats.tx_bytes += sent;
+    tx_start();
+    CRITICAL_REGION_EXIT();
+
+    if (sent != 0)
+    {
+        activity();
+    }
+
+    return sent;
+}
+
+
+/**@brief Function for handling the bytes EasyDMA wrote to the active buffer since the last call.
+ *
+ * @param[in]   count   Byte counter value; bytes beyond the active buffer wait for ENDRX.
+ */
+static void rx_flush(uint32_t count)
+{
+    uint32_t avail = MIN(count - m_rx_start, RX_BUF_LEN);
+
+    if (avail > m_rx_read)
+    {
+        rx_bytes(&m_rx_buf[m_rx_active][m_rx_read], avail - m_rx_read);
+        m_rx_read = (uint8_t)avail;
+    }
+}
+
+
+/**@brief Function for making the byte counter interrupt on the next received byte. */
+static void idle_arm(void)
+{
+    m_rx_seen = nrf_drv_timer_capture(&m_rx_counter, NRF_TIMER_CC_CHANNEL0);
+    nrf_drv_timer_compare(&m_rx_counter, NRF_TIMER_CC_CHANNEL1, m_rx_seen + 1, true);
+
+    // A byte received while arming has already passed the compare value.
+    if (nrf_drv_timer_capture(&m_rx_counter, NRF_TIMER_CC_CHANNEL0) != m_rx_seen)
+    {
+        nrf_drv_timer_compare_int_disable(&m_rx_counter, NRF_TIMER_CC_CHANNEL1);
+        (void)app_timer_start(m_idle_timer_id, APP_TIMER_TICKS(ALARM_ESP_RX_IDLE_MS), NULL);
+    }
+}
+
+
+/**@brief Function for polling the byte counter while bytes arrive. A poll period without a new
+ *        byte is an idle line: the partial buffer is handled and the counter re-armed.
+ */
+static void idle_timeout_handler(void * p_context)
+{
+    uint32_t count = nrf_drv_timer_capture(&m_rx_counter, NRF_TIMER_CC_CHANNEL0);
+
+    UNUSED_PARAMETER(p_context);
+
+    if (count != m_rx_seen)
+    {
+        m_rx_seen = count;
+        return;
+    }
+
+    (void)app_timer_stop(m_idle_timer_id);
+    m_stats.rx_idle_flushes++;
+    rx_flush(count);
+    idle_arm();
+}
+
+
+/**@brief The first byte after an idle period starts the idle poll. */
+static void rx_counter_handler(nrf_timer_event_t event_type, void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (event_type == NRF_TIMER_EVENT_COMPARE1)
+    {
+        nrf_drv_timer_compare_int_disable(&m_rx_counter, NRF_TIMER_CC_CHANNEL1);
+        (void)app_timer_start(m_idle_timer_id, APP_TIMER_TICKS(ALARM_ESP_RX_IDLE_MS), NULL);
+    }
+}
+
+
+/**@brief Function for queueing both RX buffers and resynchronizing the byte counter. */
+static void rx_start(void)
+{
+    (void)app_timer_stop(m_idle_timer_id);
+    nrf_drv_timer_clear(&m_rx_counter);
+
+    m_rx_active = 0;
+    m_rx_read   = 0;
+    m_rx_start  = 0;
+
+    // The second buffer is latched behind the first; ENDRX->STARTRX switches between them
+    // without waiting for the CPU.
+    (void)nrf_drv_uart_rx(&m_uart, m_rx_buf[0], RX_BUF_LEN);
+    (void)nrf_drv_uart_rx(&m_uart, m_rx_buf[1], RX_BUF_LEN);
+
+    idle_arm();
+}
+
+
+static void uart_close(void)
+{
+    if (m_open)
+    {
+        (void)app_timer_stop(m_idle_timer_id);
+        nrf_drv_uart_uninit(&m_uart);
+        m_open = false;
+
+        // The pins are released to their default, floating state. Hold TX at idle so the ESP
+        // sees neither data nor a break, and RTS deasserted so it does not send.
+        nrf_gpio_pin_set(m_init.tx_pin);
+        nrf_gpio_cfg_output(m_init.tx_pin);
+        if (m_stats.hwfc)
+        {
+            nrf_gpio_pin_set(m_init.rts_pin);
+            nrf_gpio_cfg_output(m_init.rts_pin);
+        }
+    }
+}
+
+
+/**@brief Function for (re)opening the UART. Bytes still in the TX ring are dropped. */
+static ret_code_t uart_open(uint8_t rate, bool hwfc)
+{
+    ret_code_t            err_code;
+    nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+
+    config.pselrxd            = m_init.rx_pin;
+    config.pseltxd            = m_init.tx_pin;
+    config.pselrts            = m_init.rts_pin;
+    config.pselcts            = m_init.cts_pin;
+    config.hwfc               = hwfc ? NRF_UART_HWFC_ENABLED : NRF_UART_HWFC_DISABLED;
+    config.parity             = NRF_UART_PARITY_EXCLUDED;
+    config.baudrate           = (nrf_uart_baudrate_t)m_rates[rate].uart;
+    config.interrupt_priority = IRQ_PRIORITY;
+
+    uart_close();
+
+    err_code = nrf_drv_uart_init(&m_uart, &config, uart_evt_handler);
+    VERIFY_SUCCESS(err_code);
+
+    CRITICAL_REGION_ENTER();
+    m_tx_tail = m_tx_head;
+    m_tx_len  = 0;
+    CRITICAL_REGION_EXIT();
+
+    m_open        = true;
+    m_ctrl_len    = 0;
+    m_stats.rate  = rate;
+    m_stats.hwfc  = hwfc;
+
+    // Paused while the link sleeps.
+    nrf_drv_timer_resume(&m_rx_counter);
+    rx_start();
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for writing a control frame, bypassing the hold on application data. */
+static void ctrl_send(uint8_t const * p_data, uint8_t length)
+{
+    (void)tx_put(p_data, length);
+}
+
+
+/**@brief Function for adding the time since the last call to the asleep time. */
+static void sleep_account(void)
+{
+    uint32_t now = app_timer_cnt_get();
+
+    m_stats.asleep_ms += ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(now, m_slept_at));
+    m_slept_at         = now;
+}
+
+
+static void link_up(void)
+{
+    m_state       = STATE_UP;
+    m_stats.gated = m_gated_new;
+    if (m_stats.rate != ALARM_ESP_RATE_115200)
+    {
+        m_stats.negotiations++;
+    }
+
+    activity();
+    if (m_stats.gated)
+    {
+        (void)app_timer_start(m_sleep_timer_id, APP_TIMER_TICKS(ALARM_ESP_SLEEP_IDLE_MS), NULL);
+    }
+
+    m_init.evt_handler(ALARM_ESP_EVT_LINK_UP);
+    m_init.evt_handler(ALARM_ESP_EVT_TX_READY);
+}
+
+
+/**@brief Function for turning the UARTE off. The state is already STATE_SLEEP. */
+static void link_sleep(void)
+{
+    (void)app_timer_stop(m_sleep_timer_id);
+    rx_flush(nrf_drv_timer_capture(&m_rx_counter, NRF_TIMER_CC_CHANNEL0));
+
+    // A UARTE disabled while still receiving keeps drawing current; stop reception first.
+    nrf_drv_uart_rx_abort(&m_uart);
+    uart_close();
+    nrf_drv_timer_pause(&m_rx_counter);
+    nrf_gpio_pin_clear(m_init.wake_out_pin);
+
+    m_slept_at = app_timer_cnt_get();
+    m_stats.sleeps++;
+}
+
+
+/**@brief Function for resuming traffic once both wake lines are high. */
+static void link_wake(void)
+{
+    uint32_t latency_us = ALARM_TICKS_TO_US(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_wake_at));
+
+    m_stats.wake_latency_sum_us += latency_us;
+    m_stats.wake_latency_max_us  = MAX(m_stats.wake_latency_max_us, latency_us);
+
+    m_state = STATE_UP;
+    activity();
+    (void)app_timer_start(m_sleep_timer_id, APP_TIMER_TICKS(ALARM_ESP_SLEEP_IDLE_MS), NULL);
+
+    m_init.evt_handler(ALARM_ESP_EVT_TX_READY);
+}
+
+
+/**@brief Function for gating the link once it has been idle for ALARM_ESP_SLEEP_IDLE_MS. */
+static void sleep_timeout_handler(void * p_context)
+{
+    bool idle;
+
+    UNUSED_PARAMETER(p_context);
+
+    CRITICAL_REGION_ENTER();
+    idle = (m_state == STATE_UP)                                                           &&
+           (m_tx_len == 0) && (m_tx_head == m_tx_tail)                                     &&
+           (ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_active_at)) >=
+            ALARM_ESP_SLEEP_IDLE_MS)                                                       &&
+           !wake_in_high();
+    if (idle)
+    {
+        // alarm_esp_write() turns into a wake request from here on.
+        m_state = STATE_SLEEP;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (idle)
+    {
+        link_sleep();
+    }
+}
+
+
+/**@brief Function for waking a sleeping link. Safe to call from any interrupt level; the UARTE
+ *        is reopened from the wake timer.
+ */
+static void wake_request(bool remote)
+{
+    bool start = false;
+
+    CRITICAL_REGION_ENTER();
+    if (m_state == STATE_SLEEP)
+    {
+        m_state   = STATE_WAKE;
+        m_wake_at = app_timer_cnt_get();
+        start     = true;
+        if (remote)
+        {
+            m_stats.wakes_remote++;
+        }
+        else
+        {
+            m_stats.wakes_local++;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (start)
+    {
+        (void)app_timer_start(m_wake_timer_id, APP_TIMER_MIN_TIMEOUT_TICKS, NULL);
+    }
+}
+
+
+/**@brief Function for reopening the UARTE and waiting for the ESP wake line. */
+static void wake_timeout_handler(void * p_context)
+{
+    uint32_t elapsed_ms;
+
+    UNUSED_PARAMETER(p_context);
+
+    if (m_state != STATE_WAKE)
+    {
+        return;
+    }
+
+    if (!m_open)
+    {
+        sleep_account();
+        if (uart_open(m_stats.rate, m_stats.hwfc) != NRF_SUCCESS)
+        {
+            negotiate(m_target);
+            return;
+        }
+        // Listening again: the ESP may send as soon as it sees this.
+        nrf_gpio_pin_set(m_init.wake_out_pin);
+    }
+
+    if (wake_in_high())
+    {
+        link_wake();
+        return;
+    }
+
+    elapsed_ms = ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_wake_at));
+    if (elapsed_ms >= ALARM_ESP_WAKE_TIMEOUT_MS)
+    {
+        m_stats.wake_timeouts++;
+        NRF_LOG_WARNING("ESP did not wake within %u ms, renegotiating.", ALARM_ESP_WAKE_TIMEOUT_MS);
+        negotiate(m_target);
+        return;
+    }
+
+    // Cut short by wake_in_handler() when the ESP line rises.
+    (void)app_timer_start(m_wake_timer_id, APP_TIMER_TICKS(ALARM_ESP_WAKE_TIMEOUT_MS - elapsed_ms), NULL);
+}
+
+
+/**@brief Function for handling an edge on the ESP wake line. */
+static void wake_in_handler(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action)
+{
+    UNUSED_PARAMETER(pin);
+    UNUSED_PARAMETER(action);
+
+    if (!wake_in_high())
+    {
+        return;
+    }
+
+    if (m_state == STATE_SLEEP)
+    {
+        wake_request(true);
+    }
+    else if (m_state == STATE_WAKE)
+    {
+        (void)app_timer_stop(m_wake_timer_id);
+        (void)app_timer_start(m_wake_timer_id, APP_TIMER_MIN_TIMEOUT_TICKS, NULL);
+    }
+}
+
+
+/**@brief Function for sending a break and asking the ESP for @p target.
+ *
+ * @details Runs in app_timer context, never from the UART event handler, since it closes the
+ *          driver that is calling it.
+ */
+static void negotiate(uint8_t target)
+{
+    uint8_t const request[] = {'b',
+                               target,
+                               (m_init.hwfc  ? ALARM_ESP_FLAG_HWFC : 0) |
+                               (wake_wired() ? ALARM_ESP_FLAG_WAKE : 0),
+                               '\r'};
+
+    m_target    = target;
+    m_state     = STATE_REQUEST;
+    m_gated_new = false;
+
+    (void)app_timer_stop(m_sleep_timer_id);
+    (void)app_timer_stop(m_wake_timer_id);
+    uart_close();
+
+    // The ESP keeps listening while the line is high.
+    if (wake_wired())
+    {
+        nrf_gpio_pin_set(m_init.wake_out_pin);
+    }
+
+    // A break returns the ESP to the base rate whatever rate it is listening at.
+    nrf_gpio_pin_clear(m_init.tx_pin);
+    nrf_gpio_cfg_output(m_init.tx_pin);
+    nrf_delay_us(ALARM_ESP_BREAK_US);
+    nrf_gpio_pin_set(m_init.tx_pin);
+
+    if (uart_open(ALARM_ESP_RATE_115200, false) != NRF_SUCCESS)
+    {
+        return;
+    }
+
+    if (target == ALARM_ESP_RATE_115200)
+    {
+        link_up();
+        return;
+    }
+
+    ctrl_send(request, sizeof(request));
+    (void)app_timer_start(m_timer_id, APP_TIMER_TICKS(ALARM_ESP_REPLY_TIMEOUT_MS), NULL);
+}
+
+
+/**@brief Function for dropping to the base rate and renegotiating one rate lower. */
+static void fallback(void)
+{
+    m_stats.fallbacks++;
+    NRF_LOG_WARNING("ESP link at %u baud failed, falling back.", m_rates[m_stats.rate].bps);
+
+    negotiate((m_target > ALARM_ESP_RATE_115200) ? (m_target - 1) : ALARM_ESP_RATE_115200);
+}
+
+
+static void timeout_handler(void * p_context)
+{
+    uint8_t const probe[] = {'p', '\r'};
+
+    UNUSED_PARAMETER(p_context);
+
+    switch (m_state)
+    {
+        case STATE_REQUEST:
+            // No reply: an ESP without negotiation support. Stay at the base rate.
+            link_up();
+            break;
+
+        case STATE_SWITCH:
+            if (uart_open(m_rate_new, m_hwfc_new) != NRF_SUCCESS)
+            {
+                fallback();
+                break;
+            }
+            m_target = m_rate_new;
+            m_state  = STATE_PROBE;
+            ctrl_send(probe, sizeof(probe));
+            (void)app_timer_start(m_timer_id, APP_TIMER_TICKS(ALARM_ESP_REPLY_TIMEOUT_MS), NULL);
+            break;
+
+        case STATE_PROBE:
+            fallback();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Function for handling a complete control frame from the ESP. */
+static void ctrl_handle(uint8_t const * p_frame, uint8_t length)
+{
+    if ((p_frame[0] == 'B') && (length == 4) && (m_state == STATE_REQUEST))
+    {
+        (void)app_timer_stop(m_timer_id);
+        m_rate_new = MIN(p_frame[1], m_target);
+        m_hwfc_new  = m_init.hwfc && ((p_frame[2] & ALARM_ESP_FLAG_HWFC) != 0);
+        m_gated_new = wake_wired() && ((p_frame[2] & ALARM_ESP_FLAG_WAKE) != 0);
+        m_state    = STATE_SWITCH;
+        (void)app_timer_start(m_timer_id, APP_TIMER_MIN_TIMEOUT_TICKS, NULL);
+    }
+    else if ((p_frame[0] == 'P') && (length == 2) && (m_state == STATE_PROBE))
+    {
+        (void)app_timer_stop(m_timer_id);
+        NRF_LOG_INFO("ESP link at %u baud, flow control %s.",
+                     m_rates[m_stats.rate].bps, m_stats.hwfc ? "on" : "off");
+        link_up();
+    }
+}
+
+
+static void rx_byte(uint8_t byte)
+{
+    if ((m_ctrl_len == 0) && (byte != 'B') && (byte != 'P'))
+    {
+        return;
+    }
+
+    m_ctrl[m_ctrl_len++] = byte;
+
+    if (byte == '\r')
+    {
+        ctrl_handle(m_ctrl, m_ctrl_len);
+        m_ctrl_len = 0;
+    }
+    else if (m_ctrl_len == CTRL_FRAME_MAX_LEN)
+    {
+        m_ctrl_len = 0;
+    }
+}
+
+
+static void rx_bytes(uint8_t const * p_data, uint16_t length)
+{
+    m_stats.rx_bytes += length;
+    activity();
+
+    if (m_state == STATE_UP)
+    {
+        if (m_init.rx_handler != NULL)
+        {
+            m_init.rx_handler(p_data, length);
+        }
+        return;
+    }
+
+    for (uint16_t i = 0; i < length; i++)
+    {
+        rx_byte(p_data[i]);
+    }
+}
+
+
+static void uart_evt_handler(nrf_drv_uart_event_t * p_event, void * p_context)
+{
+    uint32_t errors;
+
+    UNUSED_PARAMETER(p_context);
+
+    switch (p_event->type)
+    {
+        case NRF_DRV_UART_EVT_RX_DONE:
+            // EasyDMA already moved on to the other buffer; hand this one back as the next.
+            m_stats.rx_buffers++;
+            if (p_event->data.rxtx.bytes > m_rx_read)
+            {
+                rx_bytes(&p_event->data.rxtx.p_data[m_rx_read], p_event->data.rxtx.bytes - m_rx_read);
+            }
+            m_rx_start  += p_event->data.rxtx.bytes;
+            m_rx_read    = 0;
+            m_rx_active ^= 1;
+            (void)nrf_drv_uart_rx(&m_uart, p_event->data.rxtx.p_data, RX_BUF_LEN);
+            break;
+
+        case NRF_DRV_UART_EVT_TX_DONE:
+            CRITICAL_REGION_ENTER();
+            m_tx_tail += m_tx_len;
+            m_tx_len   = 0;
+            tx_start();
+            CRITICAL_REGION_EXIT();
+            if (m_state == STATE_UP)
+            {
+                m_init.evt_handler(ALARM_ESP_EVT_TX_READY);
+            }
+            break;
+
+        case NRF_DRV_UART_EVT_ERROR:
+            // Counted, not fatal: reception restarts and fallback handles bad links.
+            errors = p_event->data.error.error_mask;
+            m_stats.overrun_errors += ((errors & ERROR_OVERRUN) != 0);
+            m_stats.parity_errors  += ((errors & ERROR_PARITY)  != 0);
+            m_stats.framing_errors += ((errors & ERROR_FRAMING) != 0);
+            m_stats.breaks         += ((errors & ERROR_BREAK)   != 0);
+            m_framing_errors_tick  += ((errors & ERROR_FRAMING) != 0);
+            m_ctrl_len              = 0;
+            rx_start();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Function for driving the nRF wake line and sensing the ESP one.
+ *
+ * @details The ESP line uses a PORT event (no GPIOTE channel), so sensing it costs nothing while
+ *          the system sleeps. It is pulled down: an ESP that never drives it never wakes the link.
+ */
+static ret_code_t wake_init(void)
+{
+    ret_code_t                 err_code;
+    nrf_drv_gpiote_in_config_t config = GPIOTE_CONFIG_IN_SENSE_TOGGLE(false);
+
+    if (!wake_wired())
+    {
+        return NRF_SUCCESS;
+    }
+
+    nrf_gpio_pin_set(m_init.wake_out_pin);
+    nrf_gpio_cfg_output(m_init.wake_out_pin);
+
+    if (!nrf_drv_gpiote_is_init())
+    {
+        err_code = nrf_drv_gpiote_init();
+        VERIFY_SUCCESS(err_code);
+    }
+
+    config.pull = NRF_GPIO_PIN_PULLDOWN;
+    err_code    = nrf_drv_gpiote_in_init(m_init.wake_in_pin, &config, wake_in_handler);
+    VERIFY_SUCCESS(err_code);
+
+    nrf_drv_gpiote_in_event_enable(m_init.wake_in_pin, true);
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for counting received bytes in TIMER2, fed from RXDRDY through PPI. */
+static ret_code_t rx_counter_init(void)
+{
+    ret_code_t             err_code;
+    nrf_drv_timer_config_t timer_cfg = NRF_DRV_TIMER_DEFAULT_CONFIG;
+
+    timer_cfg.mode               = NRF_TIMER_MODE_LOW_POWER_COUNTER;
+    timer_cfg.bit_width          = NRF_TIMER_BIT_WIDTH_32;
+    timer_cfg.interrupt_priority = IRQ_PRIORITY;
+
+    err_code = nrf_drv_timer_init(&m_rx_counter, &timer_cfg, rx_counter_handler);
+    VERIFY_SUCCESS(err_code);
+
+    // Other modules may have initialized PPI already.
+    err_code = nrf_drv_ppi_init();
+    if ((err_code != NRF_SUCCESS) && (err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED))
+    {
+        return err_code;
+    }
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_channel);
+    VERIFY_SUCCESS(err_code);
+
+    // The event address only depends on the instance, so it survives reopening the UART.
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_channel,
+                                          nrf_drv_uart_event_address_get(&m_uart, EVENT_RXDRDY),
+                                          nrf_drv_timer_task_address_get(&m_rx_counter,
+                                                                         NRF_TIMER_TASK_COUNT));
+    VERIFY_SUCCESS(err_code);
+
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_channel);
+    VERIFY_SUCCESS(err_code);
+
+    nrf_drv_timer_enable(&m_rx_counter);
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t alarm_esp_init(alarm_esp_init_t const * p_init)
+{
+    ret_code_t err_code;
+
+    VERIFY_PARAM_NOT_NULL(p_init);
+    VERIFY_PARAM_NOT_NULL(p_init->evt_handler);
+
+    m_init = *p_init;
+    m_open = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_framing_errors_tick = 0;
+    m_tx_bytes_tick       = 0;
+
+    err_code = app_timer_create(&m_timer_id, APP_TIMER_MODE_SINGLE_SHOT, timeout_handler);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = app_timer_create(&m_idle_timer_id, APP_TIMER_MODE_REPEATED, idle_timeout_handler);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = app_timer_create(&m_sleep_timer_id, APP_TIMER_MODE_REPEATED, sleep_timeout_handler);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = app_timer_create(&m_wake_timer_id, APP_TIMER_MODE_SINGLE_SHOT, wake_timeout_handler);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = rx_counter_init();
+    VERIFY_SUCCESS(err_code);
+
+    err_code = wake_init();
+    VERIFY_SUCCESS(err_code);
+
+    negotiate(ALARM_ESP_RATE_COUNT - 1);
+
+    return m_open ? NRF_SUCCESS : NRF_ERROR_INTERNAL;
+}
+
+
+uint16_t alarm_esp_write(uint8_t const * p_data, uint16_t length)
+{
+    if (m_state == STATE_SLEEP)
+    {
+        wake_request(false);
+    }
+
+    if (m_state != STATE_UP)
+    {
+        return 0;
+    }
+
+    return tx_put(p_data, length);
+}
+
+
+void alarm_esp_tick(void)
+{
+    bool failing = (m_framing_errors_tick >= ALARM_ESP_FRAMING_MAX);
+
+    m_stats.tx_bps        = m_stats.tx_bytes - m_tx_bytes_tick;
+    m_stats.tx_bps_max    = MAX(m_stats.tx_bps_max, m_stats.tx_bps);
+    m_tx_bytes_tick       = m_stats.tx_bytes;
+    m_framing_errors_tick = 0;
+
+    if ((m_state == STATE_SLEEP) || ((m_state == STATE_WAKE) && !m_open))
+    {
+        sleep_account();
+    }
+
+    if (failing && (m_state == STATE_UP) && (m_stats.rate != ALARM_ESP_RATE_115200))
+    {
+        fallback();
+    }
+}
+
+
+uint32_t alarm_esp_rate_bps(uint8_t rate)
+{
+    return (rate < ALARM_ESP_RATE_COUNT) ? m_rates[rate].bps : 0;
+}
+
+
+alarm_esp_stats_t const * alarm_esp_stats_get(void)
+{
+    return &m_stats;
+}
@@ -0,0 +1,134 @@
+#ifndef ALARM_ESP_H__
+#define ALARM_ESP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+/**@file
+ *
+ * @details UART link to the ESP. The link comes up at 115200 baud without flow control, which
+ *          every ESP firmware understands, and is then negotiated up:
+ *
+ *          - nRF: line break (TX low for @ref ALARM_ESP_BREAK_US). Both ends return to 115200.
+ *          - nRF: 'b', highest rate index, flags, '\\r'.
+ *          - ESP: 'B', accepted rate index, flags, '\\r'. Both switch once the reply is sent.
+ *          - nRF: 'p', '\\r' at the new rate. ESP: 'P', '\\r'. The link is up.
+ *
+ *          Rate indexes are those of @ref alarm_esp_rate_t. Flag bit 0 is RTS/CTS flow control,
+ *          used only if both ends set it. An ESP that does not answer the request stays at
+ *          115200. A missing probe reply, or @ref ALARM_ESP_FRAMING_MAX framing errors in one
+ *          second, sends a break and renegotiates one rate lower.
+ *
+ *          Reception needs no CPU per byte: EasyDMA fills two buffers in turn (ENDRX->STARTRX)
+ *          and TIMER2 counts the bytes through PPI. A full buffer is handled on ENDRX; a partial
+ *          one once the line has been idle for @ref ALARM_ESP_RX_IDLE_MS.
+ *
+ *          Power gating (flag bit 1, with both wake pins wired) turns the UARTE off while the
+ *          link is idle, since a listening UARTE keeps HFCLK running. Each side drives one wake
+ *          line, high while its UART is on:
+ *
+ *          - nRF: after @ref ALARM_ESP_SLEEP_IDLE_MS without traffic, with the TX ring empty and
+ *            the ESP line low, the UARTE is disabled and the nRF line driven low.
+ *          - Either side raises its line to wake the link and sends once the other line is
+ *            high. The nRF raises its line only after the UARTE is listening again.
+ *          - The ESP keeps its line high for as long as it has bytes to send.
+ *
+ *          If the ESP line stays low for @ref ALARM_ESP_WAKE_TIMEOUT_MS after a wake request, the
+ *          link is renegotiated.
+ */
+
+typedef enum
+{
+    ALARM_ESP_RATE_115200,
+    ALARM_ESP_RATE_230400,
+    ALARM_ESP_RATE_460800,
+    ALARM_ESP_RATE_921600,
+    ALARM_ESP_RATE_1000000,
+    ALARM_ESP_RATE_COUNT
+} alarm_esp_rate_t;
+
+#define ALARM_ESP_FLAG_HWFC             0x01                        /**< RTS/CTS flow control. */
+#define ALARM_ESP_FLAG_WAKE             0x02                        /**< Power gating with wake lines. */
+#define ALARM_ESP_BREAK_US              500                         /**< Longer than a character at the base rate. */
+#define ALARM_ESP_REPLY_TIMEOUT_MS      100                         /**< Wait for 'B' or 'P'. */
+#define ALARM_ESP_FRAMING_MAX           3                           /**< Framing errors per second that make the link fall back. */
+#define ALARM_ESP_RX_IDLE_MS            1                           /**< Line idle time after which a partial RX buffer is handled. */
+#define ALARM_ESP_SLEEP_IDLE_MS         20                          /**< Link idle time after which the UARTE is turned off. */
+#define ALARM_ESP_WAKE_TIMEOUT_MS       10                          /**< Longest wait for the ESP line after a wake request. */
+#define ALARM_ESP_PIN_NONE              0xFFFFFFFF                  /**< Wake pin not wired; the link is never gated. */
+
+typedef enum
+{
+    ALARM_ESP_EVT_TX_READY,                                         /**< @ref alarm_esp_write accepts bytes again. */
+    ALARM_ESP_EVT_LINK_UP                                           /**< Negotiation finished; see @ref alarm_esp_stats_t. */
+} alarm_esp_evt_t;
+
+typedef void (*alarm_esp_evt_handler_t)(alarm_esp_evt_t evt);
+
+/**@brief   Receives the bytes of the ESP once the link is up; control frames are consumed before. */
+typedef void (*alarm_esp_rx_handler_t)(uint8_t const * p_data, uint16_t length);
+
+typedef struct
+{
+    uint32_t rx_pin;
+    uint32_t tx_pin;
+    uint32_t rts_pin;
+    uint32_t cts_pin;
+    bool     hwfc;                                                  /**< RTS/CTS are wired to the ESP. */
+    uint32_t wake_out_pin;                                          /**< Wake line to the ESP, or @ref ALARM_ESP_PIN_NONE. */
+    uint32_t wake_in_pin;                                           /**< Wake line from the ESP, or @ref ALARM_ESP_PIN_NONE. */
+    alarm_esp_evt_handler_t evt_handler;
+    alarm_esp_rx_handler_t  rx_handler;                             /**< May be NULL. */
+} alarm_esp_init_t;
+
+typedef struct
+{
+    uint8_t  rate;                                                  /**< Current @ref alarm_esp_rate_t. */
+    bool     hwfc;                                                  /**< Flow control in use. */
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    uint32_t tx_bps;                                                /**< Bytes written in the last second. */
+    uint32_t tx_bps_max;
+    uint32_t overrun_errors;
+    uint32_t parity_errors;
+    uint32_t framing_errors;
+    uint32_t breaks;                                                /**< Break conditions received. */
+    uint32_t rx_buffers;                                            /**< RX buffers filled by EasyDMA. */
+    uint32_t rx_idle_flushes;                                       /**< Partial RX buffers handled on an idle line. */
+    uint32_t negotiations;                                          /**< Links brought up above the base rate. */
+    uint32_t fallbacks;
+    bool     gated;                                                 /**< Power gating in use. */
+    uint32_t sleeps;
+    uint32_t wakes_local;                                           /**< Wakes for bytes to send. */
+    uint32_t wakes_remote;                                          /**< Wakes requested by the ESP. */
+    uint32_t wake_timeouts;
+    uint32_t wake_latency_sum_us;                                   /**< Wake request to link usable, summed over all wakes. */
+    uint32_t wake_latency_max_us;
+    uint32_t asleep_ms;                                             /**< Time spent with the UARTE off. */
+} alarm_esp_stats_t;
+
+/**@brief Function for opening the link and starting the negotiation.
+ *
+ * @details Needs app_timer. The link accepts bytes at 115200 until negotiation starts.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_esp_init(alarm_esp_init_t const * p_init);
+
+/**@brief Function for writing bytes to the ESP. Wakes a gated link.
+ *
+ * @return      Number of bytes accepted; 0 while the link is renegotiating or waking up, or the
+ *              FIFO is full. @ref ALARM_ESP_EVT_TX_READY follows when more can be written.
+ */
+uint16_t alarm_esp_write(uint8_t const * p_data, uint16_t length);
+
+/**@brief Function for updating the throughput and error rate. Call once per second. */
+void alarm_esp_tick(void);
+
+/**@brief Function for getting the line rate in bits per second of a rate index. */
+uint32_t alarm_esp_rate_bps(uint8_t rate);
+
+alarm_esp_stats_t const * alarm_esp_stats_get(void);
+
+#endif // ALARM_ESP_H__
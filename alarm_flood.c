@@ -0,0 +1,348 @@
+#include "sdk_common.h"
+#include "alarm_flood.h"
+#include <string.h>
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "alarm_util.h"
+#include "nrf_soc.h"
+#include "nrf_log.h"
+
+typedef enum
+{
+    STATE_IDLE,
+    STATE_BACKOFF,                                                  /**< Waiting to put the queue head on air. */
+    STATE_BURST                                                     /**< The queue head is in the advertising data. */
+} state_t;
+
+typedef struct
+{
+    alarm_flood_msg_t msg;
+    uint32_t          queued_at;                                    /**< app_timer counter value when the message was queued. */
+    uint8_t           heard;                                        /**< Copies heard since it was queued. */
+    bool              local;                                        /**< Originated here; never suppressed. */
+} entry_t;
+
+typedef struct
+{
+    uint32_t src;
+    uint16_t seq;
+    uint32_t heard_at_s;                                            /**< Uptime when the pair was first heard. */
+} cache_entry_t;
+
+APP_TIMER_DEF(m_timer_id);
+
+static alarm_flood_init_t  m_init;
+static uint16_t            m_seq;
+static cache_entry_t       m_cache[ALARM_FLOOD_CACHE_LEN];
+static uint8_t             m_cache_next;                            /**< Oldest cache entry, overwritten next. */
+static uint8_t             m_cache_count;
+static entry_t             m_queue[ALARM_FLOOD_QUEUE_LEN];
+static uint8_t             m_queue_head;
+static uint8_t             m_queue_count;
+static state_t             m_state;
+static uint8_t             m_payload[ALARM_FLOOD_MSG_LEN];          /**< Published message; must stay valid during the burst. */
+static alarm_flood_stats_t m_stats;
+
+
+uint16_t alarm_flood_encode(alarm_flood_msg_t const * p_msg, uint8_t * p_buf)
+{
+    uint16_t len = 0;
+
+    p_buf[len++] = ALARM_ADV_FORMAT_FLOOD;
+    len += uint32_encode(p_msg->src,    &p_buf[len]);
+    len += uint16_encode(p_msg->seq,    &p_buf[len]);
+    p_buf[len++] = p_msg->ttl;
+    len += uint16_encode(p_msg->age_ms, &p_buf[len]);
+    p_buf[len++] = p_msg->zone;
+    p_buf[len++] = p_msg->flags;
+
+    return len;
+}
+
+
+ret_code_t alarm_flood_decode(uint8_t const * p_data, uint16_t length, alarm_flood_msg_t * p_msg)
+{
+    if (length != ALARM_FLOOD_MSG_LEN)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    if ((p_data[0] != ALARM_ADV_FORMAT_FLOOD) || (p_data[7] == 0) || (p_data[7] > ALARM_FLOOD_TTL))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    p_msg->src    = uint32_decode(&p_data[1]);
+    p_msg->seq    = uint16_decode(&p_data[5]);
+    p_msg->ttl    = p_data[7];
+    p_msg->age_ms = uint16_decode(&p_data[8]);
+    p_msg->zone   = p_data[10];
+    p_msg->flags  = p_data[11];
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for checking the duplicate cache, adding the message if it is not there.
+ *
+ * @details A pair heard more than @ref ALARM_FLOOD_CACHE_TIMEOUT_S ago counts as new and starts
+ *          its window again.
+ *
+ * @return  True if the message was already in the cache.
+ */
+static bool cache_check_add(uint32_t src, uint16_t seq)
+{
+    uint32_t now_s = m_init.clock();
+
+    for (uint8_t i = 0; i < m_cache_count; i++)
+    {
+        if ((m_cache[i].src == src) && (m_cache[i].seq == seq))
+        {
+            if ((now_s - m_cache[i].heard_at_s) < ALARM_FLOOD_CACHE_TIMEOUT_S)
+            {
+                return true;
+            }
+
+            m_cache[i].heard_at_s = now_s;
+            return false;
+        }
+    }
+
+    m_cache[m_cache_next].src        = src;
+    m_cache[m_cache_next].seq        = seq;
+    m_cache[m_cache_next].heard_at_s = now_s;
+    m_cache_next                     = (m_cache_next + 1) % ALARM_FLOOD_CACHE_LEN;
+    m_cache_count             = MIN(m_cache_count + 1, ALARM_FLOOD_CACHE_LEN);
+
+    return false;
+}
+
+
+/**@brief Function for starting the backoff of the queue head, if the flood is idle. */
+static void next(void)
+{
+    uint8_t  rand = 0;
+    uint32_t backoff_ms;
+    bool     start;
+
+    CRITICAL_REGION_ENTER();
+    start = (m_state == STATE_IDLE) && (m_queue_count != 0);
+    if (start)
+    {
+        m_state = STATE_BACKOFF;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (!start)
+    {
+        return;
+    }
+
+    // Without enough entropy the minimum backoff is used; suppression still bounds the repeats.
+    (void)sd_rand_application_vector_get(&rand, sizeof(rand));
+    backoff_ms = ALARM_FLOOD_BACKOFF_MIN_MS +
+                 ((rand * (ALARM_FLOOD_BACKOFF_MAX_MS - ALARM_FLOOD_BACKOFF_MIN_MS)) / UINT8_MAX);
+
+    if (app_timer_start(m_timer_id, APP_TIMER_TICKS(backoff_ms), NULL) != NRF_SUCCESS)
+    {
+        m_state = STATE_IDLE;
+    }
+}
+
+
+static void queue_pop(void)
+{
+    m_queue_head = (m_queue_head + 1) % ALARM_FLOOD_QUEUE_LEN;
+    m_queue_count--;
+}
+
+
+/**@brief Function for queueing a message for transmission. Call inside a critical region. */
+static ret_code_t queue_put(alarm_flood_msg_t const * p_msg, bool local)
+{
+    entry_t * p_entry;
+
+    if (m_queue_count == ALARM_FLOOD_QUEUE_LEN)
+    {
+        m_stats.queue_full++;
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p_entry            = &m_queue[(m_queue_head + m_queue_count) % ALARM_FLOOD_QUEUE_LEN];
+    p_entry->msg       = *p_msg;
+    p_entry->queued_at = app_timer_cnt_get();
+    p_entry->heard     = 0;
+    p_entry->local     = local;
+    m_queue_count++;
+
+    return NRF_SUCCESS;
+}
+
+
+static void timeout_handler(void * p_context)
+{
+    entry_t * p_entry;
+    uint32_t  held_ms;
+    state_t   prev_state;
+
+    UNUSED_PARAMETER(p_context);
+
+    CRITICAL_REGION_ENTER();
+    p_entry    = &m_queue[m_queue_head];
+    prev_state = m_state;
+
+    if (prev_state == STATE_BACKOFF)
+    {
+        if (!p_entry->local && (p_entry->heard >= ALARM_FLOOD_SUPPRESS_COUNT))
+        {
+            m_stats.suppressed++;
+            queue_pop();
+            m_state = STATE_IDLE;
+        }
+        else
+        {
+            held_ms               = ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), p_entry->queued_at));
+            p_entry->msg.age_ms   = (uint16_t)MIN(p_entry->msg.age_ms + held_ms, UINT16_MAX);
+            (void)alarm_flood_encode(&p_entry->msg, m_payload);
+            m_state = STATE_BURST;
+        }
+    }
+    else
+    {
+        if (!p_entry->local)
+        {
+            m_stats.rebroadcast++;
+        }
+        queue_pop();
+        m_state = STATE_IDLE;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (m_state == STATE_BURST)
+    {
+        m_init.publish(m_payload, ALARM_FLOOD_MSG_LEN);
+        (void)app_timer_start(m_timer_id, APP_TIMER_TICKS(ALARM_FLOOD_BURST_MS), NULL);
+        return;
+    }
+
+    if (prev_state == STATE_BURST)
+    {
+        m_init.publish(NULL, 0);
+    }
+    next();
+}
+
+
+ret_code_t alarm_flood_init(alarm_flood_init_t const * p_init)
+{
+    uint8_t seed[sizeof(m_seq)] = {0};
+
+    VERIFY_PARAM_NOT_NULL(p_init);
+    VERIFY_PARAM_NOT_NULL(p_init->publish);
+    VERIFY_PARAM_NOT_NULL(p_init->deliver);
+    VERIFY_PARAM_NOT_NULL(p_init->clock);
+
+    // Without enough entropy yet the sequence starts at 0; the cache timeout still lets
+    // neighbours hear it after a reboot.
+    (void)sd_rand_application_vector_get(seed, sizeof(seed));
+
+    m_init        = *p_init;
+    m_seq         = uint16_decode(seed);
+    m_cache_next  = 0;
+    m_cache_count = 0;
+    m_queue_head  = 0;
+    m_queue_count = 0;
+    m_state       = STATE_IDLE;
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    return app_timer_create(&m_timer_id, APP_TIMER_MODE_SINGLE_SHOT, timeout_handler);
+}
+
+
+ret_code_t alarm_flood_originate(uint8_t zone, uint8_t flags)
+{
+    ret_code_t        err_code;
+    alarm_flood_msg_t msg;
+
+    msg.src    = m_init.src;
+    msg.ttl    = ALARM_FLOOD_TTL;
+    msg.age_ms = 0;
+    msg.zone   = zone;
+    msg.flags  = flags;
+
+    CRITICAL_REGION_ENTER();
+    msg.seq  = m_seq++;
+    (void)cache_check_add(msg.src, msg.seq);                        // Ignore our own message when a neighbour repeats it.
+    err_code = queue_put(&msg, true);
+    if (err_code == NRF_SUCCESS)
+    {
+        m_stats.originated++;
+    }
+    CRITICAL_REGION_EXIT();
+
+    next();
+
+    return err_code;
+}
+
+
+bool alarm_flood_rx(uint8_t const * p_data, uint16_t length)
+{
+    alarm_flood_msg_t msg;
+    bool              duplicate;
+
+    if (alarm_flood_decode(p_data, length, &msg) != NRF_SUCCESS)
+    {
+        return false;
+    }
+
+    CRITICAL_REGION_ENTER();
+    m_stats.received++;
+    duplicate = cache_check_add(msg.src, msg.seq);
+    if (duplicate)
+    {
+        m_stats.duplicates++;
+        for (uint8_t i = 0; i < m_queue_count; i++)
+        {
+            entry_t * p_entry = &m_queue[(m_queue_head + i) % ALARM_FLOOD_QUEUE_LEN];
+
+            if ((p_entry->msg.src == msg.src) && (p_entry->msg.seq == msg.seq))
+            {
+                p_entry->heard++;
+                break;
+            }
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (duplicate)
+    {
+        return false;
+    }
+
+    m_stats.hops_sum   += ALARM_FLOOD_TTL - msg.ttl + 1;
+    m_stats.age_sum_ms += msg.age_ms;
+    m_stats.age_max_ms  = MAX(m_stats.age_max_ms, msg.age_ms);
+    m_init.deliver(&msg);
+
+    if (msg.ttl <= 1)
+    {
+        m_stats.ttl_expired++;
+        return true;
+    }
+
+    msg.ttl--;
+    CRITICAL_REGION_ENTER();
+    (void)queue_put(&msg, false);
+    CRITICAL_REGION_EXIT();
+
+    next();
+
+    return true;
+}
+
+
+alarm_flood_stats_t const * alarm_flood_stats_get(void)
+{
+    return &m_stats;
+}
@@ -0,0 +1,107 @@
+#ifndef ALARM_FLOOD_H__
+#define ALARM_FLOOD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "alarm_relay.h"
+
+#define ALARM_FLOOD_ENABLED             ALARM_RELAY_ENABLED         /**< Flooding needs the relay scanner. */
+
+#define ALARM_FLOOD_MSG_LEN             12                          /**< Encoded message, format byte included. */
+#define ALARM_FLOOD_TTL                 4                           /**< Hops an originated message may travel. */
+#define ALARM_FLOOD_CACHE_LEN           16                          /**< (source, sequence) pairs remembered for duplicate suppression. */
+#define ALARM_FLOOD_CACHE_TIMEOUT_S     60                          /**< Time a pair is remembered; outlasts a message crossing every hop behind full queues. */
+#define ALARM_FLOOD_QUEUE_LEN           4                           /**< Messages waiting to go on air. */
+#define ALARM_FLOOD_BACKOFF_MIN_MS      10
+#define ALARM_FLOOD_BACKOFF_MAX_MS      250                         /**< Random backoff spreads the rebroadcasts of nodes that heard the same PDU. */
+#define ALARM_FLOOD_BURST_MS            2000                        /**< Time a message stays in the advertising data. */
+#define ALARM_FLOOD_SUPPRESS_COUNT      2                           /**< Copies heard during the backoff that cancel a rebroadcast. */
+
+/**@brief   Alarm event carried by the flood. */
+typedef struct
+{
+    uint32_t src;                                                   /**< Device id of the originating node. */
+    uint16_t seq;                                                   /**< Per-source sequence number. */
+    uint8_t  ttl;                                                   /**< Hops left; the message is not rebroadcast at 1. */
+    uint16_t age_ms;                                                /**< Time spent queued and in backoff on all previous hops (saturating). */
+    uint8_t  zone;
+    uint8_t  flags;                                                 /**< BLE_ALARM_STATUS_FLAG_* bits of the source. */
+} alarm_flood_msg_t;
+
+/**@brief   Puts a message in the advertising data, or with @p length 0 takes it out again. */
+typedef void (*alarm_flood_publish_t)(uint8_t const * p_payload, uint16_t length);
+
+/**@brief   Called once for every message heard for the first time. */
+typedef void (*alarm_flood_deliver_t)(alarm_flood_msg_t const * p_msg);
+
+/**@brief   Current uptime in seconds. */
+typedef uint32_t (*alarm_flood_clock_t)(void);
+
+typedef struct
+{
+    uint32_t              src;                                      /**< Device id of this node. */
+    alarm_flood_publish_t publish;
+    alarm_flood_deliver_t deliver;
+    alarm_flood_clock_t   clock;                                    /**< Time base of the duplicate cache. */
+} alarm_flood_init_t;
+
+typedef struct
+{
+    uint32_t originated;
+    uint32_t received;                                              /**< Valid flood PDUs heard, duplicates included. */
+    uint32_t duplicates;                                            /**< PDUs whose (source, sequence) was in the cache. */
+    uint32_t rebroadcast;                                           /**< Messages of other nodes put on air. */
+    uint32_t suppressed;                                            /**< Rebroadcasts cancelled because neighbours already covered them. */
+    uint32_t ttl_expired;                                           /**< Messages delivered but not rebroadcast. */
+    uint32_t queue_full;                                            /**< Messages dropped because the queue was full. */
+    uint32_t hops_sum;                                              /**< Hops of delivered messages. */
+    uint32_t age_sum_ms;                                            /**< Propagation latency of delivered messages. */
+    uint32_t age_max_ms;
+} alarm_flood_stats_t;
+
+/**@brief Function for encoding a message as manufacturer data, company identifier excluded.
+ *
+ * @param[out]  p_buf   Buffer of at least @ref ALARM_FLOOD_MSG_LEN bytes.
+ *
+ * @return      Number of bytes written.
+ */
+uint16_t alarm_flood_encode(alarm_flood_msg_t const * p_msg, uint8_t * p_buf);
+
+/**@brief Function for decoding a message written by @ref alarm_flood_encode.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH or NRF_ERROR_INVALID_DATA.
+ */
+ret_code_t alarm_flood_decode(uint8_t const * p_data, uint16_t length, alarm_flood_msg_t * p_msg);
+
+/**@brief Function for initializing the managed flood.
+ *
+ * @details Messages go on air one at a time: after a random backoff each is published for
+ *          @ref ALARM_FLOOD_BURST_MS, then the next one follows. A rebroadcast is cancelled if
+ *          @ref ALARM_FLOOD_SUPPRESS_COUNT copies of it are heard during the backoff, so a dense
+ *          room does not repeat every message once per node.
+ *
+ *          The sequence number starts from a random value, and neighbours forget a (source,
+ *          sequence) pair after @ref ALARM_FLOOD_CACHE_TIMEOUT_S, so the first alarms of a node
+ *          that rebooted are not taken for duplicates of its alarms before the reset. Needs the
+ *          SoftDevice enabled.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_flood_init(alarm_flood_init_t const * p_init);
+
+/**@brief Function for flooding a local alarm event. Safe to call from interrupt context.
+ *
+ * @return      NRF_SUCCESS, or NRF_ERROR_NO_MEM if the queue is full.
+ */
+ret_code_t alarm_flood_originate(uint8_t zone, uint8_t flags);
+
+/**@brief Function for handling a flood PDU heard by the scanner.
+ *
+ * @return      True if the message was new.
+ */
+bool alarm_flood_rx(uint8_t const * p_data, uint16_t length);
+
+alarm_flood_stats_t const * alarm_flood_stats_get(void);
+
+#endif // ALARM_FLOOD_H__
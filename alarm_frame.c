@@ -0,0 +1,101 @@
+#include "sdk_common.h"
+#include "alarm_frame.h"
+#include <string.h>
+#include "crc16.h"
+
+#define SLIP_END                        0xC0
+
+
+ret_code_t alarm_frame_encode(uint8_t         type,
+                              uint8_t         seq,
+                              uint8_t const * p_payload,
+                              uint16_t        length,
+                              uint8_t       * p_buf,
+                              uint16_t      * p_len)
+{
+    uint8_t  raw[ALARM_FRAME_HEADER_LEN + ALARM_FRAME_PAYLOAD_MAX_LEN + ALARM_FRAME_CRC_LEN];
+    uint16_t raw_len = 0;
+    uint32_t slip_len;
+
+    if (length > ALARM_FRAME_PAYLOAD_MAX_LEN)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    raw[raw_len++] = type;
+    raw[raw_len++] = seq;
+    if (length != 0)
+    {
+        memcpy(&raw[raw_len], p_payload, length);
+        raw_len += length;
+    }
+    raw_len += uint16_encode(crc16_compute(raw, raw_len, NULL), &raw[raw_len]);
+
+    // slip_encode() only terminates the frame; the leading END flushes whatever noise the
+    // receiver collected since the last frame.
+    p_buf[0] = SLIP_END;
+    (void)slip_encode(&p_buf[1], raw, raw_len, &slip_len);
+    *p_len   = (uint16_t)(slip_len + 1);
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_frame_rx_init(alarm_frame_rx_t * p_rx)
+{
+    memset(p_rx, 0, sizeof(*p_rx));
+    p_rx->slip.p_buffer   = p_rx->buf;
+    p_rx->slip.buffer_len = sizeof(p_rx->buf);
+    p_rx->slip.state      = SLIP_STATE_DECODING;
+}
+
+
+bool alarm_frame_rx_put(alarm_frame_rx_t * p_rx, uint8_t byte, alarm_frame_t * p_frame)
+{
+    uint16_t len;
+
+    switch (slip_decode_add_byte(&p_rx->slip, byte))
+    {
+        case NRF_SUCCESS:
+            break;
+
+        case NRF_ERROR_NO_MEM:
+            // Skip the rest of the frame up to the next END.
+            p_rx->overruns++;
+            p_rx->slip.current_index = 0;
+            p_rx->slip.state         = SLIP_STATE_CLEARING_INVALID_PACKET;
+            return false;
+
+        case NRF_ERROR_INVALID_DATA:
+            p_rx->overruns++;
+            return false;
+
+        default:
+            return false;
+    }
+
+    len                      = (uint16_t)p_rx->slip.current_index;
+    p_rx->slip.current_index = 0;
+
+    if (len == 0)
+    {
+        // Leading END of a frame.
+        return false;
+    }
+
+    if ((len < ALARM_FRAME_HEADER_LEN + ALARM_FRAME_CRC_LEN) ||
+        (crc16_compute(p_rx->buf, len - ALARM_FRAME_CRC_LEN, NULL) !=
+         uint16_decode(&p_rx->buf[len - ALARM_FRAME_CRC_LEN])))
+    {
+        p_rx->crc_errors++;
+        return false;
+    }
+
+    p_frame->type      = p_rx->buf[0];
+    p_frame->seq       = p_rx->buf[1];
+    p_frame->p_payload = &p_rx->buf[ALARM_FRAME_HEADER_LEN];
+    p_frame->length    = len - ALARM_FRAME_HEADER_LEN - ALARM_FRAME_CRC_LEN;
+    p_rx->frames++;
+
+    return true;
+}
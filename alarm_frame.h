@@ -0,0 +1,97 @@
+#ifndef ALARM_FRAME_H__
+#define ALARM_FRAME_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "slip.h"
+
+/**@file
+ *
+ * @details Frames on the UART link to the ESP. Before byte stuffing a frame is:
+ *
+ *          | type | seq | payload (0..@ref ALARM_FRAME_PAYLOAD_MAX_LEN) | CRC16 (LSB first) |
+ *
+ *          The CRC is CRC-16/CCITT (crc16_compute, initial value 0xFFFF) over type, sequence
+ *          number and payload. The frame is then SLIP encoded (RFC 1055) and sent between two
+ *          END bytes (0xC0), so the receiver can resynchronize after line noise or a
+ *          renegotiation and drop any frame whose CRC does not match.
+ *
+ *          Sequence numbers count frames in the order they were queued, over all types. Frames
+ *          of different priority may overtake each other on the wire; a gap means frames were
+ *          dropped before they reached the link.
+ *
+ *          The ESP answers in the same format. Its frames are at most
+ *          @ref ALARM_FRAME_RX_PAYLOAD_MAX_LEN bytes of payload.
+ */
+
+#define ALARM_FRAME_HEADER_LEN          2                           /**< Type and sequence number. */
+#define ALARM_FRAME_CRC_LEN             2
+#define ALARM_FRAME_PAYLOAD_MAX_LEN     244                         /**< Largest notification payload (ATT MTU 247). */
+#define ALARM_FRAME_RX_PAYLOAD_MAX_LEN  16                          /**< Largest payload of a frame from the ESP. */
+
+/**@brief   Worst-case encoded length of a frame: every byte escaped, plus both END bytes. */
+#define ALARM_FRAME_ENCODED_MAX_LEN(_payload_len)                                                  \
+    (2 * (ALARM_FRAME_HEADER_LEN + (_payload_len) + ALARM_FRAME_CRC_LEN) + 2)
+
+/**@brief   Frame types. Printable, so a raw capture of the link stays readable. */
+typedef enum
+{
+    ALARM_FRAME_TYPE_ALARM     = 'a',                               /**< Alarm command of the peer or of a local detector. */
+    ALARM_FRAME_TYPE_COMMAND   = 'c',                               /**< Any other command written by the peer. */
+    ALARM_FRAME_TYPE_LINK_DOWN = 'd',                               /**< The peer disconnected. Payload: HCI reason. */
+    ALARM_FRAME_TYPE_REPEAT    = 'e',                               /**< Copies of an alarm that were not forwarded. Payload: sequence number of the alarm frame, count (2). */
+    ALARM_FRAME_TYPE_FLOOD     = 'f',                               /**< Source id (4), sequence (2), hops, age in ms (2), zone, flags. */
+    ALARM_FRAME_TYPE_RELAY     = 'r',                               /**< Neighbour address (6), RSSI, its advertised snapshot. */
+    ALARM_FRAME_TYPE_ACK       = 'A',                               /**< From the ESP. Payload: sequence number of the frame received. */
+} alarm_frame_type_t;
+
+/**@brief   Decoded frame. The payload points into the receiver buffer. */
+typedef struct
+{
+    uint8_t         type;
+    uint8_t         seq;
+    uint8_t const * p_payload;
+    uint16_t        length;
+} alarm_frame_t;
+
+/**@brief   Receiver state for one link. */
+typedef struct
+{
+    uint8_t  buf[ALARM_FRAME_HEADER_LEN + ALARM_FRAME_RX_PAYLOAD_MAX_LEN + ALARM_FRAME_CRC_LEN];
+    slip_t   slip;
+    uint32_t frames;                                                /**< Valid frames received. */
+    uint32_t crc_errors;                                            /**< Frames dropped for a bad CRC or length. */
+    uint32_t overruns;                                              /**< Frames dropped for being too long or badly escaped. */
+} alarm_frame_rx_t;
+
+/**@brief Function for encoding a frame for the ESP link.
+ *
+ * @param[in]   type        Frame type, see @ref alarm_frame_type_t.
+ * @param[in]   seq         Sequence number.
+ * @param[in]   p_payload   Payload; may be NULL if @p length is 0.
+ * @param[in]   length      Payload length.
+ * @param[out]  p_buf       Buffer of at least ALARM_FRAME_ENCODED_MAX_LEN(@p length) bytes.
+ * @param[out]  p_len       Encoded length.
+ *
+ * @return      NRF_SUCCESS, or NRF_ERROR_INVALID_LENGTH if the payload is too long.
+ */
+ret_code_t alarm_frame_encode(uint8_t         type,
+                              uint8_t         seq,
+                              uint8_t const * p_payload,
+                              uint16_t        length,
+                              uint8_t       * p_buf,
+                              uint16_t      * p_len);
+
+/**@brief Function for initializing a receiver. */
+void alarm_frame_rx_init(alarm_frame_rx_t * p_rx);
+
+/**@brief Function for feeding one received byte to a receiver.
+ *
+ * @param[out]  p_frame     Filled in when a frame completes; valid until the next call.
+ *
+ * @return      True if @p p_frame holds a frame that passed the CRC check.
+ */
+bool alarm_frame_rx_put(alarm_frame_rx_t * p_rx, uint8_t byte, alarm_frame_t * p_frame);
+
+#endif // ALARM_FRAME_H__
@@ -0,0 +1,265 @@
+#include "sdk_common.h"
+#include "alarm_glassbreak.h"
+#include <math.h>
+#include <string.h>
+#include "nrf.h"
+#include "alarm_cycles.h"
+#if ALARM_GLASSBREAK_USE_CMSIS_DSP
+#include "arm_math.h"
+#endif
+
+#define FFT_BINS            (ALARM_GLASSBREAK_FFT_LEN / 2)
+#define TWO_PI              6.28318531f
+#define HZ_TO_BIN(_hz)      (((_hz) * ALARM_GLASSBREAK_FFT_LEN) / ALARM_GLASSBREAK_SAMPLE_RATE_HZ)
+
+/**@brief   First bin of each band; band i spans [m_band_start[i], m_band_start[i + 1]). */
+static const uint16_t m_band_start[ALARM_GLASSBREAK_BAND_COUNT + 1] =
+{
+    HZ_TO_BIN(100),
+    HZ_TO_BIN(500),
+    HZ_TO_BIN(2000),
+    FFT_BINS
+};
+
+static float                      m_window[ALARM_GLASSBREAK_FFT_LEN];       /**< Hann window, computed once at init. */
+static float                      m_time[ALARM_GLASSBREAK_FFT_LEN];
+static float                      m_power[FFT_BINS];
+static int16_t                    m_block[ALARM_GLASSBREAK_FFT_LEN];        /**< Pending microphone block. */
+static volatile bool              m_block_pending;
+static uint8_t                    m_armed_blocks;                           /**< Blocks left in which a shatter completes a detection. */
+static alarm_glassbreak_handler_t m_handler;
+static alarm_glassbreak_bench_t   m_bench;
+
+#if ALARM_GLASSBREAK_USE_CMSIS_DSP
+static arm_rfft_fast_instance_f32 m_rfft;
+static float                      m_freq[ALARM_GLASSBREAK_FFT_LEN];
+#endif
+
+
+#if ALARM_GLASSBREAK_USE_CMSIS_DSP
+
+/**@brief Function for computing the power spectrum with the CMSIS-DSP real FFT. */
+static void power_spectrum(void)
+{
+    // m_time is consumed by the transform. The packed output holds DC and Nyquist in bin 0.
+    arm_rfft_fast_f32(&m_rfft, m_time, m_freq, 0);
+    arm_cmplx_mag_squared_f32(m_freq, m_power, FFT_BINS);
+    m_power[0] = m_freq[0] * m_freq[0];
+}
+
+#else
+
+/**@brief Reference power spectrum: in-place iterative radix-2 complex FFT with a zero
+ *        imaginary part. Slow, but portable and independent of CMSIS-DSP.
+ */
+static void power_spectrum(void)
+{
+    static float re[ALARM_GLASSBREAK_FFT_LEN];
+    static float im[ALARM_GLASSBREAK_FFT_LEN];
+    uint16_t     n = ALARM_GLASSBREAK_FFT_LEN;
+
+    // Bit-reversed copy.
+    for (uint16_t i = 0, j = 0; i < n; i++)
+    {
+        re[j] = m_time[i];
+        im[j] = 0.0f;
+
+        uint16_t bit = n >> 1;
+        while ((j & bit) != 0)
+        {
+            j  ^= bit;
+            bit >>= 1;
+        }
+        j |= bit;
+    }
+
+    for (uint16_t len = 2; len <= n; len <<= 1)
+    {
+        float angle = -TWO_PI / len;
+
+        for (uint16_t start = 0; start < n; start += len)
+        {
+            for (uint16_t k = 0; k < (len / 2); k++)
+            {
+                float    wr = cosf(angle * k);
+                float    wi = sinf(angle * k);
+                uint16_t a  = start + k;
+                uint16_t b  = a + (len / 2);
+                float    tr = (re[b] * wr) - (im[b] * wi);
+                float    ti = (re[b] * wi) + (im[b] * wr);
+
+                re[b]  = re[a] - tr;
+                im[b]  = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+
+    for (uint16_t i = 0; i < FFT_BINS; i++)
+    {
+        m_power[i] = (re[i] * re[i]) + (im[i] * im[i]);
+    }
+}
+
+#endif // ALARM_GLASSBREAK_USE_CMSIS_DSP
+
+
+void alarm_glassbreak_band_energy(int16_t const * p_block, float * p_energy)
+{
+    float mean = 0.0f;
+
+    for (uint16_t i = 0; i < ALARM_GLASSBREAK_FFT_LEN; i++)
+    {
+        m_time[i] = (float)p_block[i];
+        mean     += m_time[i];
+    }
+    mean /= ALARM_GLASSBREAK_FFT_LEN;
+
+#if ALARM_GLASSBREAK_USE_CMSIS_DSP
+    arm_offset_f32(m_time, -mean, m_time, ALARM_GLASSBREAK_FFT_LEN);
+    arm_mult_f32(m_time, m_window, m_time, ALARM_GLASSBREAK_FFT_LEN);
+#else
+    for (uint16_t i = 0; i < ALARM_GLASSBREAK_FFT_LEN; i++)
+    {
+        m_time[i] = (m_time[i] - mean) * m_window[i];
+    }
+#endif
+
+    power_spectrum();
+
+    for (uint8_t band = 0; band < ALARM_GLASSBREAK_BAND_COUNT; band++)
+    {
+        float sum = 0.0f;
+
+        for (uint16_t bin = m_band_start[band]; bin < m_band_start[band + 1]; bin++)
+        {
+            sum += m_power[bin];
+        }
+        p_energy[band] = sum;
+    }
+}
+
+
+/**@brief Function for classifying one block from its band energies.
+ *
+ * @details A glass break is a low-frequency thump followed within a short window by a burst
+ *          that is dominated by high-frequency shatter energy.
+ *
+ * @return  True if the block completes a glass-break signature.
+ */
+static bool classify(float const * p_energy)
+{
+    float total = 0.0f;
+
+    for (uint8_t band = 0; band < ALARM_GLASSBREAK_BAND_COUNT; band++)
+    {
+        total += p_energy[band];
+    }
+
+    if (p_energy[ALARM_GLASSBREAK_BAND_THUMP] > ALARM_GLASSBREAK_THUMP_ENERGY)
+    {
+        m_armed_blocks = ALARM_GLASSBREAK_WINDOW_BLOCKS;
+        return false;
+    }
+
+    if (m_armed_blocks == 0)
+    {
+        return false;
+    }
+    m_armed_blocks--;
+
+    if ((p_energy[ALARM_GLASSBREAK_BAND_SHATTER] > ALARM_GLASSBREAK_SHATTER_ENERGY) &&
+        (p_energy[ALARM_GLASSBREAK_BAND_SHATTER] > (ALARM_GLASSBREAK_SHATTER_RATIO * total)))
+    {
+        m_armed_blocks = 0;
+        return true;
+    }
+
+    return false;
+}
+
+
+ret_code_t alarm_glassbreak_init(alarm_glassbreak_handler_t handler)
+{
+    VERIFY_PARAM_NOT_NULL(handler);
+
+    m_handler       = handler;
+    m_block_pending = false;
+    m_armed_blocks  = 0;
+    memset(&m_bench, 0, sizeof(m_bench));
+
+    for (uint16_t i = 0; i < ALARM_GLASSBREAK_FFT_LEN; i++)
+    {
+        m_window[i] = 0.5f - (0.5f * cosf((TWO_PI * i) / (ALARM_GLASSBREAK_FFT_LEN - 1)));
+    }
+
+#if ALARM_GLASSBREAK_USE_CMSIS_DSP
+    if (arm_rfft_fast_init_f32(&m_rfft, ALARM_GLASSBREAK_FFT_LEN) != ARM_MATH_SUCCESS)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+#endif
+
+    m_bench.budget_cycles = (SystemCoreClock / ALARM_GLASSBREAK_SAMPLE_RATE_HZ) * ALARM_GLASSBREAK_FFT_LEN;
+    ALARM_CYCLES_ENABLE();
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_glassbreak_feed(int16_t const * p_samples, uint16_t scan_count, uint8_t stride, uint8_t channel)
+{
+    if (scan_count != ALARM_GLASSBREAK_FFT_LEN)
+    {
+        return;
+    }
+
+    if (m_block_pending)
+    {
+        m_bench.overruns++;
+        return;
+    }
+
+    for (uint16_t i = 0; i < ALARM_GLASSBREAK_FFT_LEN; i++)
+    {
+        m_block[i] = p_samples[(i * stride) + channel];
+    }
+    m_block_pending = true;
+}
+
+
+bool alarm_glassbreak_process(void)
+{
+    float    energy[ALARM_GLASSBREAK_BAND_COUNT];
+    uint32_t start;
+    bool     detected;
+
+    if (!m_block_pending)
+    {
+        return false;
+    }
+
+    start = ALARM_CYCLES_NOW();
+
+    alarm_glassbreak_band_energy(m_block, energy);
+    m_block_pending = false;
+    detected        = classify(energy);
+
+    m_bench.last_cycles = ALARM_CYCLES_NOW() - start;
+    m_bench.max_cycles  = MAX(m_bench.max_cycles, m_bench.last_cycles);
+    m_bench.blocks++;
+
+    if (detected)
+    {
+        m_handler(energy);
+    }
+
+    return true;
+}
+
+
+alarm_glassbreak_bench_t const * alarm_glassbreak_bench_get(void)
+{
+    return &m_bench;
+}
@@ -0,0 +1,87 @@
+#ifndef ALARM_GLASSBREAK_H__
+#define ALARM_GLASSBREAK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+/**@brief   Use the CMSIS-DSP kernels when building for a Cortex-M4F. Any other build (including a
+ *          host build) falls back to the portable reference implementation in the same file. */
+#if defined(ARM_MATH_CM4) && defined(__FPU_PRESENT) && (__FPU_PRESENT == 1)
+#define ALARM_GLASSBREAK_USE_CMSIS_DSP  1
+#else
+#define ALARM_GLASSBREAK_USE_CMSIS_DSP  0
+#endif
+
+#define ALARM_GLASSBREAK_FFT_LEN        256                         /**< Samples per FFT block; must match the SAADC block length. */
+#define ALARM_GLASSBREAK_SAMPLE_RATE_HZ 8000
+
+/**@brief   Spectral bands fed to the classifier. */
+typedef enum
+{
+    ALARM_GLASSBREAK_BAND_THUMP,                                    /**< 100-500 Hz: low-frequency impact on the pane. */
+    ALARM_GLASSBREAK_BAND_MID,                                      /**< 500-2000 Hz: speech and general room noise. */
+    ALARM_GLASSBREAK_BAND_SHATTER,                                  /**< 2000-4000 Hz: high-frequency shatter. */
+    ALARM_GLASSBREAK_BAND_COUNT
+} alarm_glassbreak_band_t;
+
+#define ALARM_GLASSBREAK_THUMP_ENERGY   1.0e7f                      /**< Minimum thump band energy that opens a detection window. */
+#define ALARM_GLASSBREAK_SHATTER_ENERGY 5.0e6f                      /**< Minimum shatter band energy within the window. */
+#define ALARM_GLASSBREAK_SHATTER_RATIO  0.45f                       /**< Minimum share of the shatter band in the block's total energy. */
+#define ALARM_GLASSBREAK_WINDOW_BLOCKS  8                           /**< Blocks (256 ms) a thump keeps the detector armed for shatter. */
+
+/**@brief   Cycle accounting for the per-block DSP work. */
+typedef struct
+{
+    uint32_t blocks;                                                /**< Blocks processed. */
+    uint32_t overruns;                                              /**< Blocks dropped because the previous one was still pending. */
+    uint32_t last_cycles;                                           /**< CPU cycles spent on the last block. */
+    uint32_t max_cycles;                                            /**< Worst case CPU cycles per block. */
+    uint32_t budget_cycles;                                         /**< Cycles available per block at the sample rate. */
+} alarm_glassbreak_bench_t;
+
+/**@brief   Glass-break detected handler type. */
+typedef void (*alarm_glassbreak_handler_t)(float const * p_band_energy);
+
+/**@brief Function for initializing the detector (window table and FFT instance).
+ *
+ * @param[in]   handler     Called from @ref alarm_glassbreak_process when a glass break is classified.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_glassbreak_init(alarm_glassbreak_handler_t handler);
+
+/**@brief Function for handing one microphone block to the detector.
+ *
+ * @details Safe to call from interrupt context: the channel is only deinterleaved into the
+ *          pending buffer. The transform runs later in @ref alarm_glassbreak_process.
+ *
+ * @param[in]   p_samples   Interleaved SAADC samples.
+ * @param[in]   scan_count  Number of scans, must be @ref ALARM_GLASSBREAK_FFT_LEN.
+ * @param[in]   stride      Number of channels per scan.
+ * @param[in]   channel     Microphone channel within a scan.
+ */
+void alarm_glassbreak_feed(int16_t const * p_samples, uint16_t scan_count, uint8_t stride, uint8_t channel);
+
+/**@brief Function for running the windowed FFT and classifier on the pending block, if any.
+ *
+ * @details Intended to be called from the main loop.
+ *
+ * @return      True if a block was processed.
+ */
+bool alarm_glassbreak_process(void);
+
+/**@brief Function for computing the band energies of one block.
+ *
+ * @details Removes DC, applies a Hann window and sums the power spectrum into
+ *          @ref ALARM_GLASSBREAK_BAND_COUNT bands.
+ *
+ * @param[in]   p_block     @ref ALARM_GLASSBREAK_FFT_LEN microphone samples.
+ * @param[out]  p_energy    @ref ALARM_GLASSBREAK_BAND_COUNT band energies.
+ */
+void alarm_glassbreak_band_energy(int16_t const * p_block, float * p_energy);
+
+/**@brief Function for getting the cycle accounting of the detector. */
+alarm_glassbreak_bench_t const * alarm_glassbreak_bench_get(void);
+
+#endif // ALARM_GLASSBREAK_H__
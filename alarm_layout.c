@@ -0,0 +1,136 @@
+#include "sdk_common.h"
+#include "alarm_layout.h"
+#include <string.h>
+#include "alarm_config.h"
+#include "fds.h"
+#include "peer_manager.h"
+#include "nrf_log.h"
+
+static uint32_t m_layout_id;                                        /**< Also the record data; must stay valid until FDS finishes the write. */
+static bool     m_store_again;                                      /**< Retry the write once garbage collection is done. */
+
+
+/**@brief Function for writing the current layout id to flash. */
+static void store(void)
+{
+    ret_code_t        err_code;
+    fds_record_t      record;
+    fds_record_desc_t desc;
+    fds_find_token_t  token;
+
+    record.file_id           = ALARM_CONFIG_FILE_ID;
+    record.key               = ALARM_LAYOUT_RECORD_KEY;
+    record.data.p_data       = &m_layout_id;
+    record.data.length_words = 1;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(ALARM_CONFIG_FILE_ID, ALARM_LAYOUT_RECORD_KEY, &desc, &token) == NRF_SUCCESS)
+    {
+        err_code = fds_record_update(&desc, &record);
+    }
+    else
+    {
+        err_code = fds_record_write(NULL, &record);
+    }
+
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH)
+    {
+        err_code = fds_gc();
+        if (err_code == NRF_SUCCESS)
+        {
+            m_store_again = true;
+            return;
+        }
+    }
+
+    if (err_code != NRF_SUCCESS)
+    {
+        // Peers are flagged already; the id is compared (and flagged) again on the next boot.
+        NRF_LOG_WARNING("GATT layout id not stored: 0x%x.", err_code);
+    }
+}
+
+
+/**@brief Function for comparing the stored layout id with the current one.
+ *
+ * @return      NRF_SUCCESS, or FDS_ERR_NOT_INITIALIZED if FDS is not ready yet.
+ */
+static ret_code_t check(void)
+{
+    ret_code_t         err_code;
+    fds_record_desc_t  desc;
+    fds_find_token_t   token;
+    fds_flash_record_t flash_record;
+    bool               unchanged = false;
+
+    memset(&token, 0, sizeof(token));
+    err_code = fds_record_find(ALARM_CONFIG_FILE_ID, ALARM_LAYOUT_RECORD_KEY, &desc, &token);
+    if (err_code == FDS_ERR_NOT_INITIALIZED)
+    {
+        return err_code;
+    }
+
+    if ((err_code == NRF_SUCCESS) && (fds_record_open(&desc, &flash_record) == NRF_SUCCESS))
+    {
+        unchanged = (*(uint32_t const *)flash_record.p_data == m_layout_id);
+        (void)fds_record_close(&desc);
+    }
+
+    if (unchanged)
+    {
+        NRF_LOG_INFO("GATT layout 0x%08x unchanged; bonded peers keep cached handles.", m_layout_id);
+        return NRF_SUCCESS;
+    }
+
+    NRF_LOG_INFO("GATT layout changed to 0x%08x; bonded peers get Service Changed.", m_layout_id);
+    pm_local_database_has_changed();
+    store();
+
+    return NRF_SUCCESS;
+}
+
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    switch (p_evt->id)
+    {
+        case FDS_EVT_INIT:
+            if (p_evt->result == NRF_SUCCESS)
+            {
+                (void)check();
+            }
+            break;
+
+        case FDS_EVT_GC:
+            if (m_store_again)
+            {
+                m_store_again = false;
+                store();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+ret_code_t alarm_layout_init(uint32_t layout_id)
+{
+    ret_code_t err_code;
+
+    m_layout_id   = layout_id;
+    m_store_again = false;
+
+    err_code = fds_register(fds_evt_handler);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = check();
+    if (err_code == FDS_ERR_NOT_INITIALIZED)
+    {
+        // Checked on FDS_EVT_INIT.
+        return NRF_SUCCESS;
+    }
+
+    return err_code;
+}
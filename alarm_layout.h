@@ -0,0 +1,25 @@
+#ifndef ALARM_LAYOUT_H__
+#define ALARM_LAYOUT_H__
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+#define ALARM_LAYOUT_RECORD_KEY         0x0002                      /**< FDS record key of the GATT layout id, in ALARM_CONFIG_FILE_ID. */
+
+/**@brief Function for checking the GATT layout against the one bonded peers have cached.
+ *
+ * @details The layout id of the previous boot is kept in flash. If it differs, or none is
+ *          stored, every bonded peer is flagged through pm_local_database_has_changed() so the
+ *          Peer Manager sends it a Service Changed indication on its next connection, and the new
+ *          id is stored. If it matches, bonded peers can keep using their cached handles.
+ *
+ *          Must be called after the Peer Manager is initialized. The check runs at once if FDS
+ *          is already initialized, otherwise when it reports that it is.
+ *
+ * @param[in]   layout_id   Identifier of the current layout, e.g. from @ref ble_alarm_layout_t.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_layout_init(uint32_t layout_id);
+
+#endif // ALARM_LAYOUT_H__
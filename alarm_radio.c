@@ -0,0 +1,63 @@
+#include "sdk_common.h"
+#include "alarm_radio.h"
+#include "app_util_platform.h"
+
+static alarm_radio_handler_t m_handler;
+static bool                  m_armed;
+static alarm_radio_stats_t   m_stats;
+
+
+/**@brief Radio notification interrupt, raised by the SoftDevice ahead of a radio event. */
+void SWI1_EGU1_IRQHandler(void)
+{
+    m_stats.notifications++;
+    m_handler();
+}
+
+
+ret_code_t alarm_radio_init(alarm_radio_handler_t handler)
+{
+    ret_code_t err_code;
+
+    VERIFY_PARAM_NOT_NULL(handler);
+
+    m_handler = handler;
+    m_armed   = false;
+
+    err_code = sd_nvic_DisableIRQ(SWI1_EGU1_IRQn);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = sd_nvic_SetPriority(SWI1_EGU1_IRQn, ALARM_RADIO_IRQ_PRIORITY);
+    VERIFY_SUCCESS(err_code);
+
+    return sd_radio_notification_cfg_set(NRF_RADIO_NOTIFICATION_TYPE_INT_ON_ACTIVE, ALARM_RADIO_DISTANCE);
+}
+
+
+void alarm_radio_arm(void)
+{
+    CRITICAL_REGION_ENTER();
+    if (!m_armed)
+    {
+        m_armed = true;
+        m_stats.arms++;
+        (void)sd_nvic_ClearPendingIRQ(SWI1_EGU1_IRQn);
+        (void)sd_nvic_EnableIRQ(SWI1_EGU1_IRQn);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+
+void alarm_radio_disarm(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_armed = false;
+    (void)sd_nvic_DisableIRQ(SWI1_EGU1_IRQn);
+    CRITICAL_REGION_EXIT();
+}
+
+
+alarm_radio_stats_t const * alarm_radio_stats_get(void)
+{
+    return &m_stats;
+}
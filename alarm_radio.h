@@ -0,0 +1,52 @@
+#ifndef ALARM_RADIO_H__
+#define ALARM_RADIO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_soc.h"
+
+/**@file
+ *
+ * @details Radio notification. The SoftDevice raises SWI1 @ref ALARM_RADIO_DISTANCE before every
+ *          radio event, connection events included, which is the last moment to queue packets
+ *          for that event. The interrupt is only enabled while armed, so radio events with
+ *          nothing to send do not wake the CPU.
+ *
+ *          The notification is configured once at init: the SoftDevice refuses to change it
+ *          while any role is active.
+ */
+
+#define ALARM_RADIO_DISTANCE            NRF_RADIO_NOTIFICATION_DISTANCE_800US   /**< Time from the notification to the radio event. */
+#define ALARM_RADIO_IRQ_PRIORITY        APP_IRQ_PRIORITY_LOW                    /**< Same level as app_timer and the SoftDevice event handlers. */
+
+/**@brief   Called ahead of a radio event while armed. */
+typedef void (*alarm_radio_handler_t)(void);
+
+/**@brief   Counters since boot. */
+typedef struct
+{
+    uint32_t notifications;                                         /**< Radio events the handler ran ahead of. */
+    uint32_t arms;                                                  /**< Times the notification was armed from disarmed. */
+} alarm_radio_stats_t;
+
+/**@brief Function for configuring the radio notification. Needs the SoftDevice enabled, and no
+ *        role active yet.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_radio_init(alarm_radio_handler_t handler);
+
+/**@brief Function for running the handler ahead of every radio event until disarmed.
+ *
+ * @details A notification left pending from an earlier event is discarded, so the first call
+ *          comes ahead of the next event. Safe to call from any interrupt level.
+ */
+void alarm_radio_arm(void);
+
+/**@brief Function for stopping the handler. Safe to call from any interrupt level. */
+void alarm_radio_disarm(void);
+
+alarm_radio_stats_t const * alarm_radio_stats_get(void);
+
+#endif // ALARM_RADIO_H__
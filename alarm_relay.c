@@ -0,0 +1,261 @@
+#include "sdk_common.h"
+#include "alarm_relay.h"
+#include <string.h>
+#include "ble_advdata.h"
+#include "alarm_flood.h"
+#include "nrf_sdh_ble.h"
+#include "nrf_log.h"
+
+#if ALARM_ADV_EXTENDED
+#define SCAN_BUF_LEN    BLE_GAP_SCAN_BUFFER_EXTENDED_MIN            /**< Also receives the full snapshots of other s140 nodes. */
+#else
+#define SCAN_BUF_LEN    BLE_GAP_SCAN_BUFFER_MIN
+#endif
+
+/**@brief   Last state heard from a neighbour. */
+typedef struct
+{
+    ble_gap_addr_t addr;
+    bool           used;
+    uint8_t        flags;
+    uint16_t       zones;
+    uint16_t       alarm_count;
+    uint32_t       trips;                                           /**< Sum of the per-zone trip counters. */
+    uint32_t       heard_at_s;
+    uint32_t       relayed_at_s;
+} node_t;
+
+static alarm_relay_handler_t m_handler;
+static ble_uuid_t            m_uuid;
+static node_t                m_nodes[ALARM_RELAY_NODE_COUNT];
+static uint8_t               m_scan_buf[SCAN_BUF_LEN];              /**< Owned by the SoftDevice while scanning. */
+static ble_data_t            m_scan_data = {m_scan_buf, sizeof(m_scan_buf)};
+static ble_gap_scan_params_t m_scan_params;
+static bool                  m_high_duty;
+static uint32_t              m_now_s;
+static uint32_t              m_changed_at_s;                        /**< Last time a neighbour changed state. */
+static uint32_t              m_budget_s;                            /**< High duty budget, see @ref ALARM_RELAY_BOOST_COST. */
+static alarm_relay_stats_t   m_stats;
+
+
+/**@brief Function for (re)starting the scan at the given duty. */
+static ret_code_t duty_set(bool high)
+{
+    m_high_duty              = high;
+    m_scan_params.interval   = high ? ALARM_RELAY_SCAN_INTERVAL_HIGH : ALARM_RELAY_SCAN_INTERVAL_LOW;
+
+    (void)sd_ble_gap_scan_stop();
+
+    return sd_ble_gap_scan_start(&m_scan_params, &m_scan_data);
+}
+
+
+/**@brief Function for noting that a neighbour changed state, raising the duty if the budget
+ *        allows. */
+static void activity(void)
+{
+    m_changed_at_s = m_now_s;
+    if (!m_high_duty && (m_budget_s >= ALARM_RELAY_BOOST_COST))
+    {
+        (void)duty_set(true);
+        NRF_LOG_INFO("Relay scan at high duty (%u of %u reports matched).", m_stats.matched, m_stats.reports);
+    }
+}
+
+
+/**@brief Function for finding the entry of a neighbour, or recycling the least recently heard
+ *        one for it.
+ *
+ * @param[out]  p_new   True if the neighbour was not tracked.
+ */
+static node_t * node_get(ble_gap_addr_t const * p_addr, bool * p_new)
+{
+    node_t * p_oldest = &m_nodes[0];
+
+    for (uint8_t i = 0; i < ALARM_RELAY_NODE_COUNT; i++)
+    {
+        node_t * p_node = &m_nodes[i];
+
+        if (!p_node->used)
+        {
+            p_oldest = p_node;
+            continue;
+        }
+
+        if ((p_node->addr.addr_type == p_addr->addr_type) &&
+            (memcmp(p_node->addr.addr, p_addr->addr, BLE_GAP_ADDR_LEN) == 0))
+        {
+            *p_new = false;
+            return p_node;
+        }
+
+        if (p_oldest->used && ((m_now_s - p_node->heard_at_s) > (m_now_s - p_oldest->heard_at_s)))
+        {
+            p_oldest = p_node;
+        }
+    }
+
+    memset(p_oldest, 0, sizeof(*p_oldest));
+    p_oldest->used = true;
+    p_oldest->addr = *p_addr;
+    *p_new         = true;
+
+    return p_oldest;
+}
+
+
+static void on_adv_report(ble_gap_evt_adv_report_t const * p_report)
+{
+    uint8_t const      * p_data = p_report->data.p_data;
+    uint8_t const      * p_payload;
+    uint16_t             offset = 0;
+    uint16_t             len;
+    alarm_adv_snapshot_t snapshot;
+    alarm_relay_update_t update;
+    node_t             * p_node;
+    uint32_t             trips = 0;
+    bool                 is_new;
+    bool                 changed;
+
+    m_stats.reports++;
+
+    if (p_report->type.status != BLE_GAP_ADV_DATA_STATUS_COMPLETE)
+    {
+        return;
+    }
+
+    len = ble_advdata_search(p_data, p_report->data.len, &offset, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
+    if ((len <= sizeof(uint16_t)) || (uint16_decode(&p_data[offset]) != ALARM_ADV_COMPANY_ID))
+    {
+        return;
+    }
+    p_payload = &p_data[offset + sizeof(uint16_t)];
+    len      -= sizeof(uint16_t);
+
+    // Flood PDUs carry no service UUID in legacy builds, so they are told apart by format alone.
+    if (p_payload[0] == ALARM_ADV_FORMAT_FLOOD)
+    {
+        if (alarm_flood_rx(p_payload, len))
+        {
+            activity();
+        }
+        return;
+    }
+
+    if (!ble_advdata_uuid_find(p_data, p_report->data.len, &m_uuid) ||
+        (alarm_adv_snapshot_decode(p_payload, len, &snapshot) != NRF_SUCCESS))
+    {
+        return;
+    }
+
+    m_stats.matched++;
+
+    for (uint8_t zone = 0; zone < ALARM_ADV_ZONE_COUNT; zone++)
+    {
+        trips += snapshot.zone_trips[zone];
+    }
+
+    p_node  = node_get(&p_report->peer_addr, &is_new);
+    changed = is_new                                          ||
+              (p_node->flags       != snapshot.status.flags)  ||
+              (p_node->zones       != snapshot.zones)         ||
+              (p_node->alarm_count != snapshot.alarm_count)   ||
+              (p_node->trips       != trips);
+
+    update.urgent = is_new ? ((snapshot.status.flags != 0) || (snapshot.zones != 0)) : changed;
+
+    p_node->flags       = snapshot.status.flags;
+    p_node->zones       = snapshot.zones;
+    p_node->alarm_count = snapshot.alarm_count;
+    p_node->trips       = trips;
+    p_node->heard_at_s  = m_now_s;
+
+    if (!changed && ((m_now_s - p_node->relayed_at_s) < ALARM_RELAY_REFRESH_S))
+    {
+        m_stats.suppressed++;
+        return;
+    }
+
+    if (changed)
+    {
+        activity();
+    }
+
+    update.p_addr    = &p_report->peer_addr;
+    update.rssi      = p_report->rssi;
+    update.p_payload = p_payload;
+    update.length    = len;
+    m_handler(&update);
+
+    p_node->relayed_at_s = m_now_s;
+    m_stats.relayed++;
+}
+
+
+static void on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    if (p_ble_evt->header.evt_id != BLE_GAP_EVT_ADV_REPORT)
+    {
+        return;
+    }
+
+    on_adv_report(&p_ble_evt->evt.gap_evt.params.adv_report);
+
+    // The SoftDevice pauses scanning to hand over the buffer; resume with the same buffer. Fails
+    // harmlessly if duty_set() already restarted the scan.
+    (void)sd_ble_gap_scan_start(NULL, &m_scan_data);
+}
+
+NRF_SDH_BLE_OBSERVER(m_relay_obs, ALARM_RELAY_BLE_OBSERVER_PRIO, on_ble_evt, NULL);
+
+
+ret_code_t alarm_relay_init(ble_uuid_t const * p_uuid, alarm_relay_handler_t handler)
+{
+    VERIFY_PARAM_NOT_NULL(p_uuid);
+    VERIFY_PARAM_NOT_NULL(handler);
+
+    m_uuid         = *p_uuid;
+    m_handler      = handler;
+    m_now_s        = 0;
+    m_changed_at_s = 0;
+    m_budget_s     = ALARM_RELAY_BOOST_BUDGET_MAX_S;
+    memset(m_nodes, 0, sizeof(m_nodes));
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    memset(&m_scan_params, 0, sizeof(m_scan_params));
+    m_scan_params.active        = 0;
+    m_scan_params.window        = ALARM_RELAY_SCAN_WINDOW;
+    m_scan_params.timeout       = BLE_GAP_SCAN_TIMEOUT_UNLIMITED;
+    m_scan_params.scan_phys     = BLE_GAP_PHY_1MBPS;
+    m_scan_params.filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL;
+    m_scan_params.extended      = ALARM_ADV_EXTENDED;
+
+    return duty_set(false);
+}
+
+
+void alarm_relay_tick(void)
+{
+    m_now_s++;
+
+    if (!m_high_duty)
+    {
+        m_budget_s = MIN(m_budget_s + 1, ALARM_RELAY_BOOST_BUDGET_MAX_S);
+        return;
+    }
+
+    m_stats.high_duty_s++;
+    m_budget_s -= MIN(m_budget_s, ALARM_RELAY_BOOST_COST);
+
+    if ((m_budget_s < ALARM_RELAY_BOOST_COST) || ((m_now_s - m_changed_at_s) >= ALARM_RELAY_BOOST_S))
+    {
+        (void)duty_set(false);
+        NRF_LOG_INFO("Relay scan at low duty after %u s at high duty in total.", m_stats.high_duty_s);
+    }
+}
+
+
+alarm_relay_stats_t const * alarm_relay_stats_get(void)
+{
+    return &m_stats;
+}
@@ -0,0 +1,75 @@
+#ifndef ALARM_RELAY_H__
+#define ALARM_RELAY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "ble.h"
+#include "alarm_adv.h"
+
+#ifndef ALARM_RELAY_ENABLED
+#if defined(S112)
+#define ALARM_RELAY_ENABLED             0                           /**< s112 has no observer role. */
+#else
+#define ALARM_RELAY_ENABLED             1
+#endif
+#endif
+
+#define ALARM_RELAY_BLE_OBSERVER_PRIO   2                           /**< Priority of the relay BLE observer. */
+#define ALARM_RELAY_NODE_COUNT          8                           /**< Neighbours tracked for deduplication; the least recently heard is replaced. */
+#define ALARM_RELAY_REFRESH_S           60                          /**< Relay an unchanged node this often, so the ESP can tell it is alive. */
+
+#define ALARM_RELAY_SCAN_WINDOW         MSEC_TO_UNITS(30, UNIT_0_625_MS)
+#define ALARM_RELAY_SCAN_INTERVAL_HIGH  MSEC_TO_UNITS(100, UNIT_0_625_MS)   /**< 30 % duty while neighbours are changing state. */
+#define ALARM_RELAY_SCAN_INTERVAL_LOW   MSEC_TO_UNITS(1000, UNIT_0_625_MS)  /**< 3 % duty while they are quiet. */
+#define ALARM_RELAY_BOOST_S             30                          /**< High duty lasts this long after the last state change. */
+#define ALARM_RELAY_BOOST_COST          4                           /**< Budget seconds a high duty second costs; a low duty second earns one. */
+#define ALARM_RELAY_BOOST_BUDGET_MAX_S  300                         /**< Budget cap, i.e. the longest uninterrupted burst is 75 s. */
+
+/**@brief   State update of a neighbour, ready to be relayed. */
+typedef struct
+{
+    ble_gap_addr_t  const * p_addr;
+    int8_t                  rssi;
+    bool                    urgent;                                 /**< The node changed state, or is new and in alarm; false for refreshes. */
+    uint8_t const         * p_payload;                              /**< Manufacturer data as advertised, company identifier excluded. */
+    uint16_t                length;
+} alarm_relay_update_t;
+
+typedef void (*alarm_relay_handler_t)(alarm_relay_update_t const * p_update);
+
+typedef struct
+{
+    uint32_t reports;                                               /**< Advertising reports received. */
+    uint32_t matched;                                               /**< Reports from Alarm nodes. */
+    uint32_t relayed;
+    uint32_t suppressed;                                            /**< Matched reports dropped as duplicates. */
+    uint32_t high_duty_s;                                           /**< Seconds spent at high duty. */
+} alarm_relay_stats_t;
+
+/**@brief Function for initializing the relay and starting to scan.
+ *
+ * @details Scanning is passive and observer-only, so no central link needs to be configured.
+ *          Only advertising reports carrying the Alarm service UUID and a valid snapshot
+ *          (@ref alarm_adv.h) are considered. A node is relayed when it is heard for the first
+ *          time, when its alarm flag, zones, alarm count or trip counters change, and otherwise
+ *          every @ref ALARM_RELAY_REFRESH_S seconds.
+ *
+ *          The scan runs at low duty and is raised to high duty when a neighbour changes state.
+ *          High duty is paid for from a budget earned at low duty, so at most
+ *          1 / (1 + @ref ALARM_RELAY_BOOST_COST) of the time is spent at high duty however often
+ *          neighbours change.
+ *
+ * @param[in]   p_uuid      Service UUID of Alarm nodes.
+ * @param[in]   handler     Called for every update to relay.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_relay_init(ble_uuid_t const * p_uuid, alarm_relay_handler_t handler);
+
+/**@brief Function for advancing the relay clock. Call once per second. */
+void alarm_relay_tick(void);
+
+alarm_relay_stats_t const * alarm_relay_stats_get(void);
+
+#endif // ALARM_RELAY_H__
@@ -0,0 +1,215 @@
+#include "sdk_common.h"
+#include "alarm_saadc.h"
+#include <string.h>
+#include "nrf_drv_saadc.h"
+#include "nrf_drv_timer.h"
+#include "nrf_drv_ppi.h"
+#include "app_error.h"
+#include "nrf_log.h"
+
+static const nrf_drv_timer_t m_sample_timer = NRF_DRV_TIMER_INSTANCE(1);      /**< TIMER0 is reserved by the SoftDevice. */
+
+static nrf_saadc_value_t          m_buffer_pool[2][ALARM_SAADC_BUF_LEN];
+static nrf_ppi_channel_t          m_ppi_channel;
+static alarm_saadc_evt_handler_t  m_evt_handler;
+static alarm_saadc_limit_t        m_limits[ALARM_SAADC_CH_COUNT];
+static uint8_t                    m_holdoff[ALARM_SAADC_CH_COUNT];              /**< Blocks left before a tripped channel is re-armed, 0 when armed. */
+static alarm_saadc_block_stats_t  m_stats[ALARM_SAADC_CH_COUNT];
+
+static const nrf_saadc_input_t m_inputs[ALARM_SAADC_CH_COUNT] =
+{
+    [ALARM_SAADC_CH_MIC]       = NRF_SAADC_INPUT_AIN0,
+    [ALARM_SAADC_CH_VIBRATION] = NRF_SAADC_INPUT_AIN1,
+    [ALARM_SAADC_CH_BATTERY]   = NRF_SAADC_INPUT_VDD,
+};
+
+
+void alarm_saadc_block_stats(int16_t const             * p_samples,
+                             uint16_t                    scan_count,
+                             uint8_t                     stride,
+                             uint8_t                     channel,
+                             alarm_saadc_block_stats_t * p_stats)
+{
+    int32_t sum = 0;
+    int16_t min = INT16_MAX;
+    int16_t max = INT16_MIN;
+
+    if (scan_count == 0)
+    {
+        memset(p_stats, 0, sizeof(*p_stats));
+        return;
+    }
+
+    for (uint16_t i = 0; i < scan_count; i++)
+    {
+        int16_t sample = p_samples[(i * stride) + channel];
+
+        sum += sample;
+        min  = MIN(min, sample);
+        max  = MAX(max, sample);
+    }
+
+    p_stats->min  = min;
+    p_stats->max  = max;
+    p_stats->mean = (int16_t)(sum / scan_count);
+    p_stats->last = p_samples[((scan_count - 1) * stride) + channel];
+}
+
+
+/**@brief Function for arming or disarming the hardware limits of one channel. */
+static void limits_arm(uint8_t channel, bool armed)
+{
+    if (armed)
+    {
+        nrf_drv_saadc_limits_set(channel, m_limits[channel].low, m_limits[channel].high);
+    }
+    else
+    {
+        nrf_drv_saadc_limits_set(channel, NRF_DRV_SAADC_LIMITL_DISABLED, NRF_DRV_SAADC_LIMITH_DISABLED);
+    }
+}
+
+
+/**@brief Function for handling SAADC driver events.
+ *
+ * @details A LIMIT event fires on every conversion past the threshold, so the channel is disarmed
+ *          on the first hit and only re-armed after @ref ALARM_SAADC_LIMIT_HOLDOFF blocks.
+ */
+static void saadc_evt_handler(nrf_drv_saadc_evt_t const * p_event)
+{
+    alarm_saadc_evt_t evt;
+
+    if (p_event->type == NRF_DRV_SAADC_EVT_DONE)
+    {
+        int16_t const * p_samples  = p_event->data.done.p_buffer;
+        uint16_t        scan_count = p_event->data.done.size / ALARM_SAADC_CH_COUNT;
+
+        for (uint8_t ch = 0; ch < ALARM_SAADC_CH_COUNT; ch++)
+        {
+            alarm_saadc_block_stats(p_samples, scan_count, ALARM_SAADC_CH_COUNT, ch, &m_stats[ch]);
+
+            if ((m_holdoff[ch] != 0) && (--m_holdoff[ch] == 0))
+            {
+                limits_arm(ch, true);
+            }
+        }
+
+        evt.evt_type                    = ALARM_SAADC_EVT_BLOCK;
+        evt.params.block.p_samples      = p_samples;
+        evt.params.block.scan_count     = scan_count;
+        evt.params.block.p_stats        = m_stats;
+        m_evt_handler(&evt);
+
+        // Hand the buffer back to EasyDMA; the SAADC is already filling the other one.
+        APP_ERROR_CHECK(nrf_drv_saadc_buffer_convert(p_event->data.done.p_buffer,
+                                                     ALARM_SAADC_BUF_LEN));
+    }
+    else if (p_event->type == NRF_DRV_SAADC_EVT_LIMIT)
+    {
+        uint8_t ch = p_event->data.limit.channel;
+
+        if (m_holdoff[ch] != 0)
+        {
+            return;
+        }
+
+        limits_arm(ch, false);
+        m_holdoff[ch] = ALARM_SAADC_LIMIT_HOLDOFF;
+
+        evt.evt_type              = ALARM_SAADC_EVT_LIMIT;
+        evt.params.limit.channel  = (alarm_saadc_ch_t)ch;
+        evt.params.limit.high     = (p_event->data.limit.limit_type == NRF_SAADC_LIMIT_HIGH);
+        m_evt_handler(&evt);
+    }
+}
+
+
+/**@brief Sample TIMER events are routed through PPI only; no interrupt work is needed. */
+static void sample_timer_handler(nrf_timer_event_t event_type, void * p_context)
+{
+    UNUSED_PARAMETER(event_type);
+    UNUSED_PARAMETER(p_context);
+}
+
+
+static ret_code_t sample_timer_init(void)
+{
+    ret_code_t             err_code;
+    nrf_drv_timer_config_t timer_cfg = NRF_DRV_TIMER_DEFAULT_CONFIG;
+
+    timer_cfg.bit_width = NRF_TIMER_BIT_WIDTH_32;
+
+    err_code = nrf_drv_timer_init(&m_sample_timer, &timer_cfg, sample_timer_handler);
+    VERIFY_SUCCESS(err_code);
+
+    uint32_t ticks = nrf_drv_timer_us_to_ticks(&m_sample_timer, 1000000UL / ALARM_SAADC_SAMPLE_RATE_HZ);
+    nrf_drv_timer_extended_compare(&m_sample_timer,
+                                   NRF_TIMER_CC_CHANNEL0,
+                                   ticks,
+                                   NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK,
+                                   false);
+
+    // Other modules may have initialized PPI already.
+    err_code = nrf_drv_ppi_init();
+    if ((err_code != NRF_SUCCESS) && (err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED))
+    {
+        return err_code;
+    }
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_channel);
+    VERIFY_SUCCESS(err_code);
+
+    return nrf_drv_ppi_channel_assign(m_ppi_channel,
+                                      nrf_drv_timer_compare_event_address_get(&m_sample_timer,
+                                                                              NRF_TIMER_CC_CHANNEL0),
+                                      nrf_drv_saadc_sample_task_get());
+}
+
+
+ret_code_t alarm_saadc_init(alarm_saadc_init_t const * p_init)
+{
+    ret_code_t err_code;
+
+    VERIFY_PARAM_NOT_NULL(p_init);
+    VERIFY_PARAM_NOT_NULL(p_init->evt_handler);
+
+    m_evt_handler = p_init->evt_handler;
+    memcpy(m_limits, p_init->limits, sizeof(m_limits));
+    memset(m_holdoff, 0, sizeof(m_holdoff));
+
+    err_code = nrf_drv_saadc_init(NULL, saadc_evt_handler);
+    VERIFY_SUCCESS(err_code);
+
+    for (uint8_t ch = 0; ch < ALARM_SAADC_CH_COUNT; ch++)
+    {
+        nrf_saadc_channel_config_t channel_cfg = NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(m_inputs[ch]);
+
+        err_code = nrf_drv_saadc_channel_init(ch, &channel_cfg);
+        VERIFY_SUCCESS(err_code);
+
+        limits_arm(ch, true);
+    }
+
+    // Queue both buffers so EasyDMA can switch without waiting for the CPU.
+    err_code = nrf_drv_saadc_buffer_convert(m_buffer_pool[0], ALARM_SAADC_BUF_LEN);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = nrf_drv_saadc_buffer_convert(m_buffer_pool[1], ALARM_SAADC_BUF_LEN);
+    VERIFY_SUCCESS(err_code);
+
+    return sample_timer_init();
+}
+
+
+void alarm_saadc_start(void)
+{
+    APP_ERROR_CHECK(nrf_drv_ppi_channel_enable(m_ppi_channel));
+    nrf_drv_timer_enable(&m_sample_timer);
+}
+
+
+void alarm_saadc_stop(void)
+{
+    nrf_drv_timer_disable(&m_sample_timer);
+    APP_ERROR_CHECK(nrf_drv_ppi_channel_disable(m_ppi_channel));
+}
@@ -0,0 +1,106 @@
+#ifndef ALARM_SAADC_H__
+#define ALARM_SAADC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_saadc.h"
+#include "sdk_errors.h"
+
+/**@brief   Analog channels sampled by the SAADC pipeline, in scan order. */
+typedef enum
+{
+    ALARM_SAADC_CH_MIC,                                             /**< Glass-break microphone (AIN0). */
+    ALARM_SAADC_CH_VIBRATION,                                       /**< Vibration sensor (AIN1). */
+    ALARM_SAADC_CH_BATTERY,                                         /**< Supply voltage (VDD). */
+    ALARM_SAADC_CH_COUNT
+} alarm_saadc_ch_t;
+
+#define ALARM_SAADC_SAMPLE_RATE_HZ      8000                        /**< Scan rate; every scan converts all channels once. */
+#define ALARM_SAADC_BLOCK_LEN           256                         /**< Scans per EasyDMA buffer (32 ms at 8 kHz). */
+#define ALARM_SAADC_BUF_LEN             (ALARM_SAADC_BLOCK_LEN * ALARM_SAADC_CH_COUNT)
+
+#define ALARM_SAADC_LIMIT_HOLDOFF       4                           /**< Blocks to wait before a tripped limit is re-armed. */
+
+/**@brief   Per-channel statistics for one sample block. */
+typedef struct
+{
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+    int16_t last;                                                   /**< Most recent sample of the block. */
+} alarm_saadc_block_stats_t;
+
+typedef enum
+{
+    ALARM_SAADC_EVT_BLOCK,                                          /**< A buffer of interleaved samples is complete. */
+    ALARM_SAADC_EVT_LIMIT                                           /**< A channel crossed its high or low limit. */
+} alarm_saadc_evt_type_t;
+
+typedef struct
+{
+    alarm_saadc_evt_type_t evt_type;
+    union
+    {
+        struct
+        {
+            int16_t const                   * p_samples;            /**< Interleaved samples, @ref ALARM_SAADC_CH_COUNT per scan. */
+            uint16_t                          scan_count;           /**< Number of scans in @p p_samples. */
+            alarm_saadc_block_stats_t const * p_stats;              /**< Array of @ref ALARM_SAADC_CH_COUNT statistics. */
+        } block;
+        struct
+        {
+            alarm_saadc_ch_t channel;
+            bool             high;                                  /**< True for the high limit, false for the low limit. */
+        } limit;
+    } params;
+} alarm_saadc_evt_t;
+
+typedef void (*alarm_saadc_evt_handler_t)(alarm_saadc_evt_t const * p_evt);
+
+/**@brief   Limits applied to each channel, in raw 12-bit SAADC units. */
+typedef struct
+{
+    int16_t low;
+    int16_t high;
+} alarm_saadc_limit_t;
+
+typedef struct
+{
+    alarm_saadc_evt_handler_t evt_handler;
+    alarm_saadc_limit_t       limits[ALARM_SAADC_CH_COUNT];
+} alarm_saadc_init_t;
+
+/**@brief Function for initializing the SAADC, the sample TIMER and the PPI channel between them.
+ *
+ * @details Both EasyDMA buffers are queued immediately so the SAADC always has a spare buffer
+ *          while the application processes the other one.
+ *
+ * @param[in]   p_init  Event handler and channel limits.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_saadc_init(alarm_saadc_init_t const * p_init);
+
+/**@brief Function for starting continuous sampling. */
+void alarm_saadc_start(void);
+
+/**@brief Function for stopping continuous sampling. */
+void alarm_saadc_stop(void);
+
+/**@brief Function for computing min, max, mean and last sample of one channel in an interleaved block.
+ *
+ * @details Has no hardware dependencies so it can be run against recorded sample streams.
+ *
+ * @param[in]   p_samples   Interleaved samples.
+ * @param[in]   scan_count  Number of scans in @p p_samples.
+ * @param[in]   stride      Number of channels per scan.
+ * @param[in]   channel     Channel to compute statistics for.
+ * @param[out]  p_stats     Resulting statistics.
+ */
+void alarm_saadc_block_stats(int16_t const             * p_samples,
+                             uint16_t                    scan_count,
+                             uint8_t                     stride,
+                             uint8_t                     channel,
+                             alarm_saadc_block_stats_t * p_stats);
+
+#endif // ALARM_SAADC_H__
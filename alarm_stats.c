@@ -0,0 +1,197 @@
+#include "sdk_common.h"
+#include "alarm_stats.h"
+#include <math.h>
+#include <string.h>
+#include "app_util_platform.h"
+
+#define WINDOWS_PER_LEVEL   60                                      /**< 60 s per minute, 60 min per hour. */
+
+static alarm_stats_level_t m_levels[ALARM_STATS_CH_COUNT][ALARM_STATS_RES_COUNT];
+static uint8_t             m_ticks[ALARM_STATS_RES_COUNT - 1];     /**< Closed windows of level i since level i + 1 last closed. */
+
+
+void alarm_stats_acc_add(alarm_stats_acc_t * p_acc, float value)
+{
+    float delta;
+
+    if (p_acc->count == 0)
+    {
+        p_acc->min = value;
+        p_acc->max = value;
+    }
+    else
+    {
+        p_acc->min = MIN(p_acc->min, value);
+        p_acc->max = MAX(p_acc->max, value);
+    }
+
+    p_acc->count++;
+    delta        = value - p_acc->mean;
+    p_acc->mean += delta / p_acc->count;
+    p_acc->m2   += delta * (value - p_acc->mean);
+}
+
+
+void alarm_stats_acc_merge(alarm_stats_acc_t * p_dst, alarm_stats_acc_t const * p_src)
+{
+    uint32_t count;
+    float    delta;
+
+    if (p_src->count == 0)
+    {
+        return;
+    }
+
+    if (p_dst->count == 0)
+    {
+        *p_dst = *p_src;
+        return;
+    }
+
+    count        = p_dst->count + p_src->count;
+    delta        = p_src->mean - p_dst->mean;
+    p_dst->mean += delta * ((float)p_src->count / count);
+    p_dst->m2   += p_src->m2 + (delta * delta * (((float)p_dst->count * p_src->count) / count));
+    p_dst->min   = MIN(p_dst->min, p_src->min);
+    p_dst->max   = MAX(p_dst->max, p_src->max);
+    p_dst->count = count;
+}
+
+
+/**@brief Function for closing the open window of one level and pushing it to the history ring. */
+static void level_close(alarm_stats_level_t * p_level)
+{
+    alarm_stats_acc_t    * p_acc = &p_level->open;
+    alarm_stats_window_t * p_win;
+
+    p_level->head = (p_level->head + 1) % ALARM_STATS_HISTORY_LEN;
+    p_win         = &p_level->history[p_level->head];
+
+    p_win->count  = p_acc->count;
+    p_win->mean   = p_acc->mean;
+    p_win->min    = p_acc->min;
+    p_win->max    = p_acc->max;
+    p_win->stddev = (p_acc->count > 1) ? sqrtf(p_acc->m2 / (p_acc->count - 1)) : 0.0f;
+
+    if (p_level->filled < ALARM_STATS_HISTORY_LEN)
+    {
+        p_level->filled++;
+    }
+
+    memset(p_acc, 0, sizeof(*p_acc));
+}
+
+
+void alarm_stats_init(void)
+{
+    memset(m_levels, 0, sizeof(m_levels));
+    memset(m_ticks, 0, sizeof(m_ticks));
+}
+
+
+void alarm_stats_add(alarm_stats_ch_t channel, float value)
+{
+    if (channel >= ALARM_STATS_CH_COUNT)
+    {
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    alarm_stats_acc_add(&m_levels[channel][ALARM_STATS_RES_1S].open, value);
+    CRITICAL_REGION_EXIT();
+}
+
+
+void alarm_stats_tick(void)
+{
+    CRITICAL_REGION_ENTER();
+
+    for (uint8_t res = 0; res < ALARM_STATS_RES_COUNT; res++)
+    {
+        for (uint8_t ch = 0; ch < ALARM_STATS_CH_COUNT; ch++)
+        {
+            alarm_stats_level_t * p_level = &m_levels[ch][res];
+
+            if (res + 1 < ALARM_STATS_RES_COUNT)
+            {
+                alarm_stats_acc_merge(&m_levels[ch][res + 1].open, &p_level->open);
+            }
+            level_close(p_level);
+        }
+
+        // Only cascade to the next resolution once it has collected a full window.
+        if ((res + 1 == ALARM_STATS_RES_COUNT) || (++m_ticks[res] < WINDOWS_PER_LEVEL))
+        {
+            break;
+        }
+        m_ticks[res] = 0;
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+
+bool alarm_stats_window_get(alarm_stats_ch_t channel, alarm_stats_res_t res, alarm_stats_window_t * p_window)
+{
+    bool found = false;
+
+    if ((channel >= ALARM_STATS_CH_COUNT) || (res >= ALARM_STATS_RES_COUNT))
+    {
+        return false;
+    }
+
+    CRITICAL_REGION_ENTER();
+    alarm_stats_level_t const * p_level = &m_levels[channel][res];
+    if (p_level->filled != 0)
+    {
+        *p_window = p_level->history[p_level->head];
+        found     = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return found;
+}
+
+
+/**@brief Function for rounding a float to the nearest int16, saturating at the type limits. */
+static int16_t float_to_int16(float value)
+{
+    if (value >= INT16_MAX)
+    {
+        return INT16_MAX;
+    }
+    if (value <= INT16_MIN)
+    {
+        return INT16_MIN;
+    }
+    return (int16_t)((value >= 0.0f) ? (value + 0.5f) : (value - 0.5f));
+}
+
+
+uint16_t alarm_stats_encode(uint8_t * p_buf)
+{
+    uint16_t len = 0;
+
+    p_buf[len++] = ALARM_STATS_CH_COUNT;
+
+    for (uint8_t ch = 0; ch < ALARM_STATS_CH_COUNT; ch++)
+    {
+        for (uint8_t res = 0; res < ALARM_STATS_RES_COUNT; res++)
+        {
+            alarm_stats_window_t window;
+
+            if (!alarm_stats_window_get((alarm_stats_ch_t)ch, (alarm_stats_res_t)res, &window))
+            {
+                memset(&window, 0, sizeof(window));
+            }
+
+            len += uint16_encode((uint16_t)MIN(window.count, UINT16_MAX), &p_buf[len]);
+            len += uint16_encode((uint16_t)float_to_int16(window.mean),   &p_buf[len]);
+            len += uint16_encode((uint16_t)float_to_int16(window.stddev), &p_buf[len]);
+            len += uint16_encode((uint16_t)float_to_int16(window.min),    &p_buf[len]);
+            len += uint16_encode((uint16_t)float_to_int16(window.max),    &p_buf[len]);
+        }
+    }
+
+    return len;
+}
@@ -0,0 +1,101 @@
+#ifndef ALARM_STATS_H__
+#define ALARM_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**@brief   Telemetry channels aggregated on the device. */
+typedef enum
+{
+    ALARM_STATS_CH_MIC,                                             /**< Microphone block mean. */
+    ALARM_STATS_CH_VIBRATION,                                       /**< Vibration sensor block mean. */
+    ALARM_STATS_CH_BATTERY,                                         /**< Supply voltage block mean. */
+    ALARM_STATS_CH_RSSI,                                            /**< Link RSSI in dBm. */
+    ALARM_STATS_CH_COUNT
+} alarm_stats_ch_t;
+
+/**@brief   Downsampling resolutions. Each level is fed by the one before it. */
+typedef enum
+{
+    ALARM_STATS_RES_1S,
+    ALARM_STATS_RES_1MIN,
+    ALARM_STATS_RES_1H,
+    ALARM_STATS_RES_COUNT
+} alarm_stats_res_t;
+
+#define ALARM_STATS_HISTORY_LEN         4                           /**< Closed windows kept per resolution. */
+
+/**@brief   Running statistics (Welford's method). */
+typedef struct
+{
+    uint32_t count;
+    float    mean;
+    float    m2;                                                    /**< Sum of squared deviations from the mean. */
+    float    min;
+    float    max;
+} alarm_stats_acc_t;
+
+/**@brief   Summary of one closed window. */
+typedef struct
+{
+    float    mean;
+    float    stddev;
+    float    min;
+    float    max;
+    uint32_t count;
+} alarm_stats_window_t;
+
+/**@brief   One resolution of one channel: the open window plus a ring of closed ones. */
+typedef struct
+{
+    alarm_stats_acc_t    open;
+    alarm_stats_window_t history[ALARM_STATS_HISTORY_LEN];
+    uint8_t              head;                                      /**< Index of the newest closed window. */
+    uint8_t              filled;                                    /**< Number of valid entries in @p history. */
+} alarm_stats_level_t;
+
+#define ALARM_STATS_RECORD_LEN          10                          /**< Encoded bytes per channel and resolution. */
+#define ALARM_STATS_ENCODED_LEN         (1 + (ALARM_STATS_CH_COUNT * ALARM_STATS_RES_COUNT * ALARM_STATS_RECORD_LEN))
+
+/**@brief Function for resetting all channels. */
+void alarm_stats_init(void);
+
+/**@brief Function for adding one sample to a channel.
+ *
+ * @details Samples go into the open 1 s window. Safe to call from interrupt context.
+ */
+void alarm_stats_add(alarm_stats_ch_t channel, float value);
+
+/**@brief Function for closing the open 1 s windows. Must be called once per second.
+ *
+ * @details Every 60th call also closes the 1 min windows, and every 3600th call the 1 h
+ *          windows. Coarser levels are fed with the closed windows of the finer level, merged
+ *          with the parallel form of Welford's update so no raw samples are retained.
+ */
+void alarm_stats_tick(void);
+
+/**@brief Function for accumulating one sample into a running statistic. */
+void alarm_stats_acc_add(alarm_stats_acc_t * p_acc, float value);
+
+/**@brief Function for merging two running statistics into @p p_dst. */
+void alarm_stats_acc_merge(alarm_stats_acc_t * p_dst, alarm_stats_acc_t const * p_src);
+
+/**@brief Function for getting the newest closed window of a channel at a resolution.
+ *
+ * @return  True if the window exists.
+ */
+bool alarm_stats_window_get(alarm_stats_ch_t channel, alarm_stats_res_t res, alarm_stats_window_t * p_window);
+
+/**@brief Function for encoding the newest closed window of every channel and resolution.
+ *
+ * @details Layout: channel count (1 byte), then for each channel and each resolution the window
+ *          count (uint16, saturated) followed by mean, standard deviation, min and max (int16,
+ *          rounded), all little-endian. Windows that are not closed yet are encoded as zeros.
+ *
+ * @param[out]  p_buf       Buffer of at least @ref ALARM_STATS_ENCODED_LEN bytes.
+ *
+ * @return      Number of bytes written.
+ */
+uint16_t alarm_stats_encode(uint8_t * p_buf);
+
+#endif // ALARM_STATS_H__
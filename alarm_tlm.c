@@ -0,0 +1,143 @@
+#include "sdk_common.h"
+#include "alarm_tlm.h"
+#include <string.h>
+#include "alarm_cycles.h"
+
+#define ROW_MAX_LEN(_p_enc)     ((_p_enc)->channels * ALARM_TLM_VARINT_MAX_LEN)
+
+
+uint8_t alarm_tlm_varint_put(uint32_t value, uint8_t * p_buf)
+{
+    uint8_t len = 0;
+
+    while (value >= 0x80)
+    {
+        p_buf[len++] = (uint8_t)(value | 0x80);
+        value      >>= 7;
+    }
+    p_buf[len++] = (uint8_t)value;
+
+    return len;
+}
+
+
+uint8_t alarm_tlm_varint_get(uint8_t const * p_buf, size_t len, uint32_t * p_value)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = 0; (i < len) && (i < 5); i++)
+    {
+        value |= (uint32_t)(p_buf[i] & 0x7F) << (7 * i);
+
+        if ((p_buf[i] & 0x80) == 0)
+        {
+            *p_value = value;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+ret_code_t alarm_tlm_init(alarm_tlm_encoder_t * p_enc, uint8_t channels, uint16_t max_len, alarm_tlm_send_t send)
+{
+    VERIFY_PARAM_NOT_NULL(p_enc);
+    VERIFY_PARAM_NOT_NULL(send);
+
+    if ((channels == 0) || (channels > ALARM_TLM_MAX_CHANNELS))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    memset(p_enc, 0, sizeof(*p_enc));
+
+    p_enc->channels = channels;
+    p_enc->send     = send;
+    p_enc->max_len  = MIN(max_len, ALARM_TLM_FRAME_MAX_LEN);
+
+    if (p_enc->max_len < (ALARM_TLM_HEADER_LEN + ROW_MAX_LEN(p_enc)))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    p_enc->max_len_next = p_enc->max_len;
+
+    ALARM_CYCLES_ENABLE();
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_tlm_flush(alarm_tlm_encoder_t * p_enc)
+{
+    if (p_enc->len == 0)
+    {
+        return;
+    }
+
+    if (p_enc->send(p_enc->buf, p_enc->len) == NRF_SUCCESS)
+    {
+        p_enc->encoded_bytes += p_enc->len;
+    }
+    else
+    {
+        p_enc->frames_dropped++;
+    }
+
+    p_enc->seq++;
+    p_enc->len = 0;
+}
+
+
+void alarm_tlm_max_len_set(alarm_tlm_encoder_t * p_enc, uint16_t max_len)
+{
+    max_len = MIN(max_len, ALARM_TLM_FRAME_MAX_LEN);
+
+    if (max_len < (ALARM_TLM_HEADER_LEN + ROW_MAX_LEN(p_enc)))
+    {
+        return;
+    }
+
+    // A single halfword store, so alarm_tlm_put never sees half of it.
+    p_enc->max_len_next = max_len;
+}
+
+
+void alarm_tlm_put(alarm_tlm_encoder_t * p_enc, int16_t const * p_row)
+{
+    uint32_t start   = ALARM_CYCLES_NOW();
+    uint16_t max_len = p_enc->max_len_next;
+
+    if (max_len < p_enc->max_len)
+    {
+        // The link now takes less than the open frame was sized for.
+        alarm_tlm_flush(p_enc);
+    }
+
+    if (p_enc->len == 0)
+    {
+        // New frame: take the current limit and reset the predictor so the first row is sent
+        // as absolute values.
+        p_enc->max_len = max_len;
+        p_enc->buf[p_enc->len++] = (uint8_t)((ALARM_TLM_FRAME_SAMPLES << 4) | (p_enc->seq & 0x0F));
+        p_enc->buf[p_enc->len++] = p_enc->channels;
+        memset(p_enc->prev, 0, sizeof(p_enc->prev));
+    }
+
+    for (uint8_t ch = 0; ch < p_enc->channels; ch++)
+    {
+        int32_t delta = (int32_t)p_row[ch] - p_enc->prev[ch];
+
+        p_enc->len      += alarm_tlm_varint_put(alarm_tlm_zigzag(delta), &p_enc->buf[p_enc->len]);
+        p_enc->prev[ch]  = p_row[ch];
+    }
+
+    p_enc->raw_bytes += p_enc->channels * sizeof(int16_t);
+    p_enc->cycles    += ALARM_CYCLES_NOW() - start;
+
+    if ((p_enc->len + ROW_MAX_LEN(p_enc)) > p_enc->max_len)
+    {
+        alarm_tlm_flush(p_enc);
+    }
+}
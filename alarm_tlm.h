@@ -0,0 +1,100 @@
+#ifndef ALARM_TLM_H__
+#define ALARM_TLM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdk_errors.h"
+
+#define ALARM_TLM_MAX_CHANNELS          4                           /**< Maximum samples per row. */
+#define ALARM_TLM_FRAME_MAX_LEN         244                         /**< Largest notification payload (ATT MTU 247). */
+#define ALARM_TLM_HEADER_LEN            2                           /**< Type/sequence byte and channel count. */
+#define ALARM_TLM_VARINT_MAX_LEN        3                           /**< A zigzag-encoded 16-bit delta fits in 3 varint bytes. */
+
+/**@brief   Frame types, stored in the upper nibble of the first frame byte. */
+typedef enum
+{
+    ALARM_TLM_FRAME_SAMPLES   = 1,                                  /**< Rows of zigzag varint deltas. */
+    ALARM_TLM_FRAME_ACK       = 2,                                  /**< Delivery report of a command; the low nibble is the alarm_ack_status_t. */
+    ALARM_TLM_FRAME_EVENT     = 3,                                  /**< Zone trip, possibly delivered late; the low nibble is the zone. */
+    ALARM_TLM_FRAME_HEARTBEAT = 4,                                  /**< Once per second while notifying; the second byte is the heartbeat. */
+} alarm_tlm_frame_type_t;
+
+/**@brief   Sends one complete frame. Returns NRF_SUCCESS if the frame was queued. */
+typedef uint32_t (*alarm_tlm_send_t)(uint8_t * p_data, uint16_t length);
+
+/**@brief   Encoder state for one telemetry stream.
+ *
+ * @details Every frame restarts the delta predictor from zero, so the first row of a frame is
+ *          effectively absolute and a lost notification never corrupts later frames.
+ */
+typedef struct
+{
+    uint8_t          buf[ALARM_TLM_FRAME_MAX_LEN];
+    uint16_t         len;                                           /**< Bytes used in @p buf, 0 when no frame is open. */
+    uint16_t         max_len;                                       /**< Payload limit of the open frame. */
+    volatile uint16_t max_len_next;                                 /**< Payload limit of the current link (ATT MTU - 3), taken at the next frame. */
+    uint8_t          channels;
+    uint8_t          seq;
+    int16_t          prev[ALARM_TLM_MAX_CHANNELS];
+    alarm_tlm_send_t send;
+    uint32_t         raw_bytes;                                     /**< Bytes the rows would take as raw int16. */
+    uint32_t         encoded_bytes;                                 /**< Bytes actually sent, headers included. */
+    uint32_t         frames_dropped;                                /**< Frames the link refused. */
+    uint32_t         cycles;                                        /**< CPU cycles spent encoding. */
+} alarm_tlm_encoder_t;
+
+/**@brief Function for zigzag-encoding a signed value so small magnitudes map to small codes. */
+static __INLINE uint32_t alarm_tlm_zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**@brief Function for decoding a zigzag-encoded value. */
+static __INLINE int32_t alarm_tlm_unzigzag(uint32_t code)
+{
+    return (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+}
+
+/**@brief Function for writing a LEB128 varint.
+ *
+ * @return  Number of bytes written.
+ */
+uint8_t alarm_tlm_varint_put(uint32_t value, uint8_t * p_buf);
+
+/**@brief Function for reading a LEB128 varint.
+ *
+ * @return  Number of bytes consumed, 0 if @p len ran out before the last byte.
+ */
+uint8_t alarm_tlm_varint_get(uint8_t const * p_buf, size_t len, uint32_t * p_value);
+
+/**@brief Function for initializing an encoder.
+ *
+ * @param[out]  p_enc       Encoder.
+ * @param[in]   channels    Samples per row, at most @ref ALARM_TLM_MAX_CHANNELS.
+ * @param[in]   max_len     Initial payload limit.
+ * @param[in]   send        Frame sink.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_tlm_init(alarm_tlm_encoder_t * p_enc, uint8_t channels, uint16_t max_len, alarm_tlm_send_t send);
+
+/**@brief Function for updating the payload limit after an ATT MTU exchange.
+ *
+ * @details Only records the new limit; @ref alarm_tlm_put applies it when it opens the next
+ *          frame, or closes the open frame first if the limit shrank. It may therefore be
+ *          called from a context that preempts @ref alarm_tlm_put, such as a SoftDevice event
+ *          while the SAADC handler is encoding. Every other function must run in the context
+ *          of @ref alarm_tlm_put.
+ */
+void alarm_tlm_max_len_set(alarm_tlm_encoder_t * p_enc, uint16_t max_len);
+
+/**@brief Function for appending one row of samples.
+ *
+ * @details The frame is sent as soon as the next row might not fit.
+ */
+void alarm_tlm_put(alarm_tlm_encoder_t * p_enc, int16_t const * p_row);
+
+/**@brief Function for sending the open frame, if any. */
+void alarm_tlm_flush(alarm_tlm_encoder_t * p_enc);
+
+#endif // ALARM_TLM_H__
@@ -0,0 +1,294 @@
+#include "sdk_common.h"
+#include "alarm_tx_sched.h"
+#include <string.h>
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "alarm_util.h"
+
+#define NO_CLASS                ALARM_TX_CLASS_COUNT
+#define FIRST_WEIGHTED_CLASS    ALARM_TX_CLASS_CONTROL
+#define WEIGHTED_CLASS_COUNT    (ALARM_TX_CLASS_COUNT - FIRST_WEIGHTED_CLASS)
+
+static uint8_t const m_weights[ALARM_TX_CLASS_COUNT] =
+{
+    [ALARM_TX_CLASS_ALARM]     = 0,                                 // Strict priority, never weighted.
+    [ALARM_TX_CLASS_CONTROL]   = ALARM_TX_WEIGHT_CONTROL,
+    [ALARM_TX_CLASS_TELEMETRY] = ALARM_TX_WEIGHT_TELEMETRY,
+    [ALARM_TX_CLASS_BULK]      = ALARM_TX_WEIGHT_BULK,
+};
+
+
+/**@brief Function for getting a slot of a class queue. */
+static alarm_tx_slot_hdr_t * slot_get(alarm_tx_sched_t const * p_sched, uint8_t tx_class, uint8_t index)
+{
+    uint32_t slot_size = ALARM_TX_SLOT_SIZE(p_sched->frame_max_len);
+
+    return (alarm_tx_slot_hdr_t *)&p_sched->p_slots[((tx_class * p_sched->queue_len) + index) * slot_size];
+}
+
+
+/**@brief Function for getting the oldest frame of a class, or NULL if the queue is empty.
+ *
+ * @details Only the drain context pops frames, so the returned slot stays valid while it is sent.
+ */
+static alarm_tx_slot_hdr_t * head_get(alarm_tx_sched_t * p_sched, uint8_t tx_class)
+{
+    alarm_tx_slot_hdr_t * p_slot = NULL;
+
+    CRITICAL_REGION_ENTER();
+    if (p_sched->queues[tx_class].count != 0)
+    {
+        p_slot = slot_get(p_sched, tx_class, p_sched->queues[tx_class].head);
+    }
+    CRITICAL_REGION_EXIT();
+
+    return p_slot;
+}
+
+
+static void head_pop(alarm_tx_sched_t * p_sched, uint8_t tx_class)
+{
+    alarm_tx_queue_t * p_queue = &p_sched->queues[tx_class];
+
+    CRITICAL_REGION_ENTER();
+    p_queue->head = (p_queue->head + 1) % p_sched->queue_len;
+    p_queue->count--;
+    CRITICAL_REGION_EXIT();
+}
+
+
+static void drr_advance(alarm_tx_sched_t * p_sched)
+{
+    p_sched->drr_credited = false;
+    p_sched->drr_class++;
+    if (p_sched->drr_class >= ALARM_TX_CLASS_COUNT)
+    {
+        p_sched->drr_class = FIRST_WEIGHTED_CLASS;
+    }
+}
+
+
+/**@brief Function for picking the class whose head frame goes out next.
+ *
+ * @details A partially sent frame is always finished first so byte-stream links never see
+ *          interleaved frames. Alarm frames come next, then deficit round robin over the weighted
+ *          classes. The quantum is weight * frame_max_len, so every visit to a backlogged class
+ *          sends at least one frame and the loop below terminates within one round.
+ */
+static uint8_t class_next(alarm_tx_sched_t * p_sched)
+{
+    if (p_sched->in_progress != NO_CLASS)
+    {
+        return p_sched->in_progress;
+    }
+
+    if (head_get(p_sched, ALARM_TX_CLASS_ALARM) != NULL)
+    {
+        return ALARM_TX_CLASS_ALARM;
+    }
+
+    for (uint8_t i = 0; i <= WEIGHTED_CLASS_COUNT; i++)
+    {
+        uint8_t               tx_class = p_sched->drr_class;
+        alarm_tx_slot_hdr_t * p_slot   = head_get(p_sched, tx_class);
+
+        if (p_slot == NULL)
+        {
+            p_sched->deficit[tx_class] = 0;
+            drr_advance(p_sched);
+            continue;
+        }
+
+        if (!p_sched->drr_credited)
+        {
+            p_sched->deficit[tx_class] += m_weights[tx_class] * p_sched->frame_max_len;
+            p_sched->drr_credited       = true;
+        }
+
+        if (p_slot->len <= p_sched->deficit[tx_class])
+        {
+            return tx_class;
+        }
+
+        drr_advance(p_sched);
+    }
+
+    return NO_CLASS;
+}
+
+
+static void drain_frames(alarm_tx_sched_t * p_sched, bool pushed)
+{
+    for (;;)
+    {
+        uint8_t               tx_class = class_next(p_sched);
+        alarm_tx_slot_hdr_t * p_slot;
+        uint16_t              accepted;
+        uint32_t              delay;
+
+        if (tx_class == NO_CLASS)
+        {
+            return;
+        }
+
+        p_slot         = head_get(p_sched, tx_class);
+        accepted       = p_sched->sink((uint8_t const *)(p_slot + 1) + p_slot->sent,
+                                       p_slot->len - p_slot->sent,
+                                       pushed);
+        p_slot->sent  += accepted;
+
+        if (p_slot->sent < p_slot->len)
+        {
+            // Link is full. Resume this frame on the next drain.
+            p_sched->in_progress = (p_slot->sent != 0) ? tx_class : NO_CLASS;
+            return;
+        }
+
+        delay = app_timer_cnt_diff_compute(app_timer_cnt_get(), p_slot->enqueued_at);
+
+        p_sched->stats[tx_class].sent++;
+        p_sched->stats[tx_class].delay_sum += delay;
+        p_sched->stats[tx_class].delay_max  = MAX(p_sched->stats[tx_class].delay_max, delay);
+
+        if (tx_class != ALARM_TX_CLASS_ALARM)
+        {
+            p_sched->deficit[tx_class] -= p_slot->len;
+        }
+
+        p_sched->in_progress = NO_CLASS;
+        head_pop(p_sched, tx_class);
+    }
+}
+
+
+/**@brief Function for running one drain pass, serving the pushes requested before it started. */
+static void drain_once(void * p_context)
+{
+    alarm_tx_sched_t * p_sched = p_context;
+    uint32_t           pushes  = p_sched->push_requests;
+
+    drain_frames(p_sched, pushes != 0);
+
+    (void)nrf_atomic_u32_sub(&p_sched->push_requests, pushes);
+}
+
+
+ret_code_t alarm_tx_sched_init(alarm_tx_sched_t * p_sched, alarm_tx_sink_t sink)
+{
+    VERIFY_PARAM_NOT_NULL(p_sched);
+    VERIFY_PARAM_NOT_NULL(sink);
+
+    if ((p_sched->frame_max_len == 0) || (p_sched->queue_len == 0))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    p_sched->sink         = sink;
+    p_sched->drr_class    = FIRST_WEIGHTED_CLASS;
+    p_sched->drr_credited = false;
+    p_sched->in_progress  = NO_CLASS;
+
+    memset(p_sched->queues,  0, sizeof(p_sched->queues));
+    memset(p_sched->deficit, 0, sizeof(p_sched->deficit));
+    memset(p_sched->stats,   0, sizeof(p_sched->stats));
+    p_sched->drain_requests = 0;
+    p_sched->push_requests  = 0;
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t alarm_tx_sched_put(alarm_tx_sched_t * p_sched,
+                              alarm_tx_class_t   tx_class,
+                              uint8_t const    * p_data,
+                              uint16_t           length)
+{
+    alarm_tx_slot_hdr_t * p_slot = NULL;
+    alarm_tx_queue_t    * p_queue;
+
+    if (tx_class >= ALARM_TX_CLASS_COUNT)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if ((length == 0) || (length > p_sched->frame_max_len))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    p_queue = &p_sched->queues[tx_class];
+
+    CRITICAL_REGION_ENTER();
+    if (p_queue->count < p_sched->queue_len)
+    {
+        p_slot = slot_get(p_sched, tx_class, (p_queue->head + p_queue->count) % p_sched->queue_len);
+
+        memcpy(p_slot + 1, p_data, length);
+        p_slot->enqueued_at = app_timer_cnt_get();
+        p_slot->len         = length;
+        p_slot->sent        = 0;
+
+        p_queue->count++;
+        p_sched->stats[tx_class].enqueued++;
+    }
+    else
+    {
+        p_sched->stats[tx_class].dropped++;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (p_slot == NULL)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    alarm_tx_sched_drain(p_sched);
+
+    return NRF_SUCCESS;
+}
+
+
+void alarm_tx_sched_drain(alarm_tx_sched_t * p_sched)
+{
+    alarm_drain_run(&p_sched->drain_requests, drain_once, p_sched);
+}
+
+
+void alarm_tx_sched_push(alarm_tx_sched_t * p_sched)
+{
+    (void)nrf_atomic_u32_add(&p_sched->push_requests, 1);
+    alarm_tx_sched_drain(p_sched);
+}
+
+
+void alarm_tx_sched_flush(alarm_tx_sched_t * p_sched)
+{
+    CRITICAL_REGION_ENTER();
+    for (uint8_t tx_class = 0; tx_class < ALARM_TX_CLASS_COUNT; tx_class++)
+    {
+        p_sched->stats[tx_class].dropped += p_sched->queues[tx_class].count;
+        p_sched->queues[tx_class].head    = 0;
+        p_sched->queues[tx_class].count   = 0;
+        p_sched->deficit[tx_class]        = 0;
+    }
+    p_sched->in_progress  = NO_CLASS;
+    p_sched->drr_credited = false;
+    CRITICAL_REGION_EXIT();
+}
+
+
+uint8_t alarm_tx_sched_free_get(alarm_tx_sched_t const * p_sched, alarm_tx_class_t tx_class)
+{
+    return p_sched->queue_len - p_sched->queues[tx_class].count;
+}
+
+
+alarm_tx_class_stats_t const * alarm_tx_sched_stats_get(alarm_tx_sched_t const * p_sched,
+                                                        alarm_tx_class_t         tx_class)
+{
+    if (tx_class >= ALARM_TX_CLASS_COUNT)
+    {
+        return NULL;
+    }
+
+    return &p_sched->stats[tx_class];
+}
@@ -0,0 +1,140 @@
+#ifndef ALARM_TX_SCHED_H__
+#define ALARM_TX_SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_common.h"
+#include "nrf_atomic.h"
+
+/**@brief   Traffic classes, in strict priority order for @ref ALARM_TX_CLASS_ALARM and weighted
+ *          round robin for the rest. */
+typedef enum
+{
+    ALARM_TX_CLASS_ALARM,                                           /**< Alarm frames; always sent first. */
+    ALARM_TX_CLASS_CONTROL,                                         /**< Commands, acknowledgements and link control. */
+    ALARM_TX_CLASS_TELEMETRY,                                       /**< Periodic sensor and link telemetry. */
+    ALARM_TX_CLASS_BULK,                                            /**< Log dumps and backlog transfers. */
+    ALARM_TX_CLASS_COUNT
+} alarm_tx_class_t;
+
+#define ALARM_TX_WEIGHT_CONTROL         4                           /**< Frames per round for control traffic. */
+#define ALARM_TX_WEIGHT_TELEMETRY       2                           /**< Frames per round for telemetry. */
+#define ALARM_TX_WEIGHT_BULK            1                           /**< Frames per round for bulk traffic. */
+
+/**@brief   Header stored in front of every queued frame. */
+typedef struct
+{
+    uint32_t enqueued_at;                                           /**< app_timer counter value when the frame was queued. */
+    uint16_t len;
+    uint16_t sent;                                                  /**< Bytes already accepted by the sink. */
+} alarm_tx_slot_hdr_t;
+
+#define ALARM_TX_SLOT_SIZE(_frame_max_len)  (sizeof(alarm_tx_slot_hdr_t) + ALIGN_NUM(4, (_frame_max_len)))
+
+/**@brief   Hands bytes to the underlying link.
+ *
+ * @param[in]   p_data      Bytes to send.
+ * @param[in]   length      Length of @p p_data.
+ * @param[in]   pushed      True if the drain runs for @ref alarm_tx_sched_push. A link that
+ *                          batches frames can accept nothing otherwise.
+ *
+ * @return  Number of bytes accepted. Returning less than @p length stops draining until the next
+ *          @ref alarm_tx_sched_drain call; the rest of the frame is sent before anything else.
+ */
+typedef uint16_t (*alarm_tx_sink_t)(uint8_t const * p_data, uint16_t length, bool pushed);
+
+/**@brief   Per-class counters. Delays are in app_timer ticks. */
+typedef struct
+{
+    uint32_t enqueued;
+    uint32_t sent;
+    uint32_t dropped;                                               /**< Frames refused because the class queue was full. */
+    uint32_t delay_sum;                                             /**< Sum of queueing delays of sent frames. */
+    uint32_t delay_max;                                             /**< Worst queueing delay of a sent frame. */
+} alarm_tx_class_stats_t;
+
+typedef struct
+{
+    uint8_t head;
+    uint8_t count;
+} alarm_tx_queue_t;
+
+/**@brief   Outbound scheduler instance. Use @ref ALARM_TX_SCHED_DEF to define one. */
+typedef struct
+{
+    uint8_t        * const p_slots;                                 /**< ALARM_TX_CLASS_COUNT queues of queue_len slots each. */
+    uint16_t const         frame_max_len;
+    uint8_t const          queue_len;
+    alarm_tx_sink_t        sink;
+    alarm_tx_queue_t       queues[ALARM_TX_CLASS_COUNT];
+    int32_t                deficit[ALARM_TX_CLASS_COUNT];           /**< Deficit round robin byte credit. */
+    uint8_t                drr_class;                               /**< Weighted class currently being served. */
+    bool                   drr_credited;                            /**< True once @p drr_class got its quantum this round. */
+    uint8_t                in_progress;                             /**< Class of a partially sent frame, or ALARM_TX_CLASS_COUNT. */
+    nrf_atomic_u32_t       drain_requests;
+    nrf_atomic_u32_t       push_requests;                           /**< @ref alarm_tx_sched_push calls not yet served by a drain pass. */
+    alarm_tx_class_stats_t stats[ALARM_TX_CLASS_COUNT];
+} alarm_tx_sched_t;
+
+/**@brief   Macro for defining a scheduler instance with its frame storage.
+ *
+ * @param   _name           Name of the instance.
+ * @param   _frame_max_len  Largest frame that can be queued.
+ * @param   _queue_len      Frames per class queue.
+ * @hideinitializer
+ */
+#define ALARM_TX_SCHED_DEF(_name, _frame_max_len, _queue_len)                                      \
+static uint32_t CONCAT_2(_name, _slots)[(ALARM_TX_CLASS_COUNT * (_queue_len) *                     \
+                                        ALARM_TX_SLOT_SIZE(_frame_max_len)) / sizeof(uint32_t)];   \
+static alarm_tx_sched_t _name =                                                                    \
+{                                                                                                  \
+    .p_slots       = (uint8_t *)CONCAT_2(_name, _slots),                                           \
+    .frame_max_len = (_frame_max_len),                                                             \
+    .queue_len     = (_queue_len)                                                                  \
+}
+
+/**@brief Function for initializing a scheduler instance.
+ *
+ * @param[in]   p_sched     Instance defined with @ref ALARM_TX_SCHED_DEF.
+ * @param[in]   sink        Link the frames are drained to.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+ret_code_t alarm_tx_sched_init(alarm_tx_sched_t * p_sched, alarm_tx_sink_t sink);
+
+/**@brief Function for queueing a frame and draining the queues.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH if the frame is too large, or
+ *              NRF_ERROR_NO_MEM if the class queue is full (the frame is dropped and counted).
+ */
+ret_code_t alarm_tx_sched_put(alarm_tx_sched_t * p_sched,
+                              alarm_tx_class_t   tx_class,
+                              uint8_t const    * p_data,
+                              uint16_t           length);
+
+/**@brief Function for sending queued frames until the queues are empty or the sink is full.
+ *
+ * @details Call when the link frees space (TX complete). Reentrant calls from other interrupt
+ *          levels are folded into the drain already in progress.
+ */
+void alarm_tx_sched_drain(alarm_tx_sched_t * p_sched);
+
+/**@brief Function for draining the queues with the sink told to hand frames to the link now.
+ *
+ * @details A push that lands while another drain is in progress is served by that drain's next
+ *          pass, so it is never lost to the context the drain started in. Safe to call from any
+ *          interrupt level.
+ */
+void alarm_tx_sched_push(alarm_tx_sched_t * p_sched);
+
+/**@brief Function for discarding every queued frame, e.g. when the link goes down. */
+void alarm_tx_sched_flush(alarm_tx_sched_t * p_sched);
+
+/**@brief Function for getting the number of frames a class queue can still take. */
+uint8_t alarm_tx_sched_free_get(alarm_tx_sched_t const * p_sched, alarm_tx_class_t tx_class);
+
+/**@brief Function for getting the counters of one class. */
+alarm_tx_class_stats_t const * alarm_tx_sched_stats_get(alarm_tx_sched_t const * p_sched,
+                                                        alarm_tx_class_t         tx_class);
+
+#endif // ALARM_TX_SCHED_H__
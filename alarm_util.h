@@ -0,0 +1,52 @@
+#ifndef ALARM_UTIL_H__
+#define ALARM_UTIL_H__
+
+#include <stdint.h>
+#include "sdk_common.h"
+#include "app_timer.h"
+#include "nrf_atomic.h"
+
+/**@file
+ *
+ * @details Helpers shared by the Alarm modules.
+ */
+
+#define ALARM_TICKS_PER_S               (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1))   /**< app_timer ticks per second. */
+
+/**@brief   Macro for converting app_timer ticks to milliseconds. */
+#define ALARM_TICKS_TO_MS(_ticks)                                                                  \
+    ((uint32_t)(((uint64_t)(_ticks) * 1000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) / APP_TIMER_CLOCK_FREQ))
+
+/**@brief   Macro for converting app_timer ticks to microseconds. */
+#define ALARM_TICKS_TO_US(_ticks)                                                                  \
+    ((uint32_t)(((uint64_t)(_ticks) * 1000000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) / APP_TIMER_CLOCK_FREQ))
+
+/**@brief   One pass of a drain, see @ref alarm_drain_run. */
+typedef void (*alarm_drain_pass_t)(void * p_context);
+
+/**@brief Function for running a drain that may be requested from several interrupt levels.
+ *
+ * @details Only the first caller drains; nested calls from higher interrupt levels just bump the
+ *          request count so the active drain makes another pass.
+ *
+ * @param[in]   p_requests  Request counter of the drained object, zero while idle.
+ * @param[in]   pass        Drains what it can once.
+ * @param[in]   p_context   Passed to @p pass.
+ */
+static __INLINE void alarm_drain_run(nrf_atomic_u32_t * p_requests, alarm_drain_pass_t pass, void * p_context)
+{
+    uint32_t pending;
+
+    if (nrf_atomic_u32_fetch_add(p_requests, 1) != 0)
+    {
+        return;
+    }
+
+    do
+    {
+        pending = *p_requests;
+        pass(p_context);
+    } while (nrf_atomic_u32_sub(p_requests, pending) != 0);
+}
+
+#endif // ALARM_UTIL_H__
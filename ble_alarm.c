@@ -8,12 +8,19 @@
 #include "app_uart.h"
 #include "nrf_uart.h"
 #include "ble_link_ctx_manager.h"
+#include "alarm_cycles.h"
+#include "crc16.h"
+#include "app_timer.h"
+#include "alarm_util.h"
 
 uint8_t is_main_data = 1;
 
+STATIC_ASSERT(sizeof(ble_alarm_status_t) == 12);
+STATIC_ASSERT(sizeof(ble_alarm_layout_t) == 4);
+
 uint32_t ble_alarm_init(ble_alarm_t * p_alarm, const ble_alarm_init_t * p_alarm_init)
 {
-    if (p_alarm == NULL || p_alarm_init == NULL)
+    if (p_alarm == NULL || p_alarm_init == NULL || p_alarm_init->clock == NULL)
     {
         return NRF_ERROR_NULL;
     }
@@ -24,6 +31,15 @@ uint32_t ble_alarm_init(ble_alarm_t * p_alarm, const ble_alarm_init_t * p_alarm_
 		// Initialize service structure
 		p_alarm->conn_handle               = BLE_CONN_HANDLE_INVALID;
 		p_alarm->evt_handler               = p_alarm_init->evt_handler;
+		memset(&p_alarm->status, 0, sizeof(p_alarm->status));
+		p_alarm->read_cycles_max           = 0;
+		p_alarm->write_cycles_max          = 0;
+		p_alarm->write_cycles_sum          = 0;
+		p_alarm->write_count               = 0;
+		memcpy(p_alarm->rx_budget, p_alarm_init->rx_budget, sizeof(p_alarm->rx_budget));
+		memset(p_alarm->rx_rejected, 0, sizeof(p_alarm->rx_rejected));
+		p_alarm->clock                     = p_alarm_init->clock;
+		ALARM_CYCLES_ENABLE();
 		
 		// Add Custom Service UUID
 		ble_uuid128_t base_uuid = {CUSTOM_SERVICE_UUID_BASE};
@@ -43,124 +59,329 @@ uint32_t ble_alarm_init(ble_alarm_t * p_alarm, const ble_alarm_init_t * p_alarm_
 }
 
 
-/**@brief Function for adding the Custom Value characteristic.
+/**@brief   Attribute table entry for a characteristic that is not part of the service. */
+#define ATTR_NONE               0xFF
+#define ATTR_CCCD               0x80                                /**< Set on the CCCD entry of a characteristic. */
+#define ATTR_CHAR_MASK          0x7F
+
+STATIC_ASSERT(BLE_ALARM_CHAR_COUNT <= 32);                          // Bits of the client notify_mask.
+
+/**@brief   Handler of the writes, and read or write authorization requests, of one characteristic.
  *
- * @param[in]   p_cus        Custom Service structure.
- * @param[in]   p_cus_init   Information needed to initialize the service.
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_ble_evt   BLE_GATTS_EVT_WRITE or BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST.
+ * @param[in]   p_evt       Service event with p_alarm, conn_handle and p_link_ctx filled in.
+ */
+typedef void (*char_handler_t)(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt);
+
+/**@brief   Compile-time description of one characteristic, generated from @ref BLE_ALARM_CHAR_LIST. */
+typedef struct
+{
+    uint16_t       uuid;
+    uint8_t        props;                                           /**< BLE_ALARM_PROP_* bits. */
+    uint8_t        auth;                                            /**< BLE_ALARM_AUTH_* bits. */
+    uint16_t       value_offset;                                    /**< Offset of a user located value in ble_alarm_t, or BLE_ALARM_VALUE_OFFSET_NONE. */
+    uint16_t       init_len;
+    uint16_t       max_len;
+    char_handler_t handler;
+} char_desc_t;
+
+static void on_tx_cccd_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt);
+static void on_rx_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt);
+static void on_stats_read(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt);
+static void on_config_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt);
+static void on_status_read(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt);
+
+#define CHAR_DESC(_name, _uuid, _props, _auth, _value, _init_len, _max_len, _handler)                   \
+    [BLE_ALARM_CHAR_ ## _name] =                                                                        \
+    {                                                                                                   \
+        .uuid         = (_uuid),                                                                        \
+        .props        = (_props),                                                                       \
+        .auth         = (_auth),                                                                        \
+        .value_offset = (_value),                                                                       \
+        .init_len     = (_init_len),                                                                    \
+        .max_len      = (_max_len),                                                                     \
+        .handler      = (_handler),                                                                     \
+    },
+
+static char_desc_t const m_chars[BLE_ALARM_CHAR_COUNT] =
+{
+    BLE_ALARM_CHAR_LIST(CHAR_DESC)
+};
+
+
+/**@brief Function for recording an attribute handle in the dispatch table.
  *
- * @return      NRF_SUCCESS on success, otherwise an error code.
+ * @return      NRF_SUCCESS, or NRF_ERROR_INTERNAL if the SoftDevice placed the attribute outside
+ *              the range counted by @ref BLE_ALARM_ATTR_COUNT.
  */
-static uint32_t custom_value_char_add(ble_alarm_t * p_alarm, const ble_alarm_init_t * p_alarm_init)
+static uint32_t attr_lut_set(ble_alarm_t * p_alarm, uint16_t handle, uint8_t entry)
+{
+    uint16_t index = handle - p_alarm->service_handle;
+
+    if ((index == 0) || (index >= BLE_ALARM_ATTR_COUNT))
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+
+    p_alarm->attr_lut[index] = entry;
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for adding one characteristic from its description.
+ *
+ * @details Read and write permissions follow the properties: an attribute without the property
+ *          is not accessible, whatever the security mode in the init structure.
+ */
+static uint32_t char_add(ble_alarm_t            * p_alarm,
+                         const ble_alarm_init_t * p_alarm_init,
+                         uint8_t                  index)
 {
     uint32_t            err_code;
+    char_desc_t const * p_desc = &m_chars[index];
     ble_gatts_char_md_t char_md;
     ble_gatts_attr_md_t cccd_md;
     ble_gatts_attr_t    attr_char_value;
     ble_uuid_t          ble_uuid;
     ble_gatts_attr_md_t attr_md;
-	
-		//Add the TX Characteristic
-		memset(&char_md, 0, sizeof(char_md));
-
-    char_md.char_props.read   = 1;
-    char_md.char_props.write  = 0;
-    char_md.char_props.notify = 0; 
-    char_md.p_char_user_desc  = NULL;
-    char_md.p_char_pf         = NULL;
-    char_md.p_user_desc_md    = NULL;
-    char_md.p_cccd_md         = NULL; 
-    char_md.p_sccd_md         = NULL;
-	
-		memset(&attr_md, 0, sizeof(attr_md));
-
-    attr_md.read_perm 	 = p_alarm_init->custom_value_char_attr_md.read_perm;
-    attr_md.write_perm 	 = p_alarm_init->custom_value_char_attr_md.write_perm;
-    attr_md.vloc       	 = BLE_GATTS_VLOC_STACK;
-    attr_md.rd_auth      = 0;
-    attr_md.wr_auth      = 0;
-    attr_md.vlen         = 0;
-		
-		ble_uuid.type = p_alarm->uuid_type;
-    ble_uuid.uuid = ALARM_TX_VALUE_CHAR_UUID;
-		
-		memset(&attr_char_value, 0, sizeof(attr_char_value));
+
+    memset(&char_md, 0, sizeof(char_md));
+
+    char_md.char_props.read   = ((p_desc->props & BLE_ALARM_PROP_READ) != 0);
+    char_md.char_props.write  = ((p_desc->props & BLE_ALARM_PROP_WRITE) != 0);
+    char_md.char_props.notify = ((p_desc->props & BLE_ALARM_PROP_NOTIFY) != 0);
+
+    if (char_md.char_props.notify)
+    {
+        memset(&cccd_md, 0, sizeof(cccd_md));
+
+        //  Read  operation on Cccd should be possible without authentication.
+        BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+        BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+        cccd_md.vloc      = BLE_GATTS_VLOC_STACK;
+        char_md.p_cccd_md = &cccd_md;
+    }
+
+    memset(&attr_md, 0, sizeof(attr_md));
+
+    if (char_md.char_props.read)
+    {
+        attr_md.read_perm = p_alarm_init->custom_value_char_attr_md.read_perm;
+    }
+    else
+    {
+        BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+    }
+
+    if (char_md.char_props.write)
+    {
+        attr_md.write_perm = p_alarm_init->custom_value_char_attr_md.write_perm;
+    }
+    else
+    {
+        BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+    }
+
+    attr_md.vloc    = (p_desc->value_offset == BLE_ALARM_VALUE_OFFSET_NONE) ? BLE_GATTS_VLOC_STACK
+                                                                            : BLE_GATTS_VLOC_USER;
+    attr_md.rd_auth = ((p_desc->auth & BLE_ALARM_AUTH_READ) != 0);
+    attr_md.wr_auth = ((p_desc->auth & BLE_ALARM_AUTH_WRITE) != 0);
+    attr_md.vlen    = (p_desc->init_len != p_desc->max_len);
+
+    ble_uuid.type = p_alarm->uuid_type;
+    ble_uuid.uuid = p_desc->uuid;
+
+    memset(&attr_char_value, 0, sizeof(attr_char_value));
 
     attr_char_value.p_uuid    = &ble_uuid;
     attr_char_value.p_attr_md = &attr_md;
-    attr_char_value.init_len  = sizeof(uint8_t);
+    attr_char_value.init_len  = p_desc->init_len;
     attr_char_value.init_offs = 0;
-		attr_char_value.max_len   = BLE_GATTS_FIX_ATTR_LEN_MAX;
-//    attr_char_value.max_len   = sizeof(uint8_t);
-		
-		memset(&cccd_md, 0, sizeof(cccd_md));
+    attr_char_value.max_len   = p_desc->max_len;
 
-    //  Read  operation on Cccd should be possible without authentication.
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
-//    cccd_md.vloc       = BLE_GATTS_VLOC_STACK;
+    if (attr_md.vloc == BLE_GATTS_VLOC_USER)
+    {
+        attr_char_value.p_value = (uint8_t *)p_alarm + p_desc->value_offset;
+    }
 
-//		char_md.char_props.notify = 1;  
-//    char_md.p_cccd_md         = &cccd_md; 
-		
-		err_code = sd_ble_gatts_characteristic_add(p_alarm->service_handle, &char_md,
+    err_code = sd_ble_gatts_characteristic_add(p_alarm->service_handle, &char_md,
                                                &attr_char_value,
-                                               &p_alarm->tx_value_handles);
+                                               &p_alarm->char_handles[index]);
     VERIFY_SUCCESS(err_code);
-		
-		//Add the RX Characteristic 
-		memset(&char_md, 0, sizeof(char_md));
-
-    char_md.char_props.read   = 0;
-    char_md.char_props.write  = 1;
-    char_md.char_props.notify = 0; 
-    char_md.p_char_user_desc  = NULL;
-    char_md.p_char_pf         = NULL;
-    char_md.p_user_desc_md    = NULL;
-    char_md.p_cccd_md         = NULL; 
-    char_md.p_sccd_md         = NULL;
-	
-		memset(&attr_md, 0, sizeof(attr_md));
-
-    attr_md.read_perm  		= p_alarm_init->custom_value_char_attr_md.read_perm;
-    attr_md.write_perm 	  = p_alarm_init->custom_value_char_attr_md.write_perm;
-    attr_md.vloc       		= BLE_GATTS_VLOC_STACK;
-    attr_md.rd_auth    		= 0;
-    attr_md.wr_auth    		= 0;
-    attr_md.vlen       		= 0;
-		
-		ble_uuid.type = p_alarm->uuid_type;
-    ble_uuid.uuid = ALARM_RX_VALUE_CHAR_UUID;
-		
-		memset(&attr_char_value, 0, sizeof(attr_char_value));
 
-    attr_char_value.p_uuid    = &ble_uuid;
-    attr_char_value.p_attr_md = &attr_md;
-    attr_char_value.init_len  = sizeof(uint8_t);
-    attr_char_value.init_offs = 0;
-		attr_char_value.max_len   = BLE_GATTS_FIX_ATTR_LEN_MAX;
-//    attr_char_value.max_len   = sizeof(uint8_t);
-		
-		err_code = sd_ble_gatts_characteristic_add(p_alarm->service_handle, &char_md,
-                                               &attr_char_value,
-                                               &p_alarm->rx_value_handles);
-		return err_code;
+    err_code = attr_lut_set(p_alarm, p_alarm->char_handles[index].value_handle, index);
+    VERIFY_SUCCESS(err_code);
+
+    if (char_md.char_props.notify)
+    {
+        err_code = attr_lut_set(p_alarm, p_alarm->char_handles[index].cccd_handle, index | ATTR_CCCD);
+    }
+
+    return err_code;
+}
+
+
+/**@brief Function for computing the CRC of the registered layout. */
+static uint16_t layout_crc(ble_alarm_t const * p_alarm)
+{
+    uint16_t crc = crc16_compute((uint8_t const *)&p_alarm->service_handle, sizeof(p_alarm->service_handle), NULL);
+
+    for (uint8_t i = 0; i < BLE_ALARM_CHAR_COUNT; i++)
+    {
+        uint8_t  entry[8];
+        uint16_t len = 0;
+
+        len += uint16_encode(m_chars[i].uuid, &entry[len]);
+        entry[len++] = m_chars[i].props;
+        entry[len++] = m_chars[i].auth;
+        len += uint16_encode(p_alarm->char_handles[i].value_handle, &entry[len]);
+        len += uint16_encode(p_alarm->char_handles[i].cccd_handle, &entry[len]);
+
+        crc = crc16_compute(entry, len, &crc);
+    }
+
+    return crc;
+}
+
+
+/**@brief Function for adding the characteristics of @ref BLE_ALARM_CHAR_LIST and building the
+ *        handle dispatch table.
+ *
+ * @details Every handle is checked against its position in the list (declaration, value, then
+ *          CCCD), so a layout change can only come from editing the list and never goes unnoticed.
+ *
+ * @param[in]   p_cus        Custom Service structure.
+ * @param[in]   p_cus_init   Information needed to initialize the service.
+ *
+ * @return      NRF_SUCCESS on success, NRF_ERROR_INTERNAL if a handle is not where the list puts
+ *              it, otherwise an error code.
+ */
+static uint32_t custom_value_char_add(ble_alarm_t * p_alarm, const ble_alarm_init_t * p_alarm_init)
+{
+    uint32_t err_code;
+    uint16_t decl_handle = p_alarm->service_handle + 1;
+
+    memset(p_alarm->attr_lut, ATTR_NONE, sizeof(p_alarm->attr_lut));
+
+    for (uint8_t i = 0; i < BLE_ALARM_CHAR_COUNT; i++)
+    {
+        bool notify = ((m_chars[i].props & BLE_ALARM_PROP_NOTIFY) != 0);
+
+        err_code = char_add(p_alarm, p_alarm_init, i);
+        VERIFY_SUCCESS(err_code);
+
+        if ((p_alarm->char_handles[i].value_handle != (decl_handle + 1)) ||
+            (notify && (p_alarm->char_handles[i].cccd_handle != (decl_handle + 2))))
+        {
+            return NRF_ERROR_INTERNAL;
+        }
+
+        decl_handle += notify ? 3 : 2;
+    }
+
+    p_alarm->layout.version = BLE_ALARM_LAYOUT_VERSION;
+    p_alarm->layout.crc     = layout_crc(p_alarm);
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for looking up the characteristic an attribute handle belongs to.
+ *
+ * @return      Dispatch table entry, or ATTR_NONE for declarations and foreign handles.
+ */
+static uint8_t attr_lookup(ble_alarm_t const * p_alarm, uint16_t handle)
+{
+    uint16_t index = handle - p_alarm->service_handle;            // Handles below the service wrap around.
+
+    if (index >= BLE_ALARM_ATTR_COUNT)
+    {
+        return ATTR_NONE;
+    }
+
+    return p_alarm->attr_lut[index];
 }
 
 
 /**@brief Function for handling the Connect event.
+ *
+ * @details The Peer Manager restores the CCCDs of a bonded peer before this runs, so the
+ *          notification mask starts from the stored values rather than from zero, as in ble_nus.
+ *          A peer that already had TX notifications on gets @ref BLE_ALARM_EVT_NOTIFICATION_ENABLED
+ *          right after @ref BLE_ALARM_EVT_CONNECTED, as if it had written the CCCD again.
  *
  * @param[in]   p_cus       Custom Service structure.
  * @param[in]   p_ble_evt   Event received from the BLE stack.
  */
 static void on_connect(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt)
 {	
+    ret_code_t                   err_code;
+    ble_alarm_client_context_t * p_client;
+    ble_alarm_evt_t              evt;
+
     p_alarm->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
-	
-		ble_alarm_evt_t evt;
 
-    evt.evt_type = BLE_ALARM_EVT_CONNECTED;
+    err_code = blcm_link_ctx_get(p_alarm->p_link_ctx_storage, p_alarm->conn_handle, (void *) &p_client);
+    if (err_code != NRF_SUCCESS)
+    {
+        p_client = NULL;
+    }
+
+    if (p_client != NULL)
+    {
+        memset(p_client, 0, sizeof(*p_client));
+        for (uint8_t i = 0; i < BLE_ALARM_RX_CLASS_COUNT; i++)
+        {
+            p_client->rx_buckets[i].tokens      = (uint32_t)p_alarm->rx_budget[i].burst * ALARM_TICKS_PER_S;
+            p_client->rx_buckets[i].refilled_at = app_timer_cnt_get();
+            p_client->rx_buckets[i].refilled_s  = p_alarm->clock();
+        }
+
+        for (uint8_t i = 0; i < BLE_ALARM_CHAR_COUNT; i++)
+        {
+            uint8_t           cccd_value[BLE_CCCD_VALUE_LEN];
+            ble_gatts_value_t gatts_val;
+
+            if ((m_chars[i].props & BLE_ALARM_PROP_NOTIFY) == 0)
+            {
+                continue;
+            }
+
+            memset(&gatts_val, 0, sizeof(gatts_val));
+            gatts_val.p_value = cccd_value;
+            gatts_val.len     = sizeof(cccd_value);
+            gatts_val.offset  = 0;
+
+            err_code = sd_ble_gatts_value_get(p_alarm->conn_handle,
+                                              p_alarm->char_handles[i].cccd_handle,
+                                              &gatts_val);
+            if ((err_code == NRF_SUCCESS) && ble_srv_is_notification_enabled(cccd_value))
+            {
+                p_client->notify_mask |= (1UL << i);
+            }
+        }
+    }
+
+    if (p_alarm->evt_handler == NULL)
+    {
+        return;
+    }
+
+    memset(&evt, 0, sizeof(evt));
+    evt.evt_type    = BLE_ALARM_EVT_CONNECTED;
+    evt.p_alarm     = p_alarm;
+    evt.conn_handle = p_alarm->conn_handle;
+    evt.p_link_ctx  = p_client;
 
     p_alarm->evt_handler(p_alarm, &evt);
+
+    if ((p_client != NULL) && BLE_ALARM_NOTIFY_ENABLED(p_client, TX))
+    {
+        evt.evt_type = BLE_ALARM_EVT_NOTIFICATION_ENABLED;
+        p_alarm->evt_handler(p_alarm, &evt);
+    }
 }
 
 /**@brief Function for handling the Disconnect event.
@@ -174,85 +395,386 @@ static void on_disconnect(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt)
     p_alarm->conn_handle = BLE_CONN_HANDLE_INVALID;
 }
 
+/**@brief Function for preparing the service event passed to a characteristic handler.
+ *
+ * @return      Link context of the connection, or NULL if it could not be fetched.
+ */
+static ble_alarm_client_context_t * evt_prepare(ble_alarm_t     * p_alarm,
+                                                ble_evt_t const * p_ble_evt,
+                                                ble_alarm_evt_t * p_evt)
+{
+    ret_code_t                   err_code;
+    ble_alarm_client_context_t * p_client = NULL;
+
+    err_code = blcm_link_ctx_get(p_alarm->p_link_ctx_storage,
+                                 p_ble_evt->evt.gatts_evt.conn_handle,
+                                 (void *) &p_client);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Link context for 0x%02X connection handle could not be fetched.",
+                      p_ble_evt->evt.gatts_evt.conn_handle);
+        p_client = NULL;
+    }
+
+    memset(p_evt, 0, sizeof(ble_alarm_evt_t));
+    p_evt->p_alarm     = p_alarm;
+    p_evt->conn_handle = p_ble_evt->evt.gatts_evt.conn_handle;
+    p_evt->p_link_ctx  = p_client;
+
+    return p_client;
+}
+
+/**@brief Function for recording the dispatch cost of one write. */
+static void write_cycles_record(ble_alarm_t * p_alarm, uint32_t start)
+{
+    uint32_t cycles = ALARM_CYCLES_NOW() - start;
+
+    p_alarm->write_cycles_sum += cycles;
+    p_alarm->write_cycles_max  = MAX(p_alarm->write_cycles_max, cycles);
+    p_alarm->write_count++;
+}
+
 /**@brief Function for handling the Write event.
+ *
+ * @details The written handle is mapped to its characteristic through the dispatch table built
+ *          at init. Writes to other services, declarations and malformed CCCD writes are dropped
+ *          before the link context lookup and the event setup, which only characteristics of this
+ *          service pay for. CCCD writes update the notification mask of the link before the
+ *          handler of the characteristic, if any, is called. The recorded cycles cover the
+ *          dispatch only, not the handler.
  *
  * @param[in]   p_cus       Custom Service structure.
  * @param[in]   p_ble_evt   Event received from the BLE stack.
  */
 static void on_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt)
 {
-		ret_code_t                    err_code;
     ble_alarm_evt_t               evt;
     ble_alarm_client_context_t  * p_client;
     ble_gatts_evt_write_t const * p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
-	
-		err_code = blcm_link_ctx_get(p_alarm->p_link_ctx_storage,
-                                 p_ble_evt->evt.gatts_evt.conn_handle,
-                                 (void *) &p_client);
-	
-		if (err_code != NRF_SUCCESS)
+    char_handler_t                handler;
+    uint32_t                      start = ALARM_CYCLES_NOW();
+    uint8_t                       attr;
+    uint8_t                       index;
+
+    attr = attr_lookup(p_alarm, p_evt_write->handle);
+    if (attr == ATTR_NONE)
     {
-        NRF_LOG_ERROR("Link context for 0x%02X connection handle could not be fetched.",
-                      p_ble_evt->evt.gatts_evt.conn_handle);
+        write_cycles_record(p_alarm, start);
+        return;
     }
 
-    memset(&evt, 0, sizeof(ble_alarm_evt_t));
-    evt.p_alarm     = p_alarm;
-    evt.conn_handle = p_ble_evt->evt.gatts_evt.conn_handle;
-    evt.p_link_ctx  = p_client;
-		
-		 // Check if the Custom value CCCD is written to and that the value is the appropriate length, i.e 2 bytes.
-    if ((p_evt_write->handle == p_alarm->tx_value_handles.cccd_handle)
-        && (p_evt_write->len == 2))
+    index   = attr & ATTR_CHAR_MASK;
+    handler = (p_alarm->evt_handler != NULL) ? m_chars[index].handler : NULL;
+
+    if ((attr & ATTR_CCCD) != 0)
     {
-        // CCCD written, call application event handler
-        if (p_alarm->evt_handler != NULL)
+        if (p_evt_write->len != 2)
         {
-            ble_alarm_evt_t evt;
+            write_cycles_record(p_alarm, start);
+            return;
+        }
+    }
+    else if (handler == NULL)
+    {
+        write_cycles_record(p_alarm, start);
+        return;
+    }
 
-            if (ble_srv_is_notification_enabled(p_evt_write->data))
-            {
-                evt.evt_type = BLE_ALARM_EVT_NOTIFICATION_ENABLED;
-            }
-            else
-            {
-                evt.evt_type = BLE_ALARM_EVT_NOTIFICATION_DISABLED;
-            }
-            // Call the application event handler.
-            p_alarm->evt_handler(p_alarm, &evt);
+    p_client = evt_prepare(p_alarm, p_ble_evt, &evt);
+
+    if (((attr & ATTR_CCCD) != 0) && (p_client != NULL))
+    {
+        if (ble_srv_is_notification_enabled(p_evt_write->data))
+        {
+            p_client->notify_mask |= (1UL << index);
+        }
+        else
+        {
+            p_client->notify_mask &= ~(1UL << index);
         }
     }
-		
-		else if ((p_evt_write->handle == p_alarm->rx_value_handles.value_handle) &&
-             (p_alarm->evt_handler != NULL))
-    {	
-			if(is_main_data == 1)
-			{
-				is_main_data = 0;
-				if(p_evt_write->data[0] == 's')
-				{	
-					evt.evt_type                 = BLE_ALARM_EVT_ALARM;
-					evt.params.alarm_data.p_data = p_evt_write->data;
-					evt.params.alarm_data.length = p_evt_write->len;
-					p_alarm->evt_handler(p_alarm, &evt);
-				}
-				else
-				{
-					evt.evt_type                 = BLE_ALARM_EVT;
-					evt.params.alarm_data.p_data = p_evt_write->data;
-					evt.params.alarm_data.length = p_evt_write->len;
-					p_alarm->evt_handler(p_alarm, &evt);
-				}
+
+    write_cycles_record(p_alarm, start);
+
+    if (handler != NULL)
+    {
+        handler(p_alarm, p_ble_evt, &evt);
+    }
+}
+
+/**@brief Function for handling a CCCD write of the TX characteristic. */
+static void on_tx_cccd_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt)
+{
+    ble_gatts_evt_write_t const * p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+
+    if (ble_srv_is_notification_enabled(p_evt_write->data))
+    {
+        p_evt->evt_type = BLE_ALARM_EVT_NOTIFICATION_ENABLED;
+    }
+    else
+    {
+        p_evt->evt_type = BLE_ALARM_EVT_NOTIFICATION_DISABLED;
+    }
+    // Call the application event handler.
+    p_alarm->evt_handler(p_alarm, p_evt);
+}
+
+/**@brief Function for taking the cost of one write from a token bucket.
+ *
+ * @details The bucket is refilled for the time since its last refill first. Tokens are kept in
+ *          bytes times ticks per second, so a refill adds exactly rate tokens per tick. The
+ *          app_timer counter wraps every 512 s, so after @ref BLE_ALARM_RX_TICK_SPAN_S of idle
+ *          time the refill is taken from the uptime clock instead, to the second.
+ *
+ * @return      True if the write fits the budget.
+ */
+static bool rx_budget_take(ble_alarm_rx_budget_t const * p_budget,
+                           ble_alarm_rx_bucket_t       * p_bucket,
+                           uint16_t                      length,
+                           uint32_t                      now_s)
+{
+    uint32_t now   = app_timer_cnt_get();
+    uint32_t depth = (uint32_t)p_budget->burst * ALARM_TICKS_PER_S;
+    uint32_t cost  = MIN(length + BLE_ALARM_RX_WRITE_OVERHEAD, p_budget->burst) * ALARM_TICKS_PER_S;
+    uint64_t elapsed;
+    uint64_t tokens;
+
+    if (p_budget->rate == BLE_ALARM_RX_RATE_UNLIMITED)
+    {
+        return true;
+    }
+
+    if ((now_s - p_bucket->refilled_s) >= BLE_ALARM_RX_TICK_SPAN_S)
+    {
+        elapsed = (uint64_t)(now_s - p_bucket->refilled_s) * ALARM_TICKS_PER_S;
+    }
+    else
+    {
+        elapsed = app_timer_cnt_diff_compute(now, p_bucket->refilled_at);
+    }
+
+    tokens = p_bucket->tokens + elapsed * p_budget->rate;
+
+    p_bucket->tokens      = (uint32_t)MIN(tokens, depth);
+    p_bucket->refilled_at = now;
+    p_bucket->refilled_s  = now_s;
+
+    if (p_bucket->tokens < cost)
+    {
+        return false;
+    }
+
+    p_bucket->tokens -= cost;
+    return true;
+}
+
+/**@brief Function for handling a write of the RX characteristic.
+ *
+ * @details A write over the budget of its class on this link is dropped here, before anything
+ *          is copied out of it; the application only gets @ref BLE_ALARM_EVT_RX_REJECTED so it
+ *          can account for it. Only the first write of a pair can be an alarm; a dropped write
+ *          does not advance the pairing. An empty write is bulk.
+ */
+static void on_rx_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt)
+{
+    ble_gatts_evt_write_t const * p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+    ble_alarm_client_context_t  * p_client    = p_evt->p_link_ctx;
+    bool                          alarm_cmd   = (p_evt_write->len != 0) && (p_evt_write->data[0] == 's');
+    ble_alarm_rx_class_t          rx_class;
+
+    rx_class = ((is_main_data == 1) && alarm_cmd) ? BLE_ALARM_RX_CLASS_ALARM
+                                                   : BLE_ALARM_RX_CLASS_BULK;
+
+    if ((p_client != NULL) &&
+        !rx_budget_take(&p_alarm->rx_budget[rx_class], &p_client->rx_buckets[rx_class],
+                        p_evt_write->len, p_alarm->clock()))
+    {
+        p_client->rx_rejected[rx_class]++;
+        p_alarm->rx_rejected[rx_class]++;
+        p_evt->evt_type = BLE_ALARM_EVT_RX_REJECTED;
+        p_alarm->evt_handler(p_alarm, p_evt);
+        return;
+    }
+
+    p_evt->params.alarm_data.p_data = p_evt_write->data;
+    p_evt->params.alarm_data.length = p_evt_write->len;
+
+		if(is_main_data == 1)
+		{
+			is_main_data = 0;
+			if(alarm_cmd)
+			{	
+				p_evt->evt_type = BLE_ALARM_EVT_ALARM;
 			}
-			else if(is_main_data == 0)
+			else
 			{
-				is_main_data = 1;
-				evt.evt_type                 = BLE_ALARM_EVT;
-				evt.params.alarm_data.p_data = p_evt_write->data;
-				evt.params.alarm_data.length = p_evt_write->len;
-				p_alarm->evt_handler(p_alarm, &evt);
+				p_evt->evt_type = BLE_ALARM_EVT;
 			}
+		}
+		else
+		{
+			is_main_data = 1;
+			p_evt->evt_type = BLE_ALARM_EVT;
+		}
+		p_alarm->evt_handler(p_alarm, p_evt);
+}
+
+/**@brief Function for answering a read authorization request of the Status or Stats characteristic.
+ *
+ * @details The application refreshes the value in its event handler and the request is answered
+ *          in the same call, so the response time is bounded by that handler. A long read arrives
+ *          as one request per offset; only the request at offset 0 takes a snapshot, so every
+ *          chunk of one read comes from the same value.
+ *
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_ble_evt   Event received from the BLE stack.
+ * @param[in]   p_evt       Event to raise, with evt_type set.
+ * @param[in]   p_buf       Buffer the fresh value is encoded into, or NULL if the value is read in
+ *                          place from application memory.
+ * @param[in]   buf_size    Size of @p p_buf.
+ */
+static void read_authorize_reply(ble_alarm_t     * p_alarm,
+                                 ble_evt_t const * p_ble_evt,
+                                 ble_alarm_evt_t * p_evt,
+                                 uint8_t         * p_buf,
+                                 uint16_t          buf_size)
+{
+    ble_gatts_rw_authorize_reply_params_t reply;
+    uint32_t                              start = ALARM_CYCLES_NOW();
+    ret_code_t                            err_code;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.type                    = BLE_GATTS_AUTHORIZE_TYPE_READ;
+    reply.params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+
+    if ((p_ble_evt->evt.gatts_evt.params.authorize_request.request.read.offset == 0) &&
+        (p_alarm->evt_handler != NULL))
+    {
+        p_evt->params.read.p_data = p_buf;
+        p_evt->params.read.length = buf_size;
+        p_alarm->evt_handler(p_alarm, p_evt);
+
+        if (p_buf != NULL)
+        {
+            reply.params.read.update = 1;
+            reply.params.read.offset = 0;
+            reply.params.read.p_data = p_buf;
+            reply.params.read.len    = MIN(p_evt->params.read.length, buf_size);
+        }
     }
+
+    err_code = sd_ble_gatts_rw_authorize_reply(p_ble_evt->evt.gatts_evt.conn_handle, &reply);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Read authorization reply failed: 0x%x.", err_code);
+    }
+
+    p_alarm->read_cycles_max = MAX(p_alarm->read_cycles_max, ALARM_CYCLES_NOW() - start);
+}
+
+/**@brief Function for handling a read of the Stats characteristic. */
+static void on_stats_read(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt)
+{
+    uint8_t value[BLE_ALARM_STATS_MAX_LEN];
+
+    p_evt->evt_type = BLE_ALARM_EVT_STATS_READ;
+    read_authorize_reply(p_alarm, p_ble_evt, p_evt, value, sizeof(value));
+}
+
+/**@brief Function for handling a read of the Status characteristic. */
+static void on_status_read(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt)
+{
+    // The value lives in p_alarm->status, so the reply needs no data (update = 0).
+    p_evt->evt_type = BLE_ALARM_EVT_STATUS_READ;
+    read_authorize_reply(p_alarm, p_ble_evt, p_evt, NULL, 0);
+}
+
+/**@brief Function for handling a single Write Request to the Config characteristic.
+ *
+ * @details Prepared and executed writes are answered by nrf_ble_qwr, which validates the
+ *          reassembled blob through its own callback. A blob that fits one Write Request takes
+ *          this path instead and is validated and committed before the reply.
+ *
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_ble_evt   Event received from the BLE stack.
+ * @param[in]   p_evt       Event to raise.
+ */
+static void on_config_write(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt, ble_alarm_evt_t * p_evt)
+{
+    ble_gatts_evt_write_t const         * p_write = &p_ble_evt->evt.gatts_evt.params.authorize_request.request.write;
+    ble_gatts_rw_authorize_reply_params_t reply;
+    ret_code_t                            err_code;
+
+    if (p_write->op != BLE_GATTS_OP_WRITE_REQ)
+    {
+        return;
+    }
+
+    p_evt->evt_type                  = BLE_ALARM_EVT_CONFIG_WRITE;
+    p_evt->params.config.p_data      = p_write->data;
+    p_evt->params.config.length      = p_write->len;
+    p_evt->params.config.gatt_status = BLE_GATT_STATUS_ATTERR_WRITE_NOT_PERMITTED;
+
+    if (p_alarm->evt_handler != NULL)
+    {
+        p_alarm->evt_handler(p_alarm, p_evt);
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    reply.type                     = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+    reply.params.write.gatt_status = p_evt->params.config.gatt_status;
+
+    if (p_evt->params.config.gatt_status == BLE_GATT_STATUS_SUCCESS)
+    {
+        reply.params.write.update = 1;
+        reply.params.write.offset = 0;
+        reply.params.write.len    = p_write->len;
+        reply.params.write.p_data = p_write->data;
+    }
+
+    err_code = sd_ble_gatts_rw_authorize_reply(p_ble_evt->evt.gatts_evt.conn_handle, &reply);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Write authorization reply failed: 0x%x.", err_code);
+    }
+}
+
+/**@brief Function for handling the Read/Write Authorization Request event.
+ *
+ * @details Dispatched through the same table as writes. Only characteristics with the matching
+ *          BLE_ALARM_AUTH_* bit are handed the request; the rest are left to other modules.
+ *
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_ble_evt   Event received from the BLE stack.
+ */
+static void on_rw_authorize_request(ble_alarm_t * p_alarm, ble_evt_t const * p_ble_evt)
+{
+    ble_gatts_evt_rw_authorize_request_t const * p_req = &p_ble_evt->evt.gatts_evt.params.authorize_request;
+    ble_alarm_evt_t                              evt;
+    uint16_t                                     handle;
+    uint8_t                                      auth;
+    uint8_t                                      attr;
+
+    if (p_req->type == BLE_GATTS_AUTHORIZE_TYPE_READ)
+    {
+        handle = p_req->request.read.handle;
+        auth   = BLE_ALARM_AUTH_READ;
+    }
+    else
+    {
+        handle = p_req->request.write.handle;
+        auth   = BLE_ALARM_AUTH_WRITE;
+    }
+
+    attr = attr_lookup(p_alarm, handle);
+    if ((attr == ATTR_NONE) || ((attr & ATTR_CCCD) != 0) ||
+        ((m_chars[attr].auth & auth) == 0) || (m_chars[attr].handler == NULL))
+    {
+        return;
+    }
+
+    (void)evt_prepare(p_alarm, p_ble_evt, &evt);
+    m_chars[attr].handler(p_alarm, p_ble_evt, &evt);
 }
 
 /**@brief Function for handling the Application's BLE Stack events.
@@ -287,6 +809,10 @@ void ble_alarm_on_ble_evt( ble_evt_t const * p_ble_evt, void * p_context)
 				case BLE_GATTS_EVT_WRITE:
 						on_write(p_alarm, p_ble_evt);
            break;
+
+        case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+            on_rw_authorize_request(p_alarm, p_ble_evt);
+            break;
 				
         default:
             // No implementation needed.
@@ -294,18 +820,24 @@ void ble_alarm_on_ble_evt( ble_evt_t const * p_ble_evt, void * p_context)
     }
 }
 
-uint32_t ble_nus_data_send(ble_alarm_t * p_nus,
-                           uint8_t     * p_data,
-                           uint16_t    * p_length,
-                           uint16_t      conn_handle)
+uint32_t ble_alarm_notify(ble_alarm_t    * p_alarm,
+                          ble_alarm_char_t characteristic,
+                          uint8_t        * p_data,
+                          uint16_t       * p_length,
+                          uint16_t         conn_handle)
 {
     ret_code_t                   err_code;
     ble_gatts_hvx_params_t       hvx_params;
     ble_alarm_client_context_t * p_client;
 
-    VERIFY_PARAM_NOT_NULL(p_nus);
+    VERIFY_PARAM_NOT_NULL(p_alarm);
+
+    if (characteristic >= BLE_ALARM_CHAR_COUNT)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
 
-    err_code = blcm_link_ctx_get(p_nus->p_link_ctx_storage, conn_handle, (void *) &p_client);
+    err_code = blcm_link_ctx_get(p_alarm->p_link_ctx_storage, conn_handle, (void *) &p_client);
     VERIFY_SUCCESS(err_code);
 
     if ((conn_handle == BLE_CONN_HANDLE_INVALID) || (p_client == NULL))
@@ -313,7 +845,7 @@ uint32_t ble_nus_data_send(ble_alarm_t * p_nus,
         return NRF_ERROR_NOT_FOUND;
     }
 
-    if (!p_client->is_notification_enabled)
+    if ((p_client->notify_mask & (1UL << characteristic)) == 0)
     {
         return NRF_ERROR_INVALID_STATE;
     }
@@ -325,7 +857,7 @@ uint32_t ble_nus_data_send(ble_alarm_t * p_nus,
 
     memset(&hvx_params, 0, sizeof(hvx_params));
 
-    hvx_params.handle = p_nus->tx_value_handles.value_handle;
+    hvx_params.handle = p_alarm->char_handles[characteristic].value_handle;
     hvx_params.p_data = p_data;
     hvx_params.p_len  = p_length;
     hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
@@ -335,8 +867,8 @@ uint32_t ble_nus_data_send(ble_alarm_t * p_nus,
 
 /**@brief Function for updating the custom value.
  *
- * @details The application calls this function when the cutom value should be updated. If
- *          notification has been enabled, the custom value characteristic is sent to the client.
+ * @details The application calls this function when the cutom value should be updated. The
+ *          Status characteristic reads it in place; notifying it is up to the application.
  *
  * @note 
  *       
@@ -347,44 +879,119 @@ uint32_t ble_nus_data_send(ble_alarm_t * p_nus,
  */
 uint32_t ble_alarm_custom_value_update(ble_alarm_t * p_alarm, uint8_t value)
 {
-		uint32_t err_code = NRF_SUCCESS;
-		ble_gatts_value_t gatts_value;
+    if (p_alarm == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
 
-		// Initialize value struct.
-		memset(&gatts_value, 0, sizeof(gatts_value));
+		// The Status characteristic reads this field in place; no sd_ble_gatts_value_set needed.
+		p_alarm->status.heartbeat = value;
 
-		gatts_value.len     = sizeof(uint8_t);
-		gatts_value.offset  = 0;
-		gatts_value.p_value = &value;
+		return NRF_SUCCESS;
+}
 
-		// Update database.
-		err_code = sd_ble_gatts_value_set(p_alarm->conn_handle,
-																				p_alarm->tx_value_handles.value_handle,
-																				&gatts_value);
-    if (p_alarm == NULL)
+
+uint32_t ble_alarm_sensor_update(ble_alarm_t * p_alarm, ble_alarm_sensor_report_t const * p_report)
+{
+    ret_code_t                   err_code;
+    ble_gatts_value_t            gatts_value;
+    ble_alarm_client_context_t * p_client;
+    uint8_t                      encoded[BLE_ALARM_SENSOR_REPORT_LEN];
+    uint16_t                     len = 0;
+
+    VERIFY_PARAM_NOT_NULL(p_alarm);
+    VERIFY_PARAM_NOT_NULL(p_report);
+
+    encoded[len++] = p_report->channel;
+    encoded[len++] = p_report->flags;
+    len += uint16_encode((uint16_t)p_report->min,  &encoded[len]);
+    len += uint16_encode((uint16_t)p_report->max,  &encoded[len]);
+    len += uint16_encode((uint16_t)p_report->mean, &encoded[len]);
+    len += uint16_encode((uint16_t)p_report->last, &encoded[len]);
+
+    memset(&gatts_value, 0, sizeof(gatts_value));
+
+    gatts_value.len     = len;
+    gatts_value.offset  = 0;
+    gatts_value.p_value = encoded;
+
+    err_code = sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID,
+                                      BLE_ALARM_HANDLES(p_alarm, SENSOR).value_handle,
+                                      &gatts_value);
+    VERIFY_SUCCESS(err_code);
+
+    if (p_alarm->conn_handle == BLE_CONN_HANDLE_INVALID)
     {
-        return NRF_ERROR_NULL;
+        return NRF_SUCCESS;
     }
-		// Send value if connected and notifying.
-		if ((p_alarm->conn_handle != BLE_CONN_HANDLE_INVALID)) 
-		{
-				ble_gatts_hvx_params_t hvx_params;
 
-				memset(&hvx_params, 0, sizeof(hvx_params));
+    err_code = blcm_link_ctx_get(p_alarm->p_link_ctx_storage, p_alarm->conn_handle, (void *) &p_client);
+    if ((err_code != NRF_SUCCESS) || !BLE_ALARM_NOTIFY_ENABLED(p_client, SENSOR))
+    {
+        return NRF_SUCCESS;
+    }
 
-				hvx_params.handle = p_alarm->tx_value_handles.value_handle;
-				hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
-				hvx_params.offset = gatts_value.offset;
-				hvx_params.p_len  = &gatts_value.len;
-				hvx_params.p_data = gatts_value.p_value;
+    if (p_alarm->evt_handler != NULL)
+    {
+        ble_alarm_evt_t evt;
 
-				err_code = sd_ble_gatts_hvx(p_alarm->conn_handle, &hvx_params);
-		}
-		else
-		{
-				err_code = NRF_ERROR_INVALID_STATE;
-		}
+        memset(&evt, 0, sizeof(evt));
+
+        evt.evt_type                 = BLE_ALARM_EVT_SENSOR_NOTIFY;
+        evt.p_alarm                  = p_alarm;
+        evt.conn_handle              = p_alarm->conn_handle;
+        evt.p_link_ctx               = p_client;
+        evt.params.alarm_data.p_data = encoded;
+        evt.params.alarm_data.length = len;
+
+        p_alarm->evt_handler(p_alarm, &evt);
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t ble_alarm_local_alarm_raise(ble_alarm_t * p_alarm, uint8_t const * p_data, uint16_t length)
+{
+    ble_alarm_evt_t evt;
+
+    VERIFY_PARAM_NOT_NULL(p_alarm);
+    VERIFY_PARAM_NOT_NULL(p_data);
+    VERIFY_PARAM_NOT_NULL(p_alarm->evt_handler);
+
+    memset(&evt, 0, sizeof(evt));
+
+    evt.evt_type                 = BLE_ALARM_EVT_ALARM;
+    evt.p_alarm                  = p_alarm;
+    evt.conn_handle              = BLE_CONN_HANDLE_INVALID;
+    evt.params.alarm_data.p_data = p_data;
+    evt.params.alarm_data.length = length;
+
+    p_alarm->evt_handler(p_alarm, &evt);
 
-		return err_code;
+    return NRF_SUCCESS;
 }
 
+
+uint32_t ble_alarm_config_set(ble_alarm_t * p_alarm, uint8_t const * p_data, uint16_t length)
+{
+    ble_gatts_value_t gatts_value;
+
+    VERIFY_PARAM_NOT_NULL(p_alarm);
+    VERIFY_PARAM_NOT_NULL(p_data);
+
+    if (length > BLE_ALARM_CONFIG_MAX_LEN)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    memset(&gatts_value, 0, sizeof(gatts_value));
+
+    gatts_value.len     = length;
+    gatts_value.offset  = 0;
+    gatts_value.p_value = (uint8_t *)p_data;
+
+    return sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID,
+                                  BLE_ALARM_HANDLES(p_alarm, CONFIG).value_handle,
+                                  &gatts_value);
+}
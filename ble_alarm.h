@@ -1,6 +1,7 @@
 /* This code belongs in ble_cus.h*/
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "ble.h"
 #include "ble_srv_common.h"
 #include "ble_link_ctx_manager.h"
@@ -11,6 +12,11 @@
 #define CUSTOM_SERVICE_UUID               0x2501
 #define ALARM_TX_VALUE_CHAR_UUID          0x2502
 #define ALARM_RX_VALUE_CHAR_UUID          0x2503				
+#define ALARM_SENSOR_VALUE_CHAR_UUID      0x2504
+#define ALARM_STATS_VALUE_CHAR_UUID       0x2505
+#define ALARM_CONFIG_VALUE_CHAR_UUID      0x2506
+#define ALARM_STATUS_VALUE_CHAR_UUID      0x2508
+#define ALARM_LAYOUT_VALUE_CHAR_UUID      0x2509
 
 #define OPCODE_LENGTH        1
 #define HANDLE_LENGTH        2
@@ -23,13 +29,88 @@
     #warning NRF_SDH_BLE_GATT_MAX_MTU_SIZE is not defined.
 #endif
 																					
+#define BLE_ALARM_PROP_READ               0x01                        /**< Characteristic can be read. */
+#define BLE_ALARM_PROP_WRITE              0x02                        /**< Characteristic can be written. */
+#define BLE_ALARM_PROP_NOTIFY             0x04                        /**< Characteristic can be notified; adds a CCCD. */
+
+#define BLE_ALARM_AUTH_NONE               0x00
+#define BLE_ALARM_AUTH_READ               0x01                        /**< Reads are answered by the service (rd_auth). */
+#define BLE_ALARM_AUTH_WRITE              0x02                        /**< Writes are accepted by the service (wr_auth). */
+
+#define BLE_ALARM_VALUE_OFFSET_NONE       0xFFFF
+#define BLE_ALARM_VALUE_STACK             BLE_ALARM_VALUE_OFFSET_NONE                /**< Value stored by the SoftDevice. */
+#define BLE_ALARM_VALUE_USER(_member)     ((uint16_t)offsetof(ble_alarm_t, _member)) /**< Value read in place from a ble_alarm_t member. */
+
+#define BLE_ALARM_STATS_MAX_LEN           128                         /**< Maximum length of the Stats characteristic value. */
+#define BLE_ALARM_CONFIG_MAX_LEN          136                         /**< Maximum length of the Config characteristic value. */
+#define BLE_ALARM_SENSOR_REPORT_LEN       10                          /**< Encoded length of @ref ble_alarm_sensor_report_t. */
+#define BLE_ALARM_RX_RATE_UNLIMITED       0                           /**< Rate of an RX class that is not limited. */
+#define BLE_ALARM_RX_WRITE_OVERHEAD       8                           /**< Bytes charged per RX write on top of its length: the framing it adds on the ESP link. */
+#define BLE_ALARM_RX_TICK_SPAN_S          256                         /**< Idle time from which a bucket is refilled from the uptime clock: half the 24-bit app_timer wrap. */
+
+/**@brief   Characteristics of the Alarm service, in registration order.
+ *
+ * @details Every entry is X(name, uuid, properties, authorization, value location, initial length,
+ *          maximum length, handler). The list generates the characteristic enum, the attribute
+ *          registration and the handle dispatch table, so adding a characteristic is one line here
+ *          plus its handler in ble_alarm.c. A value is variable length unless both lengths are equal.
+ *
+ *          Handles follow the list order and are checked at init, so the layout only changes when
+ *          this list does. Append new entries at the end and bump @ref BLE_ALARM_LAYOUT_VERSION;
+ *          bonded peers are then told to rediscover through Service Changed.
+ */
+#define BLE_ALARM_CHAR_LIST(X)                                                                                          \
+    X(TX,     ALARM_TX_VALUE_CHAR_UUID,     BLE_ALARM_PROP_READ | BLE_ALARM_PROP_NOTIFY, BLE_ALARM_AUTH_NONE,           \
+      BLE_ALARM_VALUE_STACK,        sizeof(uint8_t),            BLE_NUS_MAX_DATA_LEN,        on_tx_cccd_write)      \
+    X(RX,     ALARM_RX_VALUE_CHAR_UUID,     BLE_ALARM_PROP_WRITE,                        BLE_ALARM_AUTH_NONE,           \
+      BLE_ALARM_VALUE_STACK,        sizeof(uint8_t),            BLE_NUS_MAX_DATA_LEN,        on_rx_write)           \
+    X(SENSOR, ALARM_SENSOR_VALUE_CHAR_UUID, BLE_ALARM_PROP_READ | BLE_ALARM_PROP_NOTIFY, BLE_ALARM_AUTH_NONE,           \
+      BLE_ALARM_VALUE_STACK,        BLE_ALARM_SENSOR_REPORT_LEN, BLE_ALARM_SENSOR_REPORT_LEN, NULL)                 \
+    X(STATS,  ALARM_STATS_VALUE_CHAR_UUID,  BLE_ALARM_PROP_READ,                         BLE_ALARM_AUTH_READ,           \
+      BLE_ALARM_VALUE_STACK,        0,                          BLE_ALARM_STATS_MAX_LEN,     on_stats_read)         \
+    X(CONFIG, ALARM_CONFIG_VALUE_CHAR_UUID, BLE_ALARM_PROP_READ | BLE_ALARM_PROP_WRITE,  BLE_ALARM_AUTH_WRITE,          \
+      BLE_ALARM_VALUE_STACK,        0,                          BLE_ALARM_CONFIG_MAX_LEN,    on_config_write)       \
+    X(STATUS, ALARM_STATUS_VALUE_CHAR_UUID, BLE_ALARM_PROP_READ,                         BLE_ALARM_AUTH_READ,           \
+      BLE_ALARM_VALUE_USER(status), sizeof(ble_alarm_status_t), sizeof(ble_alarm_status_t), on_status_read)        \
+    X(LAYOUT, ALARM_LAYOUT_VALUE_CHAR_UUID, BLE_ALARM_PROP_READ,                         BLE_ALARM_AUTH_NONE,           \
+      BLE_ALARM_VALUE_USER(layout), sizeof(ble_alarm_layout_t), sizeof(ble_alarm_layout_t), NULL)
+
+#define BLE_ALARM_LAYOUT_VERSION          2                           /**< Version of @ref BLE_ALARM_CHAR_LIST; 1 was the list without Layout. */
+
+#define BLE_ALARM_CHAR_ENUM_(_name, ...)  BLE_ALARM_CHAR_ ## _name,
+#define BLE_ALARM_CHAR_ATTRS_(_name, _uuid, _props, ...)                                                                \
+    + 2 + ((((_props) & BLE_ALARM_PROP_NOTIFY) != 0) ? 1 : 0)
+
+/**@brief   Index of each characteristic in @ref BLE_ALARM_CHAR_LIST. */
+typedef enum
+{
+    BLE_ALARM_CHAR_LIST(BLE_ALARM_CHAR_ENUM_)
+    BLE_ALARM_CHAR_COUNT
+} ble_alarm_char_t;
+
+/**@brief   Attributes of the service: the declaration, then declaration and value (and CCCD) of each characteristic. */
+#define BLE_ALARM_ATTR_COUNT              (1 BLE_ALARM_CHAR_LIST(BLE_ALARM_CHAR_ATTRS_))
+
+/**@brief   Handles of a characteristic, e.g. BLE_ALARM_HANDLES(&m_alarm, CONFIG).value_handle. */
+#define BLE_ALARM_HANDLES(_p_alarm, _name)  ((_p_alarm)->char_handles[BLE_ALARM_CHAR_ ## _name])
+
+/**@brief   Macro for checking whether a peer has enabled notifications of a characteristic. */
+#define BLE_ALARM_NOTIFY_ENABLED(_p_client, _name)                                                                      \
+    (((_p_client)->notify_mask & (1UL << BLE_ALARM_CHAR_ ## _name)) != 0)
+
 /**@brief   Macro for defining a ble_cus instance.
  *
  * @param   _name   Name of the instance.
  * @hideinitializer
  */
 #define BLE_ALARM_DEF(_name)                                                                        \
-static ble_alarm_t _name;																																						\
+BLE_LINK_CTX_MANAGER_DEF(CONCAT_2(_name, _link_ctx_storage),                                        \
+                         NRF_SDH_BLE_TOTAL_LINK_COUNT,                                              \
+                         sizeof(ble_alarm_client_context_t));                                       \
+static ble_alarm_t _name =                                                                          \
+{                                                                                                   \
+    .p_link_ctx_storage = &CONCAT_2(_name, _link_ctx_storage)                                       \
+};                                                                                                  \
 NRF_SDH_BLE_OBSERVER(_name ## _obs,                                                                 \
                      BLE_HRS_BLE_OBSERVER_PRIO,                                                     \
                      ble_alarm_on_ble_evt, &_name)
@@ -44,7 +125,12 @@ typedef enum
 		BLE_ALARM_EVT_NOTIFICATION_ENABLED,                             /**< Custom value notification enabled event. */
     BLE_ALARM_EVT_NOTIFICATION_DISABLED,                            /**< Custom value notification disabled event. */
     BLE_ALARM_EVT_DISCONNECTED,
-    BLE_ALARM_EVT_CONNECTED
+    BLE_ALARM_EVT_CONNECTED,
+    BLE_ALARM_EVT_STATUS_READ,                                      /**< Peer reads Status; refresh p_alarm->status now. */
+    BLE_ALARM_EVT_STATS_READ,                                       /**< Peer reads Stats; encode into params.read. */
+    BLE_ALARM_EVT_CONFIG_WRITE,                                     /**< Peer wrote a whole Config blob in one Write Request. */
+    BLE_ALARM_EVT_SENSOR_NOTIFY,                                    /**< A sensor report is due on the Sensor characteristic; params.alarm_data holds it. */
+    BLE_ALARM_EVT_RX_REJECTED                                       /**< An RX write was dropped over the budget of the link; no data. */
 } ble_alarm_evt_type_t;
 
 /**@brief   Nordic UART Service @ref BLE_NUS_EVT_RX_DATA event data.
@@ -58,16 +144,117 @@ typedef struct
 } ble_evt_alarm_data_t;
 
 
+/**@brief   @ref BLE_ALARM_EVT_STATS_READ event data. */
+typedef struct
+{
+    uint8_t  * p_data;      /**< Buffer for the fresh value. */
+    uint16_t   length;      /**< In: size of @p p_data. Out: bytes written. */
+} ble_alarm_evt_read_t;
+
+
+/**@brief   @ref BLE_ALARM_EVT_CONFIG_WRITE event data. */
+typedef struct
+{
+    uint8_t const * p_data;      /**< Written blob. */
+    uint16_t        length;      /**< Length of @p p_data. */
+    uint16_t        gatt_status; /**< Out: BLE_GATT_STATUS_SUCCESS to accept and store the blob. */
+} ble_alarm_evt_config_t;
+
+
+/**@brief   Budget classes of RX writes. Each link has one token bucket per class. */
+typedef enum
+{
+    BLE_ALARM_RX_CLASS_ALARM,                                       /**< Alarm commands ('s'). */
+    BLE_ALARM_RX_CLASS_BULK,                                        /**< Every other write. */
+    BLE_ALARM_RX_CLASS_COUNT
+} ble_alarm_rx_class_t;
+
+/**@brief   Token bucket budget of one RX class.
+ *
+ * @details A write costs its length plus @ref BLE_ALARM_RX_WRITE_OVERHEAD bytes, capped at
+ *          @p burst, so both the bytes sent on to the ESP and the number of writes are bounded.
+ */
+typedef struct
+{
+    uint16_t rate;                                                  /**< Bytes per second, or @ref BLE_ALARM_RX_RATE_UNLIMITED. */
+    uint16_t burst;                                                 /**< Depth of the bucket, in bytes. */
+} ble_alarm_rx_budget_t;
+
+/**@brief   Token bucket of one RX class on one link. */
+typedef struct
+{
+    uint32_t tokens;                                                /**< Bytes available, times app_timer ticks per second. */
+    uint32_t refilled_at;                                           /**< app_timer counter value of the last refill. */
+    uint32_t refilled_s;                                            /**< Uptime of the last refill, in seconds. */
+} ble_alarm_rx_bucket_t;
+
 /**@brief Nordic UART Service client context structure.
  *
  * @details This structure contains state context related to hosts.
  */
 typedef struct
 {
-    bool is_notification_enabled; /**< Variable to indicate if the peer has enabled notification of the RX characteristic.*/
+    uint32_t              notify_mask;                              /**< Bit n set if the peer has enabled notification of characteristic n (@ref ble_alarm_char_t).*/
+    ble_alarm_rx_bucket_t rx_buckets[BLE_ALARM_RX_CLASS_COUNT];     /**< RX budget left on this link; full at connection. */
+    uint32_t              rx_rejected[BLE_ALARM_RX_CLASS_COUNT];    /**< RX writes dropped over budget on this link. */
 } ble_alarm_client_context_t;
 
 
+#define BLE_ALARM_SENSOR_FLAG_LIMIT_LOW   0x01                        /**< The low limit of the channel was crossed. */
+#define BLE_ALARM_SENSOR_FLAG_LIMIT_HIGH  0x02                        /**< The high limit of the channel was crossed. */
+
+#define BLE_ALARM_STATUS_FLAG_ALARM       0x01                        /**< An alarm was raised during this connection. */
+
+/**@brief   Status characteristic value.
+ *
+ * @details The attribute is located in application memory (BLE_GATTS_VLOC_USER) and is read
+ *          authorized: @ref BLE_ALARM_EVT_STATUS_READ lets the application refresh it right
+ *          before the SoftDevice serves it. Fields are naturally aligned, so the in-memory layout
+ *          is also the little-endian wire format.
+ */
+typedef struct
+{
+    uint8_t  heartbeat;                                               /**< Incremented once per second. */
+    uint8_t  flags;                                                   /**< BLE_ALARM_STATUS_FLAG_* bits. */
+    uint16_t zones;                                                   /**< Bit n set if zone n tripped since the previous read. */
+    uint16_t battery;                                                 /**< Latest supply voltage block mean (raw SAADC). */
+    int8_t   rssi;                                                    /**< Latest link RSSI in dBm. */
+    uint8_t  reserved;
+    uint16_t tx_dropped;                                              /**< Outbound frames dropped on the BLE and UART links (saturating). */
+    uint16_t alarm_delay_max;                                         /**< Worst queueing delay of an alarm frame to the ESP, in ms. */
+} ble_alarm_status_t;
+
+/**@brief   Layout characteristic value.
+ *
+ * @details Lets a bonded client check, with one read, that the handles it cached still apply.
+ *          The CRC covers the service handle and the UUID, properties, authorization and handles
+ *          of every characteristic, so it also catches a shift caused by services added before
+ *          this one.
+ */
+typedef struct
+{
+    uint16_t version;                                                 /**< @ref BLE_ALARM_LAYOUT_VERSION. */
+    uint16_t crc;                                                     /**< CRC16 of the registered layout. */
+} ble_alarm_layout_t;
+
+/**@brief   Macro for getting the layout as one id, e.g. to store it across firmware updates. */
+#define BLE_ALARM_LAYOUT_ID(_p_alarm)   (((uint32_t)(_p_alarm)->layout.version << 16) | (_p_alarm)->layout.crc)
+
+/**@brief   Sensor characteristic value: statistics of the latest sample block of one analog channel.
+ *
+ * @details Encoded little-endian as channel, flags, min, max, mean, last.
+ */
+typedef struct
+{
+    uint8_t channel;
+    uint8_t flags;
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+    int16_t last;
+} ble_alarm_sensor_report_t;
+
+
 /**@brief   Nordic UART Service event structure.
  *
  * @details This structure is passed to an event coming from service.
@@ -81,12 +268,17 @@ typedef struct
     union
     {
         ble_evt_alarm_data_t alarm_data; /**< @ref BLE_NUS_EVT_RX_DATA event data. */
+        ble_alarm_evt_read_t read;       /**< @ref BLE_ALARM_EVT_STATS_READ event data. */
+        ble_alarm_evt_config_t config;   /**< @ref BLE_ALARM_EVT_CONFIG_WRITE event data. */
     } params;
 } ble_alarm_evt_t;
 
 /**@brief Custom Service event handler type. */
 typedef void (*ble_alarm_evt_handler_t) (ble_alarm_t * p_cus, ble_alarm_evt_t * p_evt);
 
+/**@brief   Current uptime in seconds. */
+typedef uint32_t (*ble_alarm_clock_t)(void);
+
 /**@brief Custom Service init structure. This contains all options and data needed for
  *        initialization of the service.*/
 typedef struct
@@ -94,6 +286,8 @@ typedef struct
 		ble_alarm_evt_handler_t       evt_handler;                    /**< Event handler to be called for handling events in the Custom Service. */
     uint8_t                       initial_custom_value;           /**< Initial custom value */
     ble_srv_cccd_security_mode_t  custom_value_char_attr_md;      /**< Initial security level for Custom characteristics attribute */
+    ble_alarm_rx_budget_t         rx_budget[BLE_ALARM_RX_CLASS_COUNT]; /**< Budget of each RX class, per link. */
+    ble_alarm_clock_t             clock;                          /**< Time base of the RX budget over idle times the app_timer counter cannot span. */
 } ble_alarm_init_t;
 
 
@@ -102,8 +296,17 @@ struct ble_alarm_s
 {
 		ble_alarm_evt_handler_t       evt_handler;                    /**< Event handler to be called for handling events in the Custom Service. */
     uint16_t                      service_handle;                 /**< Handle of Custom Service (as provided by the BLE stack). */
-    ble_gatts_char_handles_t      tx_value_handles;           		/**< Handles related to the TX Value characteristic. */
-    ble_gatts_char_handles_t    	rx_value_handles;								/**< Handles related to the RX Value characteristic. */
+    ble_gatts_char_handles_t      char_handles[BLE_ALARM_CHAR_COUNT]; /**< Handles of each characteristic; see @ref BLE_ALARM_HANDLES. */
+    uint8_t                       attr_lut[BLE_ALARM_ATTR_COUNT]; /**< Characteristic of each attribute, indexed by handle - service_handle. */
+    ble_alarm_status_t            status;                         /**< Value of the Status characteristic, read in place by the SoftDevice. */
+    ble_alarm_layout_t            layout;                         /**< Value of the Layout characteristic, read in place by the SoftDevice. */
+    uint32_t                      read_cycles_max;                /**< Longest read authorization, in CPU cycles. */
+    uint32_t                      write_cycles_max;               /**< Longest write dispatch (handler excluded), in CPU cycles. */
+    uint32_t                      write_cycles_sum;               /**< Total write dispatch cycles, for the mean over @p write_count. */
+    uint32_t                      write_count;                    /**< Write events seen, including those for other services. */
+    ble_alarm_rx_budget_t         rx_budget[BLE_ALARM_RX_CLASS_COUNT]; /**< Budget of each RX class, per link. */
+    uint32_t                      rx_rejected[BLE_ALARM_RX_CLASS_COUNT]; /**< RX writes dropped over budget since boot, all links. */
+    ble_alarm_clock_t             clock;                          /**< Time base of the RX budget over long idle times. */
 		uint16_t                      conn_handle;                    /**< Handle of the current connection (as provided by the BLE stack, is BLE_CONN_HANDLE_INVALID if not in a connection). */
     uint8_t                       uuid_type; 
 	
@@ -145,8 +348,9 @@ void ble_alarm_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context);
 
 /**@brief Function for updating the custom value.
  *
- * @details The application calls this function when the cutom value should be updated. If
- *          notification has been enabled, the custom value characteristic is sent to the client.
+ * @details The application calls this function when the cutom value should be updated. The
+ *          value becomes the heartbeat of the Status characteristic. It is not notified here, so
+ *          it can go out through the same queue as every other TX frame.
  *
  * @note 
  *       
@@ -158,5 +362,60 @@ void ble_alarm_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context);
 uint32_t ble_alarm_custom_value_update(ble_alarm_t * p_cus, uint8_t value);
 
 
-uint32_t ble_nus_data_send(ble_alarm_t* p_nus, uint8_t * p_data, uint16_t * p_length, uint16_t conn_handle);
+/**@brief Function for notifying a characteristic to the peer.
+ *
+ * @param[in]       p_alarm         Custom Service structure.
+ * @param[in]       characteristic  Characteristic to notify.
+ * @param[in]       p_data          Value to notify.
+ * @param[in,out]   p_length        Length of @p p_data, at most @ref BLE_NUS_MAX_DATA_LEN.
+ * @param[in]       conn_handle     Link to notify on.
+ *
+ * @return      NRF_SUCCESS if the SoftDevice queued the notification, NRF_ERROR_INVALID_STATE if
+ *              the peer has not enabled it, otherwise an error code.
+ */
+uint32_t ble_alarm_notify(ble_alarm_t    * p_alarm,
+                          ble_alarm_char_t characteristic,
+                          uint8_t        * p_data,
+                          uint16_t       * p_length,
+                          uint16_t         conn_handle);
+
+/**@brief Function for publishing an analog sensor report.
+ *
+ * @details Updates the Sensor characteristic value. If the peer has enabled notifications on
+ *          it, @ref BLE_ALARM_EVT_SENSOR_NOTIFY hands the encoded report to the application,
+ *          which queues it with its other notifications.
+ *
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_report    Report to publish.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+uint32_t ble_alarm_sensor_update(ble_alarm_t * p_alarm, ble_alarm_sensor_report_t const * p_report);
+
 
+/**@brief Function for raising an alarm detected on the device itself.
+ *
+ * @details Delivers @ref BLE_ALARM_EVT_ALARM to the service event handler exactly as if a peer
+ *          had written an alarm command to the RX characteristic.
+ *
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_data      Alarm command forwarded with the event.
+ * @param[in]   length      Length of @p p_data.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+uint32_t ble_alarm_local_alarm_raise(ble_alarm_t * p_alarm, uint8_t const * p_data, uint16_t length);
+
+
+/**@brief Function for replacing the value of the Config characteristic.
+ *
+ * @details Used to publish the configuration loaded from flash. Peer writes update the value
+ *          themselves once they are accepted.
+ *
+ * @param[in]   p_alarm     Custom Service structure.
+ * @param[in]   p_data      Encoded configuration blob.
+ * @param[in]   length      Length of @p p_data, at most @ref BLE_ALARM_CONFIG_MAX_LEN.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+uint32_t ble_alarm_config_set(ble_alarm_t * p_alarm, uint8_t const * p_data, uint16_t length);
@@ -24,22 +24,41 @@
 #include "nrf_ble_gatt.h"
 #include "nrf_ble_qwr.h"
 #include "nrf_pwr_mgmt.h"
+#include "nrf_atomic.h"
 
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
-#include "app_uart.h"
-#include "nrf_uart.h"
 #include "nrf_drv_clock.h"
+#include "nrf_drv_saadc.h"
 #include "ble_alarm.h"
+#include "alarm_saadc.h"
+#include "alarm_glassbreak.h"
+#include "alarm_stats.h"
+#include "alarm_tlm.h"
+#include "alarm_tx_sched.h"
+#include "alarm_config.h"
+#include "alarm_layout.h"
+#include "alarm_adv.h"
+#include "alarm_relay.h"
+#include "alarm_flood.h"
+#include "alarm_esp.h"
+#include "alarm_frame.h"
+#include "alarm_ack.h"
+#include "alarm_backlog.h"
+#include "alarm_dedup.h"
+#include "alarm_radio.h"
+#include "alarm_util.h"
 
 
 #define DEVICE_NAME                     "ALARM-001"                       					/**< Name of device. Will be included in the advertising data. */
 #define MANUFACTURER_NAME               "NordicSemiconductor"                   /**< Manufacturer. Will be passed to Device Information Service. */
+#define APP_ADV_FAST_INTERVAL           32                                      /**< Whitelisted advertising interval (in units of 0.625 ms. This value corresponds to 20 ms). */
+#define APP_ADV_FAST_DURATION           1000                                    /**< Whitelisted advertising duration (10 seconds) in units of 10 milliseconds. */
 #define APP_ADV_INTERVAL                300                                     /**< The advertising interval (in units of 0.625 ms. This value corresponds to 187.5 ms). */
 
-#define APP_ADV_DURATION                18000                                   /**< The advertising duration (180 seconds) in units of 10 milliseconds. */
+#define APP_ADV_DURATION                BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED   /**< Slow advertising never times out: the node keeps watching its zones, so it must stay reachable. */
 #define APP_BLE_OBSERVER_PRIO           3                                       /**< Application's BLE observer priority. You shouldn't need to modify this value. */
 #define APP_BLE_CONN_CFG_TAG            1                                       /**< A tag identifying the SoftDevice BLE configuration. */
 
@@ -49,6 +68,7 @@
 #define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)         /**< Connection supervisory timeout (4 seconds). */
 
 #define NOTIFICATION_INTERVAL           APP_TIMER_TICKS(1000)
+#define STATS_INTERVAL                  APP_TIMER_TICKS(1000)                   /**< Period of the finest statistics window (1 second). */
 #define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(5000)                   /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(30000)                  /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT    3                                       /**< Number of attempts before giving up the connection parameter negotiation. */
@@ -61,20 +81,107 @@
 #define SEC_PARAM_OOB                   0                                       /**< Out Of Band data not available. */
 #define SEC_PARAM_MIN_KEY_SIZE          7                                       /**< Minimum encryption key size. */
 #define SEC_PARAM_MAX_KEY_SIZE          16                                      /**< Maximum encryption key size. */
-#define UART_TX_BUF_SIZE                256                                         /**< UART TX buffer size. */
-#define UART_RX_BUF_SIZE                256                                         /**< UART RX buffer size. */
+#define STRAY_LINK_TIMEOUT              APP_TIMER_TICKS(10000)                  /**< Time an unbonded central gets to start pairing once a gateway is bonded. */
+#define RELAY_PAYLOAD_LEN               (BLE_GAP_ADDR_LEN + 1 + ALARM_ADV_FULL_LEN)                /**< Neighbour address, RSSI and snapshot. */
+#define ESP_PAYLOAD_MAX_LEN             MAX(BLE_NUS_MAX_DATA_LEN, RELAY_PAYLOAD_LEN)             /**< Largest payload relayed to the ESP: one RX write or a relayed snapshot. */
+#define UART_FRAME_MAX_LEN              ALARM_FRAME_ENCODED_MAX_LEN(ESP_PAYLOAD_MAX_LEN)         /**< Largest frame on the ESP link, after byte stuffing. */
+#define QWR_MEM_BUFF_SIZE               512                                     /**< Reassembly buffer for queued (long) writes to the Config characteristic. */
+#define CONFIG_GATT_STATUS_INVALID      BLE_GATT_STATUS_ATTERR_APP_BEGIN        /**< ATT error returned for a Config blob that fails validation. */
+#define TX_SCHED_QUEUE_LEN              8                                       /**< Frames queued per traffic class on each link. */
+#define BLE_TX_FRAME_MAX_LEN            (1 + BLE_NUS_MAX_DATA_LEN)              /**< Queued notification: characteristic, then the value. */
+#if defined(S112)
+#define HVN_TX_QUEUE_SIZE               6                                       /**< Notifications the SoftDevice queues per link; bounded by nRF52810 RAM. */
+#else
+#define HVN_TX_QUEUE_SIZE               16                                      /**< Notifications the SoftDevice queues per link, i.e. the most one connection event can carry. */
+#endif
+#define RX_ALARM_RATE                   100                                     /**< Alarm command bytes per second accepted from one link: ten 's' writes. */
+#define RX_ALARM_BURST                  50                                      /**< Alarm command bytes accepted back to back: five 's' writes. */
+#define RX_BULK_RATE                    2048                                    /**< Other command bytes per second accepted from one link; under a fifth of the UART at 115200 baud. */
+#define RX_BULK_BURST                   1024                                    /**< Other command bytes accepted back to back: four full writes. */
+#define ESP_WAKE_OUT_PIN                26                                      /**< Wake line to the ESP; free on PCA10040 and PCA10056. */
+#define ESP_WAKE_IN_PIN                 27                                      /**< Wake line from the ESP. */
+#define ESP_UART_ON_CURRENT_UA          900                                     /**< UARTE listening plus HFCLK, from the datasheet; confirm with a power profiler. */
+
+#define SENSOR_REPORT_BLOCKS            (ALARM_SAADC_SAMPLE_RATE_HZ / ALARM_SAADC_BLOCK_LEN)   /**< Sample blocks between periodic sensor reports (about 1 second). */
+#define MIC_LIMIT_LOW                   400                                     /**< Microphone low limit (raw 12-bit, gain 1/6, 0.35 V). */
+#define MIC_LIMIT_HIGH                  3000                                    /**< Microphone high limit (raw 12-bit, gain 1/6, 2.64 V). */
+#define VIBRATION_LIMIT_HIGH            2500                                    /**< Vibration sensor high limit (raw 12-bit, gain 1/6, 2.2 V). */
+#define BATTERY_LIMIT_LOW               2503                                    /**< Supply voltage low limit (raw 12-bit, gain 1/6, 2.2 V). */
+
+#define ACK_NOTIF_LEN                   6                                       /**< TX notification: type/status, command id (2), retries, round trip in ms (2). */
+#define EVENT_NOTIF_LEN                 6                                       /**< TX notification: type/zone, uptime of the trip in s (4), status flags. */
+
+#define ESP_BACKLOG_RAM_SIZE            1024                                    /**< RAM for frames the ESP link could not take. */
+#define ESP_BACKLOG_FILE_ID             0x1A02                                  /**< FDS file of the ESP backlog overflow. */
+#define ESP_BACKLOG_POLICY              ALARM_BACKLOG_DROP_OLDEST               /**< Relayed state is refreshed; the newest frames matter most. */
+#define PEER_BACKLOG_RAM_SIZE           512                                     /**< RAM for events that happened while no peer listened. */
+#define PEER_BACKLOG_FILE_ID            0x1A03                                  /**< FDS file of the peer backlog overflow. */
+#define PEER_BACKLOG_POLICY             ALARM_BACKLOG_DROP_NEWEST               /**< The first trips of an incident matter most; later ones are in the status. */
+
+#define ZONE_GLASSBREAK                 ALARM_SAADC_CH_COUNT                    /**< Status zone bit of the glass-break detector; zones below it are SAADC channels. */
+#define GLASSBREAK_ALARM_CMD            {'s', 'G'}                              /**< Alarm command sent to the ESP when the glass-break detector fires. */
 
 #define DEAD_BEEF                       0xDEADBEEF                              /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
 
 APP_TIMER_DEF(m_notification_timer_id);
+APP_TIMER_DEF(m_stats_timer_id);
+APP_TIMER_DEF(m_stray_timer_id);
 BLE_ALARM_DEF(m_alarm);
 NRF_BLE_GATT_DEF(m_gatt);                                                       /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                         /**< Context for the Queued Write module.*/
 BLE_ADVERTISING_DEF(m_advertising);                                             /**< Advertising module instance. */
 
 static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;                        /**< Handle of the current connection. */
+static pm_peer_id_t m_peer_id = PM_PEER_ID_INVALID;                             /**< Most recently connected bonded peer; target of directed advertising. */
+static ble_adv_evt_t m_adv_mode = BLE_ADV_EVT_IDLE;                             /**< Advertising mode the device was in when it was last connected to. */
+static uint32_t m_disconnected_at;                                              /**< app_timer counter value at the last disconnection. */
+static bool m_reconnect_pending = false;                                        /**< Disconnected since boot; the next connection is a reconnect. */
+static uint32_t m_stray_disconnects = 0;                                        /**< Unbonded links dropped for not pairing in time. */
+ALARM_TX_SCHED_DEF(m_ble_tx, BLE_TX_FRAME_MAX_LEN, TX_SCHED_QUEUE_LEN);          /**< Outbound notifications of the Alarm service. */
+ALARM_TX_SCHED_DEF(m_uart_tx, UART_FRAME_MAX_LEN, TX_SCHED_QUEUE_LEN);          /**< Outbound frames to the ESP. */
+ALARM_BACKLOG_DEF(m_esp_backlog, ESP_BACKLOG_RAM_SIZE, ESP_BACKLOG_FILE_ID);      /**< Frames held while the ESP is away. */
+ALARM_BACKLOG_DEF(m_peer_backlog, PEER_BACKLOG_RAM_SIZE, PEER_BACKLOG_FILE_ID);   /**< Events held while no peer listens on TX. */
+
+static alarm_tlm_encoder_t m_tlm;                                               /**< Compressed sensor telemetry stream on the TX characteristic. */
+static bool m_tlm_enabled = false;                                              /**< True while the peer has notifications enabled on TX. */
 static uint8_t m_custom_value = 0;
-static uint8_t data_send[5];
+static const uint8_t m_glassbreak_alarm[] = GLASSBREAK_ALARM_CMD;
+static uint8_t m_qwr_mem[QWR_MEM_BUFF_SIZE];                                    /**< Memory handed to the SoftDevice for prepared writes. */
+static nrf_atomic_u32_t m_zones_tripped;                                        /**< Zones tripped since the last status refresh. */
+static uint32_t m_connected_at;                                                 /**< app_timer counter value at the last connection. */
+static bool m_first_cmd_pending = false;                                        /**< No command received yet on the current connection. */
+static bool m_adv_data_live = false;                                            /**< The running advertising set carries the alarm snapshot. */
+static nrf_atomic_u32_t m_zones_unseen;                                         /**< Zones tripped since a gateway last connected; advertised. */
+static nrf_atomic_u32_t m_zone_trips[ALARM_ADV_ZONE_COUNT];                     /**< Trips per zone since boot. */
+static volatile uint8_t m_last_event_zone = ALARM_ADV_EVENT_NONE;               /**< Zone of the latest trip. */
+static volatile uint32_t m_last_event_at_s;                                     /**< Uptime of the latest trip. */
+static uint32_t m_alarm_count = 0;                                              /**< Alarm commands received since boot. */
+static nrf_atomic_u32_t m_esp_seq;                                              /**< Sequence number of the next frame to the ESP. */
+static alarm_frame_rx_t m_esp_rx;                                               /**< Frames from the ESP. */
+static uint16_t m_cmd_id = 0;                                                   /**< Id of the next RX write of the peer on the current connection. */
+static volatile uint32_t m_uptime_s = 0;                                        /**< Seconds since boot, from the statistics timer. */
+static uint32_t m_wakeups = 0;                                                  /**< Returns from sleep since boot. */
+static uint32_t m_wakeups_at_conn;                                              /**< m_wakeups at the last connection. */
+static uint32_t m_wakeups_prev;                                                 /**< m_wakeups at the previous statistics tick. */
+static uint32_t m_wakeups_per_s_max;                                            /**< Busiest second of the current connection. */
+static uint32_t m_hvn_events;                                                   /**< Connection events that carried notifications, this connection. */
+static uint32_t m_hvn_packets;                                                  /**< Notifications sent, this connection. */
+static uint32_t m_hvn_packets_max;                                              /**< Most notifications sent in one connection event. */
+static uint32_t m_ble_tx_bytes = 0;                                             /**< Notification payload bytes handed to the SoftDevice since boot. */
+static uint32_t m_ble_tx_bytes_at_conn;                                         /**< m_ble_tx_bytes at the last connection. */
+static uint32_t m_ble_tx_bytes_prev;                                            /**< m_ble_tx_bytes at the previous statistics tick. */
+static uint32_t m_ble_tx_bps_max;                                               /**< Best second of the current connection, in bytes. */
+static bool m_bulk_mode = false;                                                /**< Connection event length extension is on. */
+
+STATIC_ASSERT(ALARM_GLASSBREAK_FFT_LEN == ALARM_SAADC_BLOCK_LEN);
+STATIC_ASSERT(ALARM_GLASSBREAK_SAMPLE_RATE_HZ == ALARM_SAADC_SAMPLE_RATE_HZ);
+STATIC_ASSERT(ALARM_STATS_ENCODED_LEN <= BLE_ALARM_STATS_MAX_LEN);
+STATIC_ASSERT(ALARM_CONFIG_ENCODED_MAX_LEN <= BLE_ALARM_CONFIG_MAX_LEN);
+STATIC_ASSERT(ZONE_GLASSBREAK < ALARM_ADV_ZONE_COUNT);
+STATIC_ASSERT(ESP_PAYLOAD_MAX_LEN <= ALARM_FRAME_PAYLOAD_MAX_LEN);
+STATIC_ASSERT(UART_FRAME_MAX_LEN <= ALARM_BACKLOG_RECORD_MAX_LEN);
+STATIC_ASSERT(ALARM_ADV_ZONE_COUNT <= 16);
+STATIC_ASSERT(RX_BULK_BURST >= BLE_NUS_MAX_DATA_LEN + BLE_ALARM_RX_WRITE_OVERHEAD);
 //static uint16_t   m_ble_nus_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;            /**< Maximum length of data (in bytes) that can be transmitted to the peer by the Nordic UART service module. */
 
 /* YOUR_JOB: Declare all services structure your application is using
@@ -89,6 +196,9 @@ static ble_uuid_t m_adv_uuids[] =
 
 
 static void advertising_start(bool erase_bonds);
+static void whitelist_set(void);
+static void adv_snapshot_update(void);
+static ret_code_t ble_tx_put(alarm_tx_class_t tx_class, uint8_t const * p_data, uint16_t length);
 
 
 /**@brief Callback function for asserts in the SoftDevice.
@@ -120,9 +230,33 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
     switch (p_evt->evt_id)
     {
         case PM_EVT_PEERS_DELETE_SUCCEEDED:
+            m_peer_id = PM_PEER_ID_INVALID;
             advertising_start(false);
             break;
 
+        case PM_EVT_BONDED_PEER_CONNECTED:
+        case PM_EVT_CONN_SEC_SUCCEEDED:
+            if (p_evt->peer_id != PM_PEER_ID_INVALID)
+            {
+                // The last gateway to connect is the one directed advertising goes to.
+                m_peer_id = p_evt->peer_id;
+                (void)pm_peer_rank_highest(m_peer_id);
+            }
+            if (p_evt->evt_id == PM_EVT_CONN_SEC_SUCCEEDED)
+            {
+                (void)app_timer_stop(m_stray_timer_id);
+            }
+            break;
+
+        case PM_EVT_PEER_DATA_UPDATE_SUCCEEDED:
+            if (p_evt->params.peer_data_update_succeeded.flash_changed &&
+                (p_evt->params.peer_data_update_succeeded.data_id == PM_PEER_DATA_ID_BONDING))
+            {
+                // A new bond; let it through the whitelist from the next advertising round on.
+                whitelist_set();
+            }
+            break;
+
         default:
             break;
     }
@@ -138,7 +272,7 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
 static void notification_timeout_handler(void * p_context)
 {
     UNUSED_PARAMETER(p_context);
-    ret_code_t err_code;
+    uint8_t notif[2];
     
     // Increment the value of m_custom_value before nortifing it.
 		if(m_custom_value == 0x10)
@@ -147,86 +281,1091 @@ static void notification_timeout_handler(void * p_context)
 		}
 			m_custom_value++;
     
-    err_code = ble_alarm_custom_value_update(&m_alarm, m_custom_value);
+    (void)ble_alarm_custom_value_update(&m_alarm, m_custom_value);
+
+    notif[0] = (uint8_t)(ALARM_TLM_FRAME_HEARTBEAT << 4);
+    notif[1] = m_custom_value;
+
+    // A full queue skips one beat; the next follows a second later.
+    (void)ble_tx_put(ALARM_TX_CLASS_TELEMETRY, notif, sizeof(notif));
+}
+
+/**@brief Function for handling the statistics timer timeout.
+ *
+ * @details Closes the 1 s windows (cascading into 1 min and 1 h). The Stats characteristic is
+ *          encoded on demand when a peer reads it. Also keeps the advertised snapshot current.
+ *
+ * @param[in] p_context  Unused.
+ */
+static void stats_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    m_uptime_s++;
+    m_wakeups_per_s_max = MAX(m_wakeups_per_s_max, m_wakeups - m_wakeups_prev);
+    m_wakeups_prev      = m_wakeups;
+    m_ble_tx_bps_max    = MAX(m_ble_tx_bps_max, m_ble_tx_bytes - m_ble_tx_bytes_prev);
+    m_ble_tx_bytes_prev = m_ble_tx_bytes;
+    alarm_stats_tick();
+    alarm_esp_tick();
+#if ALARM_RELAY_ENABLED
+    alarm_relay_tick();
+#endif
+
+    if (m_adv_data_live)
+    {
+        adv_snapshot_update();
+    }
+}
+
+/**@brief Function for dropping a link that did not pair in time.
+ *
+ * @details Only armed for unbonded centrals while a gateway is bonded, so scanners probing the
+ *          open advertising phase cannot hold the only connection.
+ *
+ * @param[in] p_context  Unused.
+ */
+static void stray_timeout_handler(void * p_context)
+{
+    ret_code_t err_code;
+
+    UNUSED_PARAMETER(p_context);
+
+    err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+    if (err_code == NRF_SUCCESS)
+    {
+        m_stray_disconnects++;
+        NRF_LOG_INFO("Unbonded central did not pair, disconnecting (%u so far).", m_stray_disconnects);
+    }
+}
+
+/**@brief Function for the Timer initialization.
+ *
+ * @details Initializes the timer module. This creates and starts application timers.
+ */
+static void timers_init(void)
+{
+    // Initialize timer module.
+    ret_code_t err_code = app_timer_init();
+    APP_ERROR_CHECK(err_code);
+		
+		err_code = app_timer_create(&m_notification_timer_id, APP_TIMER_MODE_REPEATED, notification_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_stats_timer_id, APP_TIMER_MODE_REPEATED, stats_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_stray_timer_id, APP_TIMER_MODE_SINGLE_SHOT, stray_timeout_handler);
     APP_ERROR_CHECK(err_code);
 }
 
-/**@brief Function for the Timer initialization.
- *
- * @details Initializes the timer module. This creates and starts application timers.
- */
-static void timers_init(void)
+
+/**@brief Function for the GAP initialization.
+ *
+ * @details This function sets up all the necessary GAP (Generic Access Profile) parameters of the
+ *          device including the device name, appearance, and the preferred connection parameters.
+ */
+static void gap_params_init(void)
+{
+    ret_code_t              err_code;
+    ble_gap_conn_params_t   gap_conn_params;
+    ble_gap_conn_sec_mode_t sec_mode;
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
+
+    err_code = sd_ble_gap_device_name_set(&sec_mode,
+                                          (const uint8_t *)DEVICE_NAME,
+                                          strlen(DEVICE_NAME));
+    APP_ERROR_CHECK(err_code);
+
+    memset(&gap_conn_params, 0, sizeof(gap_conn_params));
+
+    gap_conn_params.min_conn_interval = MIN_CONN_INTERVAL;
+    gap_conn_params.max_conn_interval = MAX_CONN_INTERVAL;
+    gap_conn_params.slave_latency     = SLAVE_LATENCY;
+    gap_conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
+
+    err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for handling events from the GATT library.
+ *
+ * @details Telemetry frames are packed up to the negotiated notification payload size.
+ */
+static void gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
+{
+    if (p_evt->evt_id == NRF_BLE_GATT_EVT_ATT_MTU_UPDATED)
+    {
+        alarm_tlm_max_len_set(&m_tlm, p_evt->params.att_mtu_effective - OPCODE_LENGTH - HANDLE_LENGTH);
+    }
+}
+
+
+/**@brief Function for initializing the GATT module.
+ */
+static void gatt_init(void)
+{
+    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, gatt_evt_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for sending one telemetry frame as a TX notification.
+ */
+static uint32_t tlm_frame_send(uint8_t * p_data, uint16_t length)
+{
+    return ble_tx_put(ALARM_TX_CLASS_TELEMETRY, p_data, length);
+}
+
+
+/**@brief Function for initializing the sensor telemetry encoder.
+ */
+static void tlm_init(void)
+{
+    ret_code_t err_code = alarm_tlm_init(&m_tlm,
+                                         ALARM_SAADC_CH_COUNT,
+                                         BLE_GATT_ATT_MTU_DEFAULT - OPCODE_LENGTH - HANDLE_LENGTH,
+                                         tlm_frame_send);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for handling Queued Write Module errors.
+ *
+ * @details A pointer to this function will be passed to each service which may need to inform the
+ *          application about an error.
+ *
+ * @param[in]   nrf_error   Error code containing information about what went wrong.
+ */
+static void nrf_qwr_error_handler(uint32_t nrf_error)
+{
+    APP_ERROR_HANDLER(nrf_error);
+}
+
+
+/**@brief Function for mapping a configuration validation result to an ATT status.
+ */
+static uint16_t config_gatt_status(ret_code_t err_code)
+{
+    switch (err_code)
+    {
+        case NRF_SUCCESS:
+            return BLE_GATT_STATUS_SUCCESS;
+
+        case NRF_ERROR_INVALID_LENGTH:
+            return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+
+        default:
+            return CONFIG_GATT_STATUS_INVALID;
+    }
+}
+
+
+/**@brief Function for handling Queued Write Module events.
+ *
+ * @details A long write to the Config characteristic is reassembled by the module. The complete
+ *          blob is validated when the peer sends Execute Write (AUTH_REQUEST); a rejection
+ *          discards the whole write. It is committed only once the SoftDevice has applied it
+ *          (EXECUTE_WRITE), so RAM, flash and the attribute value change together.
+ *
+ * @return  ATT status for the execute request.
+ */
+static uint16_t qwr_evt_handler(nrf_ble_qwr_t * p_qwr, nrf_ble_qwr_evt_t * p_evt)
+{
+    uint8_t    blob[BLE_ALARM_CONFIG_MAX_LEN];
+    uint16_t   len = sizeof(blob);
+    ret_code_t err_code;
+
+    if (p_evt->attr_handle != BLE_ALARM_HANDLES(&m_alarm, CONFIG).value_handle)
+    {
+        return BLE_GATT_STATUS_SUCCESS;
+    }
+
+    switch (p_evt->evt_type)
+    {
+        case NRF_BLE_QWR_EVT_AUTH_REQUEST:
+            err_code = nrf_ble_qwr_value_get(p_qwr, p_evt->attr_handle, blob, &len);
+            if (err_code != NRF_SUCCESS)
+            {
+                return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+            }
+            return config_gatt_status(alarm_config_stage(blob, len));
+
+        case NRF_BLE_QWR_EVT_EXECUTE_WRITE:
+            err_code = alarm_config_commit();
+            APP_ERROR_CHECK(err_code);
+            NRF_LOG_INFO("Configuration committed (long write).");
+            break;
+
+        default:
+            break;
+    }
+
+    return BLE_GATT_STATUS_SUCCESS;
+}
+
+
+/**@brief Function for handling configuration store events.
+ */
+static void config_evt_handler(alarm_config_evt_t evt)
+{
+    switch (evt)
+    {
+        case ALARM_CONFIG_EVT_LOADED:
+        {
+            alarm_config_t config;
+            uint8_t        blob[ALARM_CONFIG_ENCODED_MAX_LEN];
+            uint16_t       len;
+
+            alarm_config_get(&config);
+            len = alarm_config_encode(&config, blob);
+            APP_ERROR_CHECK(ble_alarm_config_set(&m_alarm, blob, len));
+            NRF_LOG_INFO("Configuration loaded: %u zones, %u rules.", config.zone_count, config.rule_count);
+        } break;
+
+        case ALARM_CONFIG_EVT_STORED:
+            NRF_LOG_INFO("Configuration stored.");
+            break;
+
+        case ALARM_CONFIG_EVT_STORE_FAILED:
+            NRF_LOG_WARNING("Configuration not stored; the RAM copy stays active until reboot.");
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Function for initializing the configuration store.
+ *
+ * @details Must run before the Peer Manager initializes FDS.
+ */
+static void config_init(void)
+{
+    ret_code_t err_code = alarm_config_init(config_evt_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for flagging bonded peers for Service Changed if the GATT layout changed.
+ *
+ * @details Needs the Peer Manager, so it runs after peer_manager_init().
+ */
+static void layout_init(void)
+{
+    ret_code_t err_code = alarm_layout_init(BLE_ALARM_LAYOUT_ID(&m_alarm));
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for taking the next frame sequence number. Safe to call from any interrupt level. */
+static uint8_t esp_seq_next(void)
+{
+    return (uint8_t)nrf_atomic_u32_fetch_add(&m_esp_seq, 1);
+}
+
+
+/**@brief Function for framing a message and queueing it for the ESP.
+ *
+ * @param[in]   store   Keep the frame in the backlog if its class queue is full. While the backlog
+ *                      holds frames, new ones other than alarms queue up behind it.
+ */
+static ret_code_t esp_frame_put(alarm_frame_type_t type,
+                                uint8_t            seq,
+                                alarm_tx_class_t   tx_class,
+                                uint8_t const    * p_payload,
+                                uint16_t           length,
+                                bool               store)
+{
+    ret_code_t err_code;
+    uint8_t    frame[UART_FRAME_MAX_LEN];
+    uint16_t   len;
+
+    err_code = alarm_frame_encode(type, seq, p_payload, length, frame, &len);
+    VERIFY_SUCCESS(err_code);
+
+    if (store &&
+        (((tx_class != ALARM_TX_CLASS_ALARM) && !alarm_backlog_is_empty(&m_esp_backlog)) ||
+         (alarm_tx_sched_free_get(&m_uart_tx, tx_class) == 0)))
+    {
+        return alarm_backlog_put(&m_esp_backlog, frame, len);
+    }
+
+    return alarm_tx_sched_put(&m_uart_tx, tx_class, frame, len);
+}
+
+
+/**@brief Function for queueing a message for the ESP without acknowledgement.
+ *
+ * @details Frames the link cannot take are stored until the ESP drains it again.
+ */
+static ret_code_t esp_send(alarm_frame_type_t type,
+                           alarm_tx_class_t   tx_class,
+                           uint8_t const    * p_payload,
+                           uint16_t           length)
+{
+    return esp_frame_put(type, esp_seq_next(), tx_class, p_payload, length, true);
+}
+
+#if ALARM_RELAY_ENABLED
+/**@brief Function for forwarding the state of a neighbouring Alarm node to the ESP.
+ *
+ * @details State changes go in the alarm class, refreshes in the telemetry class, so a room full
+ *          of quiet nodes cannot delay a local alarm.
+ */
+static void relay_handler(alarm_relay_update_t const * p_update)
+{
+    ret_code_t err_code;
+    uint8_t    payload[RELAY_PAYLOAD_LEN];
+    uint16_t   len = 0;
+
+    memcpy(&payload[len], p_update->p_addr->addr, BLE_GAP_ADDR_LEN);
+    len           += BLE_GAP_ADDR_LEN;
+    payload[len++] = (uint8_t)p_update->rssi;
+    memcpy(&payload[len], p_update->p_payload, p_update->length);
+    len           += p_update->length;
+
+    err_code = esp_send(ALARM_FRAME_TYPE_RELAY,
+                        p_update->urgent ? ALARM_TX_CLASS_ALARM : ALARM_TX_CLASS_TELEMETRY,
+                        payload,
+                        len);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Relay frame dropped (error 0x%x).", err_code);
+    }
+}
+
+/**@brief Function for scanning for neighbouring Alarm nodes.
+ *
+ * @details Needs the SoftDevice enabled; runs once advertising has started.
+ */
+static void relay_init(void)
+{
+    ret_code_t err_code = alarm_relay_init(&m_adv_uuids[0], relay_handler);
+    APP_ERROR_CHECK(err_code);
+}
+#endif
+
+#if ALARM_FLOOD_ENABLED
+/**@brief Function for putting a flood message on air in place of the snapshot, or removing it.
+ *
+ * @details While connected nothing is advertised, so the message is only relayed by the
+ *          neighbours that already heard it.
+ */
+static void flood_publish(uint8_t const * p_payload, uint16_t length)
+{
+    alarm_adv_override_set(p_payload, length);
+    if (m_adv_data_live)
+    {
+        adv_snapshot_update();
+    }
+}
+
+/**@brief Function for forwarding a flooded alarm event to the ESP. */
+static void flood_deliver(alarm_flood_msg_t const * p_msg)
+{
+    ret_code_t err_code;
+    uint8_t    payload[11];
+    uint16_t   len = 0;
+
+    len           += uint32_encode(p_msg->src, &payload[len]);
+    len           += uint16_encode(p_msg->seq, &payload[len]);
+    payload[len++] = ALARM_FLOOD_TTL - p_msg->ttl + 1;
+    len           += uint16_encode(p_msg->age_ms, &payload[len]);
+    payload[len++] = p_msg->zone;
+    payload[len++] = p_msg->flags;
+
+    err_code = esp_send(ALARM_FRAME_TYPE_FLOOD, ALARM_TX_CLASS_ALARM, payload, len);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Flood frame dropped (error 0x%x).", err_code);
+    }
+}
+
+/**@brief Function for logging flood propagation: duplicate rate, mean hops and latency. */
+static void flood_stats_log(void)
+{
+    alarm_flood_stats_t const * p_stats   = alarm_flood_stats_get();
+    uint32_t                    delivered = p_stats->received - p_stats->duplicates;
+
+    NRF_LOG_INFO("Flood: %u originated, %u heard, %u duplicates, %u rebroadcast, %u suppressed.",
+                 p_stats->originated, p_stats->received, p_stats->duplicates,
+                 p_stats->rebroadcast, p_stats->suppressed);
+    if (delivered != 0)
+    {
+        NRF_LOG_INFO("Flood: %u delivered, %u hops x10 mean, %u ms mean age, %u ms max.",
+                     delivered, (p_stats->hops_sum * 10) / delivered,
+                     p_stats->age_sum_ms / delivered, p_stats->age_max_ms);
+    }
+}
+
+/**@brief Function for giving the flood duplicate cache its time base. */
+static uint32_t flood_clock(void)
+{
+    return m_uptime_s;
+}
+
+/**@brief Function for initializing multi-hop flooding of alarm events.
+ *
+ * @details The device id in FICR identifies this node as a flood source.
+ */
+static void flood_init(void)
+{
+    ret_code_t         err_code;
+    alarm_flood_init_t init;
+
+    init.src     = NRF_FICR->DEVICEID[0];
+    init.publish = flood_publish;
+    init.deliver = flood_deliver;
+    init.clock   = flood_clock;
+
+    err_code = alarm_flood_init(&init);
+    APP_ERROR_CHECK(err_code);
+}
+#endif
+
+/**@brief Function for draining scheduled notifications into the SoftDevice.
+ *
+ * @details Frames are only handed over by a pushed drain, ahead of a radio event or for an alarm;
+ *          until then they wait in the scheduler. A full SoftDevice queue is retried ahead of the
+ *          next radio event. Any other error means there is nobody to deliver to, so the frame is
+ *          consumed and dropped. The first byte of a frame selects the characteristic.
+ */
+static uint16_t ble_tx_sink(uint8_t const * p_data, uint16_t length, bool pushed)
+{
+    uint16_t   len = length - 1;
+    ret_code_t err_code;
+
+    if (!pushed)
+    {
+        return 0;
+    }
+
+    err_code = ble_alarm_notify(&m_alarm, (ble_alarm_char_t)p_data[0], (uint8_t *)&p_data[1], &len, m_conn_handle);
+    if (err_code == NRF_SUCCESS)
+    {
+        m_ble_tx_bytes += len;
+    }
+
+    return (err_code == NRF_ERROR_RESOURCES) ? 0 : length;
+}
+
+
+/**@brief Function for checking whether notifications wait in the scheduler. */
+static bool ble_tx_pending(void)
+{
+    for (uint8_t tx_class = 0; tx_class < ALARM_TX_CLASS_COUNT; tx_class++)
+    {
+        if (alarm_tx_sched_free_get(&m_ble_tx, (alarm_tx_class_t)tx_class) != TX_SCHED_QUEUE_LEN)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**@brief Function for switching connection event length extension.
+ *
+ * @details With it, a connection event carries on past NRF_SDH_BLE_GAP_EVENT_LENGTH for as long
+ *          as both sides have data and the radio is free, so a bulk transfer is bounded by the
+ *          SoftDevice queue rather than by the event length. It stays off otherwise, so
+ *          scanning for neighbours keeps its radio time.
+ */
+static void bulk_mode_set(bool on)
+{
+    ret_code_t err_code;
+    ble_opt_t  opt;
+
+    if (on == m_bulk_mode)
+    {
+        return;
+    }
+
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = on ? 1 : 0;
+
+    err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    if (err_code == NRF_SUCCESS)
+    {
+        m_bulk_mode = on;
+    }
+}
+
+
+/**@brief Function for filling the SoftDevice queue ahead of a radio event.
+ *
+ * @details Runs from the radio notification while notifications wait, so the next connection
+ *          event goes out with as many packets as the SoftDevice queue holds. The peer backlog
+ *          fills what the scheduled frames leave. The notification is disarmed once the scheduler
+ *          is empty, so idle connection events do not wake the CPU; the backlog carries on from
+ *          TX complete. Bulk mode is on while bulk frames or backlog records are left over for
+ *          the next event.
+ */
+static void ble_tx_batch(void)
+{
+    alarm_tx_sched_push(&m_ble_tx);
+    alarm_backlog_drain(&m_peer_backlog);
+    bulk_mode_set((alarm_tx_sched_free_get(&m_ble_tx, ALARM_TX_CLASS_BULK) != TX_SCHED_QUEUE_LEN) ||
+                  (m_tlm_enabled && !alarm_backlog_is_empty(&m_peer_backlog)));
+
+    CRITICAL_REGION_ENTER();
+    // A frame queued from a higher interrupt level since the drain re-armed the notification.
+    if (!ble_tx_pending())
+    {
+        alarm_radio_disarm();
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+
+/**@brief Function for queueing a notification of an Alarm service characteristic.
+ *
+ * @details Notifications are batched ahead of the next radio event. Alarm frames are handed to
+ *          the SoftDevice at once, so one queued in the last moments before a connection event
+ *          still makes it.
+ */
+static ret_code_t ble_tx_char_put(ble_alarm_char_t   characteristic,
+                                  alarm_tx_class_t   tx_class,
+                                  uint8_t const    * p_data,
+                                  uint16_t           length)
+{
+    uint8_t    frame[BLE_TX_FRAME_MAX_LEN];
+    ret_code_t err_code;
+
+    if ((length == 0) || (length > BLE_NUS_MAX_DATA_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    frame[0] = (uint8_t)characteristic;
+    memcpy(&frame[1], p_data, length);
+
+    err_code = alarm_tx_sched_put(&m_ble_tx, tx_class, frame, length + 1);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    if (tx_class == ALARM_TX_CLASS_ALARM)
+    {
+        alarm_tx_sched_push(&m_ble_tx);
+    }
+
+    if (ble_tx_pending())
+    {
+        alarm_radio_arm();
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for queueing a TX notification, see @ref ble_tx_char_put. */
+static ret_code_t ble_tx_put(alarm_tx_class_t tx_class, uint8_t const * p_data, uint16_t length)
+{
+    return ble_tx_char_put(BLE_ALARM_CHAR_TX, tx_class, p_data, length);
+}
+
+
+/**@brief Function for initializing notification batching. Must run before any role starts. */
+static void ble_tx_batch_init(void)
+{
+    ret_code_t err_code = alarm_radio_init(ble_tx_batch);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for logging packets per connection event and CPU wakeups of the last connection. */
+static void ble_tx_batch_log(void)
+{
+    uint32_t conn_s = ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_connected_at)) / 1000;
+
+    NRF_LOG_INFO("Notifications: %u in %u connection events (max %u per event), %u radio notifications.",
+                 m_hvn_packets, m_hvn_events, m_hvn_packets_max,
+                 alarm_radio_stats_get()->notifications);
+    NRF_LOG_INFO("CPU wakeups: %u per second mean, %u max.",
+                 (m_wakeups - m_wakeups_at_conn) / MAX(conn_s, 1), m_wakeups_per_s_max);
+    NRF_LOG_INFO("Notification throughput: %u B/s mean, %u B/s best second.",
+                 (m_ble_tx_bytes - m_ble_tx_bytes_at_conn) / MAX(conn_s, 1), m_ble_tx_bps_max);
+}
+
+
+/**@brief Function for draining scheduled frames into the ESP link.
+ *
+ * @details Stops at the first byte the link refuses; the rest follows on ALARM_ESP_EVT_TX_READY.
+ */
+static uint16_t uart_tx_sink(uint8_t const * p_data, uint16_t length, bool pushed)
+{
+    UNUSED_PARAMETER(pushed);
+
+    return alarm_esp_write(p_data, length);
+}
+
+
+/**@brief Function for initializing the outbound schedulers of the BLE and UART links.
+ */
+static void tx_sched_init(void)
+{
+    ret_code_t err_code;
+
+    err_code = alarm_tx_sched_init(&m_ble_tx, ble_tx_sink);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = alarm_tx_sched_init(&m_uart_tx, uart_tx_sink);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for logging the per-class counters and queueing delays of a scheduler.
+ */
+static void tx_sched_log(char const * p_link, alarm_tx_sched_t const * p_sched)
+{
+    for (uint8_t tx_class = 0; tx_class < ALARM_TX_CLASS_COUNT; tx_class++)
+    {
+        alarm_tx_class_stats_t const * p_stats = alarm_tx_sched_stats_get(p_sched, (alarm_tx_class_t)tx_class);
+
+        if (p_stats->enqueued == 0)
+        {
+            continue;
+        }
+
+        NRF_LOG_INFO("%s class %u: %u sent, %u dropped, delay avg %u max %u ms.",
+                     p_link, tx_class, p_stats->sent, p_stats->dropped,
+                     ALARM_TICKS_TO_MS(p_stats->delay_sum / MAX(p_stats->sent, 1)),
+                     ALARM_TICKS_TO_MS(p_stats->delay_max));
+    }
+}
+
+
+/**@brief Function for giving the backlogs their time base. */
+static uint32_t backlog_clock(void)
+{
+    return m_uptime_s;
+}
+
+
+/**@brief Function for handing stored frames back to the ESP link.
+ *
+ * @details The backlog goes out in the bulk class, so it fills whatever the live traffic leaves
+ *          of the link without holding up new alarms.
+ */
+static bool esp_backlog_deliver(uint8_t const * p_data, uint16_t length)
+{
+    return (alarm_tx_sched_free_get(&m_uart_tx, ALARM_TX_CLASS_BULK) != 0) &&
+           (alarm_tx_sched_put(&m_uart_tx, ALARM_TX_CLASS_BULK, p_data, length) == NRF_SUCCESS);
+}
+
+
+/**@brief Function for handing stored events to the peer once it listens on TX again.
+ *
+ * @details A record goes straight to the SoftDevice and only counts as delivered once the
+ *          SoftDevice took it, so a link that drops, or a full queue, leaves it in the backlog.
+ *          Scheduled frames go first: the backlog only fills the SoftDevice queue once the
+ *          scheduler is empty, ahead of a radio event or on TX complete.
+ */
+static bool peer_backlog_deliver(uint8_t const * p_data, uint16_t length)
+{
+    uint16_t len = length;
+
+    if (!m_tlm_enabled || ble_tx_pending())
+    {
+        return false;
+    }
+
+    if (ble_alarm_notify(&m_alarm, BLE_ALARM_CHAR_TX, (uint8_t *)p_data, &len, m_conn_handle) != NRF_SUCCESS)
+    {
+        return false;
+    }
+
+    m_ble_tx_bytes += len;
+    return true;
+}
+
+
+/**@brief Function for initializing store-and-forward towards the ESP and the peer.
+ *
+ * @details Registers with FDS, so it must run before the Peer Manager initializes FDS.
+ */
+static void backlog_init(void)
+{
+    ret_code_t           err_code;
+    alarm_backlog_init_t init;
+
+    init.clock   = backlog_clock;
+
+    init.policy  = ESP_BACKLOG_POLICY;
+    init.deliver = esp_backlog_deliver;
+    err_code = alarm_backlog_init(&m_esp_backlog, &init);
+    APP_ERROR_CHECK(err_code);
+
+    init.policy  = PEER_BACKLOG_POLICY;
+    init.deliver = peer_backlog_deliver;
+    err_code = alarm_backlog_init(&m_peer_backlog, &init);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for logging the depth, age and counters of a backlog.
+ */
+static void backlog_log(char const * p_peer, alarm_backlog_t const * p_backlog)
+{
+    alarm_backlog_depth_t         depth;
+    alarm_backlog_stats_t const * p_stats = alarm_backlog_stats_get(p_backlog);
+
+    alarm_backlog_depth_get(p_backlog, &depth);
+
+    NRF_LOG_INFO("%s backlog: %u in RAM (%u B), %u in %u flash chunks, oldest %u s.",
+                 p_peer, depth.ram_records, depth.ram_bytes, depth.flash_records,
+                 depth.flash_chunks, depth.oldest_age_s);
+    NRF_LOG_INFO("%s backlog: %u stored, %u spilled, %u forwarded (max age %u s), %u dropped, %u flash errors.",
+                 p_peer, p_stats->stored, p_stats->spilled, p_stats->forwarded,
+                 p_stats->age_max_s, p_stats->dropped, p_stats->flash_errors);
+}
+
+
+/**@brief Function for logging the rate, throughput and error counters of the ESP link.
+ */
+static void esp_stats_log(void)
+{
+    alarm_esp_stats_t const * p_stats = alarm_esp_stats_get();
+
+    NRF_LOG_INFO("ESP link: %u baud, flow control %s, %u B/s (max %u), %u bytes out.",
+                 alarm_esp_rate_bps(p_stats->rate), p_stats->hwfc ? "on" : "off",
+                 p_stats->tx_bps, p_stats->tx_bps_max, p_stats->tx_bytes);
+    NRF_LOG_INFO("ESP link: %u framing, %u overrun errors, %u fallbacks.",
+                 p_stats->framing_errors, p_stats->overrun_errors, p_stats->fallbacks);
+    NRF_LOG_INFO("ESP link: %u bytes in, %u full RX buffers, %u idle flushes.",
+                 p_stats->rx_bytes, p_stats->rx_buffers, p_stats->rx_idle_flushes);
+    NRF_LOG_INFO("ESP link: %u frames in, %u CRC errors, %u overruns.",
+                 m_esp_rx.frames, m_esp_rx.crc_errors, m_esp_rx.overruns);
+
+    if (p_stats->gated && (m_uptime_s != 0))
+    {
+        uint32_t wakes       = p_stats->wakes_local + p_stats->wakes_remote;
+        uint32_t asleep_pmil = MIN(p_stats->asleep_ms / m_uptime_s, 1000);
+
+        NRF_LOG_INFO("ESP power: UARTE off %u.%u%% of the time, about %u uA saved, %u sleeps.",
+                     asleep_pmil / 10, asleep_pmil % 10,
+                     (ESP_UART_ON_CURRENT_UA * asleep_pmil) / 1000, p_stats->sleeps);
+        NRF_LOG_INFO("ESP power: %u local and %u remote wakes, latency avg %u max %u us, %u timeouts.",
+                     p_stats->wakes_local, p_stats->wakes_remote,
+                     p_stats->wake_latency_sum_us / MAX(wakes, 1), p_stats->wake_latency_max_us,
+                     p_stats->wake_timeouts);
+    }
+}
+
+
+/**@brief Function for filling in the link counters of a status value. */
+static void tx_counters_snapshot(ble_alarm_status_t * p_status)
+{
+    uint32_t dropped = 0;
+
+    for (uint8_t tx_class = 0; tx_class < ALARM_TX_CLASS_COUNT; tx_class++)
+    {
+        dropped += alarm_tx_sched_stats_get(&m_ble_tx,  (alarm_tx_class_t)tx_class)->dropped;
+        dropped += alarm_tx_sched_stats_get(&m_uart_tx, (alarm_tx_class_t)tx_class)->dropped;
+    }
+    dropped += alarm_backlog_stats_get(&m_esp_backlog)->dropped;
+    dropped += alarm_backlog_stats_get(&m_peer_backlog)->dropped;
+
+    p_status->tx_dropped      = (uint16_t)MIN(dropped, UINT16_MAX);
+    p_status->alarm_delay_max = (uint16_t)MIN(ALARM_TICKS_TO_MS(alarm_tx_sched_stats_get(&m_uart_tx, ALARM_TX_CLASS_ALARM)->delay_max),
+                                              UINT16_MAX);
+}
+
+
+/**@brief Function for refreshing the Status characteristic right before a peer reads it.
+ *
+ * @details Battery and RSSI are already stored live; only the zone latch and link counters are
+ *          collected here. Runs inside the read authorization, so it must stay constant-time.
+ */
+static void status_snapshot(ble_alarm_status_t * p_status)
+{
+    p_status->zones = (uint16_t)nrf_atomic_u32_fetch_store(&m_zones_tripped, 0);
+    tx_counters_snapshot(p_status);
+}
+
+
+/**@brief Function for notifying a zone trip on TX, or storing it until the peer listens.
+ *
+ * @details Stored events keep their order: while any are waiting, new ones queue up behind them.
+ */
+static void event_notify(uint8_t zone)
+{
+    uint8_t  notif[EVENT_NOTIF_LEN];
+    uint16_t len = 0;
+
+    notif[len++] = (uint8_t)((ALARM_TLM_FRAME_EVENT << 4) | zone);
+    len         += uint32_encode(m_uptime_s, &notif[len]);
+    notif[len++] = m_alarm.status.flags;
+
+    if (m_tlm_enabled &&
+        alarm_backlog_is_empty(&m_peer_backlog) &&
+        (alarm_tx_sched_free_get(&m_ble_tx, ALARM_TX_CLASS_ALARM) != 0) &&
+        (ble_tx_put(ALARM_TX_CLASS_ALARM, notif, len) == NRF_SUCCESS))
+    {
+        return;
+    }
+
+    if (alarm_backlog_put(&m_peer_backlog, notif, len) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Zone %u trip event dropped, backlog full.", zone);
+    }
+}
+
+
+/**@brief Function for recording a zone trip for the Status characteristic, the advertised
+ *        snapshot and the TX event stream. Safe to call from interrupt context.
+ */
+static void zone_trip(uint8_t zone)
+{
+    (void)nrf_atomic_u32_or(&m_zones_tripped, 1UL << zone);
+    (void)nrf_atomic_u32_or(&m_zones_unseen,  1UL << zone);
+    (void)nrf_atomic_u32_add(&m_zone_trips[zone], 1);
+
+    m_last_event_at_s = m_uptime_s;
+    m_last_event_zone = zone;
+
+    event_notify(zone);
+
+#if ALARM_FLOOD_ENABLED
+    if (alarm_flood_originate(zone, m_alarm.status.flags) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Zone %u trip not flooded, queue full.", zone);
+    }
+#endif
+}
+
+
+/**@brief Function for publishing the current alarm state in the advertising data.
+ *
+ * @details Extended builds (s140) advertise the full snapshot, legacy builds the short one.
+ *          Errors are not fatal: the previous snapshot simply stays on air.
+ */
+static void adv_snapshot_update(void)
+{
+    alarm_adv_snapshot_t snapshot;
+    ret_code_t           err_code;
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.status           = m_alarm.status;
+    tx_counters_snapshot(&snapshot.status);
+    snapshot.zones            = (uint16_t)m_zones_unseen;
+    snapshot.last_event_zone  = m_last_event_zone;
+    snapshot.last_event_age_s = (snapshot.last_event_zone == ALARM_ADV_EVENT_NONE)
+                                ? 0 : (uint16_t)MIN(m_uptime_s - m_last_event_at_s, UINT16_MAX);
+    snapshot.alarm_count      = (uint16_t)MIN(m_alarm_count, UINT16_MAX);
+    snapshot.uptime_s         = m_uptime_s;
+
+    for (uint8_t zone = 0; zone < ALARM_ADV_ZONE_COUNT; zone++)
+    {
+        snapshot.zone_trips[zone] = (uint16_t)MIN(m_zone_trips[zone], UINT16_MAX);
+    }
+
+    err_code = alarm_adv_update(&m_advertising, &snapshot);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Advertised snapshot not updated: 0x%x.", err_code);
+    }
+}
+
+
+/**@brief Function for sending a command frame on behalf of the acknowledgement window.
+ *
+ * @details Alarm commands go in the alarm class, everything else in the control class. Commands
+ *          are never stored: the window retransmits them and reports the outcome to the peer.
+ */
+static ret_code_t ack_send(uint8_t type, uint8_t seq, uint8_t const * p_payload, uint16_t length)
+{
+    alarm_tx_class_t tx_class = (type == ALARM_FRAME_TYPE_ALARM) ? ALARM_TX_CLASS_ALARM
+                                                                 : ALARM_TX_CLASS_CONTROL;
+
+    return esp_frame_put((alarm_frame_type_t)type, seq, tx_class, p_payload, length, false);
+}
+
+
+/**@brief Function for notifying the peer whether the ESP got one of its commands.
+ *
+ * @details Sent on TX as an @ref ALARM_TLM_FRAME_ACK frame. The command id counts the RX writes
+ *          of the peer on this connection, from 0; every write is reported once, including
+ *          those dropped over budget or absorbed as repeats, so the peer can match ids to its
+ *          own count.
+ */
+static void ack_report(alarm_ack_report_t const * p_report)
+{
+    uint8_t  notif[ACK_NOTIF_LEN];
+    uint16_t len = 0;
+
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    notif[len++] = (uint8_t)((ALARM_TLM_FRAME_ACK << 4) | p_report->status);
+    len         += uint16_encode(p_report->cmd_id, &notif[len]);
+    notif[len++] = p_report->retries;
+    len         += uint16_encode(p_report->rtt_ms, &notif[len]);
+
+    if (ble_tx_put(ALARM_TX_CLASS_CONTROL, notif, len) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Delivery report of command %u dropped.", p_report->cmd_id);
+    }
+}
+
+
+/**@brief Function for reporting a peer write that never reached the window. */
+static void cmd_report(uint16_t cmd_id, alarm_ack_status_t status)
+{
+    alarm_ack_report_t rpt;
+
+    if (cmd_id == ALARM_ACK_CMD_ID_NONE)
+    {
+        return;
+    }
+
+    memset(&rpt, 0, sizeof(rpt));
+    rpt.cmd_id = cmd_id;
+    rpt.status = status;
+
+    ack_report(&rpt);
+}
+
+
+/**@brief Function for taking the command id of an RX write.
+ *
+ * @details Only writes of the peer take an id; a local alarm gets @ref ALARM_ACK_CMD_ID_NONE and
+ *          is delivered without a report.
+ */
+static uint16_t cmd_id_next(ble_alarm_evt_t const * p_evt)
+{
+    uint16_t cmd_id;
+
+    if (p_evt->conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return ALARM_ACK_CMD_ID_NONE;
+    }
+
+    cmd_id   = m_cmd_id;
+    m_cmd_id = (uint16_t)((m_cmd_id + 1) % ALARM_ACK_CMD_ID_NONE);
+
+    return cmd_id;
+}
+
+
+/**@brief Function for logging delivery counters and round-trip times of the peer's commands. */
+static void ack_stats_log(void)
+{
+    alarm_ack_stats_t const * p_stats = alarm_ack_stats_get();
+
+    NRF_LOG_INFO("Commands: %u sent, %u delivered, %u failed, %u refused, %u retransmissions.",
+                 p_stats->sent, p_stats->delivered, p_stats->failed,
+                 p_stats->busy, p_stats->retransmits);
+    if (p_stats->delivered != 0)
+    {
+        NRF_LOG_INFO("Command round trip: %u ms min, %u ms mean, %u ms max.",
+                     p_stats->rtt_min_ms, p_stats->rtt_sum_ms / p_stats->delivered,
+                     p_stats->rtt_max_ms);
+    }
+}
+
+
+/**@brief Function for initializing acknowledged delivery of the peer's commands. */
+static void ack_init(void)
 {
-    // Initialize timer module.
-    ret_code_t err_code = app_timer_init();
-    APP_ERROR_CHECK(err_code);
-		
-		err_code = app_timer_create(&m_notification_timer_id, APP_TIMER_MODE_REPEATED, notification_timeout_handler);
+    ret_code_t       err_code;
+    alarm_ack_init_t init;
+
+    init.send   = ack_send;
+    init.report = ack_report;
+
+    err_code = alarm_ack_init(&init);
     APP_ERROR_CHECK(err_code);
 }
 
 
-/**@brief Function for the GAP initialization.
- *
- * @details This function sets up all the necessary GAP (Generic Access Profile) parameters of the
- *          device including the device name, appearance, and the preferred connection parameters.
- */
-static void gap_params_init(void)
+/**@brief Function for telling the ESP how many copies of an alarm were absorbed. */
+static void dedup_report(alarm_dedup_report_t const * p_report)
 {
-    ret_code_t              err_code;
-    ble_gap_conn_params_t   gap_conn_params;
-    ble_gap_conn_sec_mode_t sec_mode;
+    ret_code_t err_code;
+    uint8_t    payload[3];
 
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
+    payload[0] = p_report->seq;
+    (void)uint16_encode(p_report->repeats, &payload[1]);
 
-    err_code = sd_ble_gap_device_name_set(&sec_mode,
-                                          (const uint8_t *)DEVICE_NAME,
-                                          strlen(DEVICE_NAME));
-    APP_ERROR_CHECK(err_code);
+    err_code = esp_send(ALARM_FRAME_TYPE_REPEAT, ALARM_TX_CLASS_CONTROL, payload, sizeof(payload));
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Repeat count of alarm frame %u dropped.", p_report->seq);
+    }
+}
 
-    memset(&gap_conn_params, 0, sizeof(gap_conn_params));
 
-    gap_conn_params.min_conn_interval = MIN_CONN_INTERVAL;
-    gap_conn_params.max_conn_interval = MAX_CONN_INTERVAL;
-    gap_conn_params.slave_latency     = SLAVE_LATENCY;
-    gap_conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
+/**@brief Function for logging how many alarm copies were coalesced. */
+static void dedup_stats_log(void)
+{
+    alarm_dedup_stats_t const * p_stats = alarm_dedup_stats_get();
 
-    err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
-    APP_ERROR_CHECK(err_code);
+    NRF_LOG_INFO("Alarms: %u forwarded, %u copies absorbed, %u repeat counts sent, %u windows cut short.",
+                 p_stats->forwarded, p_stats->absorbed, p_stats->reports, p_stats->evicted);
 }
 
 
-/**@brief Function for initializing the GATT module.
- */
-static void gatt_init(void)
+/**@brief Function for initializing the coalescing of repeated alarm commands. */
+static void dedup_init(void)
 {
-    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, NULL);
+    ret_code_t         err_code;
+    alarm_dedup_init_t init;
+
+    init.report = dedup_report;
+
+    err_code = alarm_dedup_init(&init);
     APP_ERROR_CHECK(err_code);
 }
 
 
-/**@brief Function for handling Queued Write Module errors.
+/**@brief Function for queueing a command from the peer for the ESP.
  *
- * @details A pointer to this function will be passed to each service which may need to inform the
- *          application about an error.
+ * @details The command stays in the acknowledgement window until the ESP confirms it; the
+ *          outcome is notified to the peer under @p cmd_id, see @ref cmd_id_next.
  *
- * @param[in]   nrf_error   Error code containing information about what went wrong.
+ * @return      NRF_SUCCESS if the command was taken into the acknowledgement window.
  */
-static void nrf_qwr_error_handler(uint32_t nrf_error)
+static ret_code_t send_to_esp(ble_alarm_evt_t * p_evt, alarm_frame_type_t type, uint8_t seq, uint16_t cmd_id)
 {
-    APP_ERROR_HANDLER(nrf_error);
+    ret_code_t err_code = alarm_ack_send(type,
+                                         seq,
+                                         p_evt->params.alarm_data.p_data,
+                                         p_evt->params.alarm_data.length,
+                                         cmd_id);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("ESP command refused (type %c, error 0x%x).", type, err_code);
+        if (err_code != NRF_ERROR_NO_MEM)
+        {
+            // A full window reports itself.
+            cmd_report(cmd_id, ALARM_ACK_STATUS_FAILED);
+        }
+    }
+
+    return err_code;
 }
 
-void send_to_esp(ble_alarm_evt_t * p_evt)
+/**@brief Function for logging the time from connection to the first command of the peer.
+ *
+ * @details A bonded client that trusts its cached handles writes its first command without
+ *          service discovery, so this is where a stable GATT layout shows.
+ */
+static void first_cmd_log(void)
 {
-		ret_code_t err_code;
-		for (uint32_t i = 0; i < p_evt->params.alarm_data.length; i++)
-		{
-			do
-			{
-				err_code = app_uart_put(p_evt->params.alarm_data.p_data[i]);
-			}while(err_code == NRF_ERROR_BUSY);
-		}
+    if (m_first_cmd_pending)
+    {
+        m_first_cmd_pending = false;
+        NRF_LOG_INFO("First command %u ms after connection.",
+                     ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_connected_at)));
+    }
 }
 
 /**@brief Function for handling the Custom Service Service events.
@@ -247,31 +1386,97 @@ static void on_alarm_evt(ble_alarm_t     * p_alarm_service,
 				case BLE_ALARM_EVT_NOTIFICATION_ENABLED:
 						err_code = app_timer_start(m_notification_timer_id, NOTIFICATION_INTERVAL, NULL);
 						APP_ERROR_CHECK(err_code);
+            m_tlm_enabled = true;
+            alarm_backlog_drain(&m_peer_backlog);
             break;
 
         case BLE_ALARM_EVT_NOTIFICATION_DISABLED:
 						err_code = app_timer_stop(m_notification_timer_id);
 						APP_ERROR_CHECK(err_code);
+            m_tlm_enabled = false;
             break;
 				
         case BLE_ALARM_EVT_CONNECTED:
+            p_alarm_service->status.flags &= (uint8_t)~BLE_ALARM_STATUS_FLAG_ALARM;
+            (void)nrf_atomic_u32_store(&m_zones_unseen, 0);
             break;
 
         case BLE_ALARM_EVT_DISCONNECTED:
             break;
+
+        case BLE_ALARM_EVT_STATUS_READ:
+            status_snapshot(&p_alarm_service->status);
+            break;
+
+        case BLE_ALARM_EVT_STATS_READ:
+            p_evt->params.read.length = alarm_stats_encode(p_evt->params.read.p_data);
+            break;
+
+        case BLE_ALARM_EVT_SENSOR_NOTIFY:
+            // A full queue drops this report; the value stays readable.
+            (void)ble_tx_char_put(BLE_ALARM_CHAR_SENSOR,
+                                  ALARM_TX_CLASS_TELEMETRY,
+                                  p_evt->params.alarm_data.p_data,
+                                  p_evt->params.alarm_data.length);
+            break;
+
+        case BLE_ALARM_EVT_CONFIG_WRITE:
+            err_code = alarm_config_stage(p_evt->params.config.p_data, p_evt->params.config.length);
+            p_evt->params.config.gatt_status = config_gatt_status(err_code);
+            if (err_code == NRF_SUCCESS)
+            {
+                err_code = alarm_config_commit();
+                APP_ERROR_CHECK(err_code);
+                NRF_LOG_INFO("Configuration committed.");
+            }
+            break;
+
 				case BLE_ALARM_EVT_ALARM:
+        {
+            uint16_t cmd_id = cmd_id_next(p_evt);
+            uint8_t  seq;
+
+            if (p_evt->conn_handle != BLE_CONN_HANDLE_INVALID)
+            {
+                first_cmd_log();
+            }
+            // A copy of an alarm already forwarded is only counted.
+            if (alarm_dedup_is_repeat(p_evt->params.alarm_data.p_data, p_evt->params.alarm_data.length))
+            {
+                cmd_report(cmd_id, ALARM_ACK_STATUS_REPEAT);
+                break;
+            }
 						nrf_gpio_pin_set(4);
-						send_to_esp(p_evt);
+            p_alarm_service->status.flags |= BLE_ALARM_STATUS_FLAG_ALARM;
+            m_alarm_count++;
+            seq = esp_seq_next();
+            if (send_to_esp(p_evt, ALARM_FRAME_TYPE_ALARM, seq, cmd_id) == NRF_SUCCESS)
+            {
+                alarm_dedup_add(p_evt->params.alarm_data.p_data, p_evt->params.alarm_data.length, seq);
+            }
 						break;
+        }
 				case BLE_ALARM_EVT:
-						send_to_esp(p_evt);
+            first_cmd_log();
+						(void)send_to_esp(p_evt, ALARM_FRAME_TYPE_COMMAND, esp_seq_next(), cmd_id_next(p_evt));
 						break;
+
+        case BLE_ALARM_EVT_RX_REJECTED:
+            first_cmd_log();
+            cmd_report(cmd_id_next(p_evt), ALARM_ACK_STATUS_DROPPED);
+            break;
         default:
               // No implementation needed.
               break;
     }
 }
 
+/**@brief Function for giving the RX budget its time base over long idle times. */
+static uint32_t rx_budget_clock(void)
+{
+    return m_uptime_s;
+}
+
 /**@brief Function for initializing services that will be used by the application.
  */
 static void services_init(void)
@@ -281,7 +1486,10 @@ static void services_init(void)
 		nrf_ble_qwr_init_t qwr_init = {0};
 
     // Initialize Queued Write Module.
-    qwr_init.error_handler = nrf_qwr_error_handler;
+    qwr_init.error_handler     = nrf_qwr_error_handler;
+    qwr_init.mem_buffer.p_mem  = m_qwr_mem;
+    qwr_init.mem_buffer.len    = sizeof(m_qwr_mem);
+    qwr_init.callback          = qwr_evt_handler;
 
     err_code = nrf_ble_qwr_init(&m_qwr, &qwr_init);
     APP_ERROR_CHECK(err_code);
@@ -294,9 +1502,18 @@ static void services_init(void)
 		
 		// Set the cus event handler
     alarm_init.evt_handler                = on_alarm_evt;
+
+    alarm_init.rx_budget[BLE_ALARM_RX_CLASS_ALARM].rate  = RX_ALARM_RATE;
+    alarm_init.rx_budget[BLE_ALARM_RX_CLASS_ALARM].burst = RX_ALARM_BURST;
+    alarm_init.rx_budget[BLE_ALARM_RX_CLASS_BULK].rate   = RX_BULK_RATE;
+    alarm_init.rx_budget[BLE_ALARM_RX_CLASS_BULK].burst  = RX_BULK_BURST;
+    alarm_init.clock                                     = rx_budget_clock;
 		
 		err_code = ble_alarm_init(&m_alarm, &alarm_init);
     APP_ERROR_CHECK(err_code);	
+
+    err_code = nrf_ble_qwr_attr_register(&m_qwr, BLE_ALARM_HANDLES(&m_alarm, CONFIG).value_handle);
+    APP_ERROR_CHECK(err_code);
 }
 
 
@@ -332,6 +1549,130 @@ static void conn_params_error_handler(uint32_t nrf_error)
 }
 
 
+/**@brief Function for handling the SAADC sampling pipeline events.
+ *
+ * @details Limit hits are published immediately. Block statistics are published round-robin,
+ *          one channel every @ref SENSOR_REPORT_BLOCKS blocks, so the raw samples never go
+ *          over the air.
+ *
+ * @param[in]   p_evt   Event from the SAADC pipeline.
+ */
+static void saadc_evt_handler(alarm_saadc_evt_t const * p_evt)
+{
+    static uint8_t            block_count;
+    static uint8_t            report_channel;
+    ble_alarm_sensor_report_t report;
+
+    memset(&report, 0, sizeof(report));
+
+    switch (p_evt->evt_type)
+    {
+        case ALARM_SAADC_EVT_BLOCK:
+        {
+            alarm_glassbreak_feed(p_evt->params.block.p_samples,
+                                  p_evt->params.block.scan_count,
+                                  ALARM_SAADC_CH_COUNT,
+                                  ALARM_SAADC_CH_MIC);
+
+            alarm_stats_add(ALARM_STATS_CH_MIC,       p_evt->params.block.p_stats[ALARM_SAADC_CH_MIC].mean);
+            alarm_stats_add(ALARM_STATS_CH_VIBRATION, p_evt->params.block.p_stats[ALARM_SAADC_CH_VIBRATION].mean);
+            alarm_stats_add(ALARM_STATS_CH_BATTERY,   p_evt->params.block.p_stats[ALARM_SAADC_CH_BATTERY].mean);
+
+            m_alarm.status.battery = p_evt->params.block.p_stats[ALARM_SAADC_CH_BATTERY].mean;
+
+            if (m_tlm_enabled)
+            {
+                int16_t row[ALARM_SAADC_CH_COUNT];
+
+                for (uint8_t ch = 0; ch < ALARM_SAADC_CH_COUNT; ch++)
+                {
+                    row[ch] = p_evt->params.block.p_stats[ch].mean;
+                }
+                alarm_tlm_put(&m_tlm, row);
+            }
+
+            if (++block_count < SENSOR_REPORT_BLOCKS)
+            {
+                break;
+            }
+            block_count = 0;
+
+            alarm_saadc_block_stats_t const * p_stats = &p_evt->params.block.p_stats[report_channel];
+
+            report.channel = report_channel;
+            report.min     = p_stats->min;
+            report.max     = p_stats->max;
+            report.mean    = p_stats->mean;
+            report.last    = p_stats->last;
+
+            report_channel = (report_channel + 1) % ALARM_SAADC_CH_COUNT;
+            (void)ble_alarm_sensor_update(&m_alarm, &report);
+        } break;
+
+        case ALARM_SAADC_EVT_LIMIT:
+            NRF_LOG_INFO("Channel %d crossed its %s limit.", p_evt->params.limit.channel,
+                         p_evt->params.limit.high ? "high" : "low");
+            zone_trip(p_evt->params.limit.channel);
+            report.channel = p_evt->params.limit.channel;
+            report.flags   = p_evt->params.limit.high ? BLE_ALARM_SENSOR_FLAG_LIMIT_HIGH
+                                                      : BLE_ALARM_SENSOR_FLAG_LIMIT_LOW;
+            (void)ble_alarm_sensor_update(&m_alarm, &report);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Function for handling a glass break classified by the acoustic detector.
+ *
+ * @param[in]   p_band_energy   Band energies of the block that completed the signature.
+ */
+static void glassbreak_handler(float const * p_band_energy)
+{
+    alarm_glassbreak_bench_t const * p_bench = alarm_glassbreak_bench_get();
+
+    NRF_LOG_INFO("Glass break detected (%u/%u cycles per block).",
+                 p_bench->max_cycles, p_bench->budget_cycles);
+
+    zone_trip(ZONE_GLASSBREAK);
+
+    if (!alarm_config_source_enabled(ALARM_CONFIG_SOURCE_GLASSBREAK))
+    {
+        return;
+    }
+
+    APP_ERROR_CHECK(ble_alarm_local_alarm_raise(&m_alarm, m_glassbreak_alarm, sizeof(m_glassbreak_alarm)));
+}
+
+
+/**@brief Function for initializing the analog sensor sampling pipeline.
+ */
+static void sensors_init(void)
+{
+    ret_code_t         err_code;
+    alarm_saadc_init_t saadc_init =
+    {
+        .evt_handler = saadc_evt_handler,
+        .limits      =
+        {
+            [ALARM_SAADC_CH_MIC]       = {MIC_LIMIT_LOW,                 MIC_LIMIT_HIGH},
+            [ALARM_SAADC_CH_VIBRATION] = {NRF_DRV_SAADC_LIMITL_DISABLED, VIBRATION_LIMIT_HIGH},
+            [ALARM_SAADC_CH_BATTERY]   = {BATTERY_LIMIT_LOW,             NRF_DRV_SAADC_LIMITH_DISABLED},
+        },
+    };
+
+    alarm_stats_init();
+
+    err_code = alarm_glassbreak_init(glassbreak_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = alarm_saadc_init(&saadc_init);
+    APP_ERROR_CHECK(err_code);
+}
+
+
 /**@brief Function for initializing the Connection Parameters module.
  */
 static void conn_params_init(void)
@@ -359,11 +1700,10 @@ static void conn_params_init(void)
  */
 static void application_timers_start(void)
 {
-    /* YOUR_JOB: Start your timers. below is an example of how to start a timer.
-       ret_code_t err_code;
-       err_code = app_timer_start(m_app_timer_id, TIMER_INTERVAL, NULL);
-       APP_ERROR_CHECK(err_code); */
+    ret_code_t err_code;
 
+    err_code = app_timer_start(m_stats_timer_id, STATS_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
 }
 
 
@@ -398,18 +1738,97 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
 {
     ret_code_t err_code;
 
+    if (ble_adv_evt != BLE_ADV_EVT_IDLE)
+    {
+        m_adv_mode = ble_adv_evt;
+    }
+
+    // Directed PDUs carry no data. In the other modes the Advertising module has just configured
+    // its own payload, so put the snapshot back on air.
+    m_adv_data_live = (ble_adv_evt == BLE_ADV_EVT_FAST_WHITELIST) ||
+                      (ble_adv_evt == BLE_ADV_EVT_FAST)           ||
+                      (ble_adv_evt == BLE_ADV_EVT_SLOW);
+    if (m_adv_data_live)
+    {
+        adv_snapshot_update();
+    }
+
     switch (ble_adv_evt)
     {
+        case BLE_ADV_EVT_DIRECTED_HIGH_DUTY:
+            NRF_LOG_INFO("High duty directed advertising.");
+            err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_DIRECTED);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case BLE_ADV_EVT_FAST_WHITELIST:
+            NRF_LOG_INFO("Fast advertising with whitelist.");
+            err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_WHITELIST);
+            APP_ERROR_CHECK(err_code);
+            break;
+
         case BLE_ADV_EVT_FAST:
             NRF_LOG_INFO("Fast advertising.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING);
             APP_ERROR_CHECK(err_code);
             break;
 
+        case BLE_ADV_EVT_SLOW_WHITELIST:
+            // Bonded gateways had the whitelisted phase; open up so a new one can pair.
+            err_code = ble_advertising_restart_without_whitelist(&m_advertising);
+            if (err_code != NRF_ERROR_INVALID_STATE)
+            {
+                APP_ERROR_CHECK(err_code);
+            }
+            break;
+
+        case BLE_ADV_EVT_SLOW:
+            NRF_LOG_INFO("Slow advertising.");
+            err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_SLOW);
+            APP_ERROR_CHECK(err_code);
+            break;
+
         case BLE_ADV_EVT_IDLE:
-            sleep_mode_enter();
+            // Stay in System ON: system off would stop the sensors along with the radio.
+            NRF_LOG_WARNING("Advertising stopped.");
             break;
 
+        case BLE_ADV_EVT_PEER_ADDR_REQUEST:
+        {
+            pm_peer_data_bonding_t peer_bonding_data;
+
+            // Only reply with an address if one exists; otherwise directed advertising is skipped.
+            if (m_peer_id != PM_PEER_ID_INVALID)
+            {
+                err_code = pm_peer_data_bonding_load(m_peer_id, &peer_bonding_data);
+                if (err_code != NRF_ERROR_NOT_FOUND)
+                {
+                    APP_ERROR_CHECK(err_code);
+
+                    err_code = ble_advertising_peer_addr_reply(&m_advertising,
+                                                               &peer_bonding_data.peer_ble_id.id_addr_info);
+                    APP_ERROR_CHECK(err_code);
+                }
+            }
+        } break;
+
+        case BLE_ADV_EVT_WHITELIST_REQUEST:
+        {
+            ble_gap_addr_t whitelist_addrs[BLE_GAP_WHITELIST_ADDR_MAX_COUNT];
+            ble_gap_irk_t  whitelist_irks[BLE_GAP_WHITELIST_ADDR_MAX_COUNT];
+            uint32_t       addr_cnt = BLE_GAP_WHITELIST_ADDR_MAX_COUNT;
+            uint32_t       irk_cnt  = BLE_GAP_WHITELIST_ADDR_MAX_COUNT;
+
+            err_code = pm_whitelist_get(whitelist_addrs, &addr_cnt, whitelist_irks, &irk_cnt);
+            APP_ERROR_CHECK(err_code);
+
+            // An empty whitelist makes the module advertise without one.
+            err_code = ble_advertising_whitelist_reply(&m_advertising,
+                                                       whitelist_addrs, addr_cnt,
+                                                       whitelist_irks,  irk_cnt);
+            APP_ERROR_CHECK(err_code);
+        } break;
+
         default:
             break;
     }
@@ -423,33 +1842,99 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
 static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
 {
     ret_code_t err_code = NRF_SUCCESS;
-		data_send[0] = 's';
-		data_send[1] = 0x0D;
-		data_send[2] = 0x00;
-		data_send[3] = 0x00;
-		data_send[4] = 0x0D;
+
     switch (p_ble_evt->header.evt_id)
     {
         case BLE_GAP_EVT_DISCONNECTED:
             NRF_LOG_INFO("Disconnected.");
+            (void)app_timer_stop(m_stray_timer_id);
+            (void)app_timer_stop(m_notification_timer_id);
+            m_disconnected_at   = app_timer_cnt_get();
+            m_reconnect_pending = true;
+            m_tlm_enabled = false;
+            // Reports of this link's commands must not reach the next one, whose ids restart at 0.
+            m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            NRF_LOG_INFO("Telemetry: %u raw bytes sent as %u, %u frames dropped.",
+                         m_tlm.raw_bytes, m_tlm.encoded_bytes, m_tlm.frames_dropped);
+            alarm_tx_sched_flush(&m_ble_tx);
+            alarm_radio_disarm();
+            bulk_mode_set(false);
+            tx_sched_log("BLE", &m_ble_tx);
+            ble_tx_batch_log();
+            tx_sched_log("UART", &m_uart_tx);
+            esp_stats_log();
+            ack_stats_log();
+            alarm_ack_link_reset();
+            dedup_stats_log();
+            backlog_log("ESP", &m_esp_backlog);
+            backlog_log("Peer", &m_peer_backlog);
+            NRF_LOG_INFO("Longest read authorization: %u cycles.", m_alarm.read_cycles_max);
+            NRF_LOG_INFO("Write dispatch: %u writes, %u cycles mean, %u max.",
+                         m_alarm.write_count,
+                         (m_alarm.write_count != 0) ? (m_alarm.write_cycles_sum / m_alarm.write_count) : 0,
+                         m_alarm.write_cycles_max);
+            NRF_LOG_INFO("RX writes over budget: %u alarm, %u bulk.",
+                         m_alarm.rx_rejected[BLE_ALARM_RX_CLASS_ALARM],
+                         m_alarm.rx_rejected[BLE_ALARM_RX_CLASS_BULK]);
+#if ALARM_FLOOD_ENABLED
+            flood_stats_log();
+#endif
 						nrf_gpio_pin_set(4);
-						for (uint32_t i = 0; i < 5; i++)
-						{
-							do
-							{
-								err_code = app_uart_put(data_send[i]);
-							}while(err_code == NRF_ERROR_BUSY);
-						}
+            err_code = esp_send(ALARM_FRAME_TYPE_LINK_DOWN,
+                                ALARM_TX_CLASS_ALARM,
+                                &p_ble_evt->evt.gap_evt.params.disconnected.reason,
+                                sizeof(uint8_t));
+            if (err_code != NRF_SUCCESS)
+            {
+                NRF_LOG_WARNING("Disconnect notice to the ESP dropped.");
+            }
             // LED indication will be changed when advertising starts.
             break;
 
         case BLE_GAP_EVT_CONNECTED:
+        {
+            pm_peer_id_t peer_id = PM_PEER_ID_INVALID;
+
             NRF_LOG_INFO("Connected.");
             err_code = bsp_indication_set(BSP_INDICATE_CONNECTED);
             APP_ERROR_CHECK(err_code);
             m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+            m_adv_data_live = false;
+            if (m_reconnect_pending)
+            {
+                m_reconnect_pending = false;
+                NRF_LOG_INFO("Reconnected %u ms after the drop (advertising mode %u).",
+                             ALARM_TICKS_TO_MS(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_disconnected_at)),
+                             m_adv_mode);
+            }
+            // The Peer Manager observes before the application, so a bonded peer is known here.
+            (void)pm_peer_id_get(m_conn_handle, &peer_id);
+            if ((peer_id == PM_PEER_ID_INVALID) && (pm_peer_count() > 0))
+            {
+                err_code = app_timer_start(m_stray_timer_id, STRAY_LINK_TIMEOUT, NULL);
+                APP_ERROR_CHECK(err_code);
+            }
+            m_connected_at = app_timer_cnt_get();
+            m_first_cmd_pending = true;
+            m_wakeups_at_conn      = m_wakeups;
+            m_wakeups_per_s_max    = 0;
+            m_hvn_events           = 0;
+            m_hvn_packets          = 0;
+            m_hvn_packets_max      = 0;
+            m_ble_tx_bytes_at_conn = m_ble_tx_bytes;
+            m_ble_tx_bps_max       = 0;
+            m_cmd_id = 0;
+            alarm_ack_link_reset();
             err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
             APP_ERROR_CHECK(err_code);
+            // Report RSSI changes of at least 2 dBm for the link statistics.
+            err_code = sd_ble_gap_rssi_start(m_conn_handle, 2, 0);
+            APP_ERROR_CHECK(err_code);
+        } break;
+
+        case BLE_GAP_EVT_RSSI_CHANGED:
+            alarm_stats_add(ALARM_STATS_CH_RSSI, p_ble_evt->evt.gap_evt.params.rssi_changed.rssi);
+            m_alarm.status.rssi = p_ble_evt->evt.gap_evt.params.rssi_changed.rssi;
             break;
 
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
@@ -464,6 +1949,17 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             APP_ERROR_CHECK(err_code);
         } break;
 
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+        {
+            // One event per connection event; the scheduler refills the queue ahead of the next.
+            uint8_t count = p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+
+            m_hvn_events++;
+            m_hvn_packets    += count;
+            m_hvn_packets_max = MAX(m_hvn_packets_max, count);
+            alarm_backlog_drain(&m_peer_backlog);
+        } break;
+
         case BLE_GATTC_EVT_TIMEOUT:
             // Disconnect on GATT Client timeout event.
             NRF_LOG_DEBUG("GATT Client Timeout.");
@@ -504,6 +2000,16 @@ static void ble_stack_init(void)
     err_code = nrf_sdh_ble_default_cfg_set(APP_BLE_CONN_CFG_TAG, &ram_start);
     APP_ERROR_CHECK(err_code);
 
+    // Let one connection event carry a full batch of notifications. Together with the longer
+    // NRF_SDH_BLE_GAP_EVENT_LENGTH this raises the SoftDevice RAM needs; if the application RAM
+    // start in the linker settings is too low, nrf_sdh_ble_enable() logs the minimum.
+    ble_cfg_t ble_cfg;
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                            = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = HVN_TX_QUEUE_SIZE;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+
     // Enable BLE stack.
     err_code = nrf_sdh_ble_enable(&ram_start);
     APP_ERROR_CHECK(err_code);
@@ -519,6 +2025,9 @@ static void peer_manager_init(void)
 {
     ble_gap_sec_params_t sec_param;
     ret_code_t           err_code;
+    pm_peer_id_t         lowest_peer_id;
+    uint32_t             highest_rank;
+    uint32_t             lowest_rank;
 
     err_code = pm_init();
     APP_ERROR_CHECK(err_code);
@@ -544,6 +2053,44 @@ static void peer_manager_init(void)
 
     err_code = pm_register(pm_evt_handler);
     APP_ERROR_CHECK(err_code);
+
+    // Direct the first advertising round to the gateway that was connected most recently.
+    err_code = pm_peer_ranks_get(&m_peer_id, &highest_rank, &lowest_peer_id, &lowest_rank);
+    if (err_code != NRF_SUCCESS)
+    {
+        m_peer_id = PM_PEER_ID_INVALID;
+    }
+}
+
+
+/**@brief Function for loading the bonded peers into the whitelist and the identity list.
+ *
+ * @details Peers without an identity address cannot be whitelisted by address, and peers
+ *          without an IRK need no identity resolution, so each list skips those.
+ */
+static void whitelist_set(void)
+{
+    pm_peer_id_t peer_ids[BLE_GAP_WHITELIST_ADDR_MAX_COUNT];
+    uint32_t     peer_id_count = BLE_GAP_WHITELIST_ADDR_MAX_COUNT;
+    ret_code_t   err_code;
+
+    err_code = pm_peer_id_list(peer_ids, &peer_id_count, PM_PEER_ID_INVALID, PM_PEER_ID_LIST_SKIP_NO_ID_ADDR);
+    APP_ERROR_CHECK(err_code);
+
+    NRF_LOG_INFO("Whitelisting %u bonded peers.", peer_id_count);
+
+    err_code = pm_whitelist_set((peer_id_count != 0) ? peer_ids : NULL, peer_id_count);
+    APP_ERROR_CHECK(err_code);
+
+    peer_id_count = BLE_GAP_DEVICE_IDENTITIES_MAX_COUNT;
+    err_code = pm_peer_id_list(peer_ids, &peer_id_count, PM_PEER_ID_INVALID, PM_PEER_ID_LIST_SKIP_NO_IRK);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = pm_device_identities_list_set((peer_id_count != 0) ? peer_ids : NULL, peer_id_count);
+    if (err_code != NRF_ERROR_NOT_SUPPORTED)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
 }
 
 
@@ -575,6 +2122,10 @@ static void bsp_event_handler(bsp_event_t event)
             break; // BSP_EVENT_SLEEP
 
         case BSP_EVENT_DISCONNECT:
+            if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+            {
+                break;
+            }
             err_code = sd_ble_gap_disconnect(m_conn_handle,
                                              BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
             if (err_code != NRF_ERROR_INVALID_STATE)
@@ -605,21 +2156,38 @@ static void advertising_init(void)
 {
     ret_code_t             err_code;
     ble_advertising_init_t init;
+    alarm_adv_init_t       adv_init;
 
     memset(&init, 0, sizeof(init));
 
-		init.srdata.name_type                = BLE_ADVDATA_FULL_NAME;
-		init.srdata.include_appearance			 = true;
-	
-		init.advdata.name_type							 = BLE_ADVDATA_FULL_NAME;
-		init.advdata.include_appearance			 = true;
+    // Until the first snapshot is published: the name goes in the scan response only, so the
+    // 128-bit UUID fits the legacy PDU. Extended PDUs are not scannable and carry everything.
+#if !ALARM_ADV_EXTENDED
+    init.srdata.name_type                = BLE_ADVDATA_FULL_NAME;
+    init.srdata.include_appearance       = true;
+#endif
     init.advdata.flags                   = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
     init.advdata.uuids_complete.uuid_cnt = sizeof(m_adv_uuids) / sizeof(m_adv_uuids[0]);
     init.advdata.uuids_complete.p_uuids  = m_adv_uuids;
 
-    init.config.ble_adv_fast_enabled  = true;
-    init.config.ble_adv_fast_interval = APP_ADV_INTERVAL;
-    init.config.ble_adv_fast_timeout  = APP_ADV_DURATION;
+    // Reconnect policy: high duty directed to the last gateway (1.28 s), then fast advertising
+    // to the bonded gateways only, then slow open advertising for pairing a new one.
+    init.config.ble_adv_whitelist_enabled          = true;
+    init.config.ble_adv_directed_high_duty_enabled = true;
+    init.config.ble_adv_directed_enabled           = false;
+    init.config.ble_adv_directed_interval          = 0;
+    init.config.ble_adv_directed_timeout           = 0;
+    init.config.ble_adv_fast_enabled               = true;
+    init.config.ble_adv_fast_interval              = APP_ADV_FAST_INTERVAL;
+    init.config.ble_adv_fast_timeout               = APP_ADV_FAST_DURATION;
+    init.config.ble_adv_slow_enabled               = true;
+    init.config.ble_adv_slow_interval              = APP_ADV_INTERVAL;
+    init.config.ble_adv_slow_timeout               = APP_ADV_DURATION;
+#if ALARM_ADV_EXTENDED
+    init.config.ble_adv_extended_enabled           = true;
+    init.config.ble_adv_primary_phy                = BLE_GAP_PHY_1MBPS;
+    init.config.ble_adv_secondary_phy              = BLE_GAP_PHY_2MBPS;
+#endif
 
 		init.evt_handler = on_adv_evt;
 		
@@ -629,6 +2197,10 @@ static void advertising_init(void)
     APP_ERROR_CHECK(err_code);
 
     ble_advertising_conn_cfg_tag_set(&m_advertising, APP_BLE_CONN_CFG_TAG);
+
+    adv_init.p_uuids  = m_adv_uuids;
+    adv_init.uuid_cnt = sizeof(m_adv_uuids) / sizeof(m_adv_uuids[0]);
+    alarm_adv_init(&adv_init);
 }
 
 
@@ -681,9 +2253,15 @@ static void power_management_init(void)
  */
 static void idle_state_handle(void)
 {
+    if (alarm_glassbreak_process())
+    {
+        return;
+    }
+
     if (NRF_LOG_PROCESS() == false)
     {
         nrf_pwr_mgmt_run();
+        m_wakeups++;
     }
 }
 
@@ -699,66 +2277,82 @@ static void advertising_start(bool erase_bonds)
     }
     else
     {
-        ret_code_t err_code = ble_advertising_start(&m_advertising, BLE_ADV_MODE_FAST);
+        ret_code_t err_code;
+
+        whitelist_set();
+
+        err_code = ble_advertising_start(&m_advertising, BLE_ADV_MODE_DIRECTED_HIGH_DUTY);
 
         APP_ERROR_CHECK(err_code);
     }
 }
 
-/**@brief   Function for handling app_uart events.
+/**@brief   Function for handling ESP link events.
  */
-/**@snippet [Handling the data received over UART] */
-void uart_event_handle(app_uart_evt_t * p_event)
+static void esp_evt_handler(alarm_esp_evt_t evt)
 {
-    switch (p_event->evt_type)
+    switch (evt)
     {
-        case APP_UART_DATA_READY:
+        case ALARM_ESP_EVT_TX_READY:
+            alarm_tx_sched_drain(&m_uart_tx);
+            alarm_backlog_drain(&m_esp_backlog);
             break;
 
-        case APP_UART_COMMUNICATION_ERROR:
-            APP_ERROR_HANDLER(p_event->data.error_communication);
-            break;
-
-        case APP_UART_FIFO_ERROR:
-            APP_ERROR_HANDLER(p_event->data.error_code);
+        case ALARM_ESP_EVT_LINK_UP:
+            esp_stats_log();
+            backlog_log("ESP", &m_esp_backlog);
+            alarm_backlog_drain(&m_esp_backlog);
             break;
 
         default:
             break;
     }
 }
-/**@snippet [Handling the data received over UART] */
 
-/**@brief  Function for initializing the UART module.
+/**@brief   Function for handling bytes from the ESP: acknowledgements of the peer's commands.
  */
-/**@snippet [UART Initialization] */
-static void uart_init(void)
+static void esp_rx_handler(uint8_t const * p_data, uint16_t length)
 {
-    uint32_t                     err_code;
-    app_uart_comm_params_t const comm_params =
+    alarm_frame_t frame;
+
+    for (uint16_t i = 0; i < length; i++)
     {
-        .rx_pin_no    = RX_PIN_NUMBER,
-        .tx_pin_no    = TX_PIN_NUMBER,
-        .rts_pin_no   = RTS_PIN_NUMBER,
-        .cts_pin_no   = CTS_PIN_NUMBER,
-        .flow_control = APP_UART_FLOW_CONTROL_DISABLED,
-        .use_parity   = false,
-#if defined (UART_PRESENT)
-        .baud_rate    = NRF_UART_BAUDRATE_115200
-#else
-        .baud_rate    = NRF_UARTE_BAUDRATE_115200
-#endif
-    };
+        if (!alarm_frame_rx_put(&m_esp_rx, p_data[i], &frame))
+        {
+            continue;
+        }
+
+        if ((frame.type == ALARM_FRAME_TYPE_ACK) && (frame.length >= 1))
+        {
+            alarm_ack_rx(frame.p_payload[0]);
+        }
+    }
+}
 
-    APP_UART_FIFO_INIT(&comm_params,
-                       UART_RX_BUF_SIZE,
-                       UART_TX_BUF_SIZE,
-                       uart_event_handle,
-                       APP_IRQ_PRIORITY_LOWEST,
-                       err_code);
+/**@brief  Function for initializing the UART link to the ESP.
+ *
+ * @details Uses app_timer for the rate negotiation, so it runs after timers_init().
+ */
+static void esp_init(void)
+{
+    ret_code_t       err_code;
+    alarm_esp_init_t init;
+
+    init.rx_pin       = RX_PIN_NUMBER;
+    init.tx_pin       = TX_PIN_NUMBER;
+    init.rts_pin      = RTS_PIN_NUMBER;
+    init.cts_pin      = CTS_PIN_NUMBER;
+    init.hwfc         = true;
+    init.wake_out_pin = ESP_WAKE_OUT_PIN;
+    init.wake_in_pin  = ESP_WAKE_IN_PIN;
+    init.evt_handler  = esp_evt_handler;
+    init.rx_handler   = esp_rx_handler;
+
+    alarm_frame_rx_init(&m_esp_rx);
+
+    err_code = alarm_esp_init(&init);
     APP_ERROR_CHECK(err_code);
 }
-/**@snippet [UART Initialization] */
 
 /**@brief Function for application main entry.
  */
@@ -767,24 +2361,40 @@ int main(void)
     bool erase_bonds;
 
     // Initialize.
-		uart_init();
     log_init();
     timers_init();
+    esp_init();
+    tx_sched_init();
+    ack_init();
+    dedup_init();
     buttons_leds_init(&erase_bonds);
     power_management_init();
     ble_stack_init();
+    ble_tx_batch_init();
     gap_params_init();
+    tlm_init();
     gatt_init();
 	  services_init();
     advertising_init();
     conn_params_init();
+    config_init();
+    backlog_init();
     peer_manager_init();
+    layout_init();
+#if ALARM_FLOOD_ENABLED
+    flood_init();
+#endif
+    sensors_init();
 
     // Start execution.
     NRF_LOG_INFO("Template example started.");
     application_timers_start();
 
     advertising_start(erase_bonds);
+#if ALARM_RELAY_ENABLED
+    relay_init();
+#endif
+    alarm_saadc_start();
 
     // Enter main loop.
     for (;;)